@@ -1,5 +1,6 @@
 #include "Audio.hpp"
 #include "file/Auport.hpp"
+#include "file/ClipCache.hpp"
 #include "io/Alsa.hpp"
 #include <spdlog/spdlog.h>
 
@@ -8,6 +9,7 @@
 #include <iostream>
 #include <termios.h>
 #include <unistd.h>
+#include <vector>
 
 void print_version () {
     spdlog::info ("Bouillabaisse version \"{}\"", VERSION);
@@ -57,19 +59,12 @@ int main (int argc, char *argv[]) {
 
     if (!n_format.verify ()) { return 1; }
 
-    char *buffer = new char[buffer_size];
-
-    reader.read_chunk (buffer, buffer_size);
-
-    uint32_t new_buffer_size
-        = au_convert_buffer_size (s_format, n_format, buffer_size);
-
-    char *buffer2 = new char[new_buffer_size];
-
-    au_convert_buffer (s_format, n_format, buffer, buffer_size, buffer2);
+    auClipRef clip = auClipCache::get ().load (
+        "test.wav", AudioFileFormat::AudioFFWav, n_format);
+    if (!clip) { return 1; }
 
     auFileWriter writer ("test2.wav", AudioFileFormat::AudioFFWav, n_format);
-    writer.write_chunk (buffer2, new_buffer_size);
+    writer.write_chunk (clip->data.data (), clip->get_size ());
 
     // if (output_devices.size () > 0) {
     //     auto &output_device = output_devices[0];
@@ -91,8 +86,5 @@ int main (int argc, char *argv[]) {
     //    buffer + data_read, (buffer_size % second_size)
     //                / (s_format.channels * (s_format.bit_depth) / 8));
 
-    delete[] buffer;
-    delete[] buffer2;
-
     return 0;
 }
@@ -1,4 +1,5 @@
 #include "Audio.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <spdlog/spdlog.h>
@@ -1059,4 +1060,150 @@ bool au_convert_buffer (auSFormat from, auSFormat to, char *from_buf,
     return au_convert_call_table[(int32_t)from.data_type]
                                 [(int32_t)to.data_type](from, to, from_buf,
                                                         fromsize, to_buf);
-}
\ No newline at end of file
+}
+
+template <typename F>
+static void __to_planar (auSFormat from, auSFormat to, const char *from_buf,
+                         size_t fromsize, float **planes, F read) {
+    size_t sample_size     = from.bit_depth / 8;
+    size_t from_frame_size = sample_size * from.channels;
+    size_t from_num_frames = fromsize / from_frame_size;
+
+    if (from.channels == to.channels) {
+        for (size_t j = 0; j < to.channels; j++) {
+            const char *src = from_buf + j * sample_size;
+            for (size_t i = 0; i < from_num_frames; i++) {
+                planes[j][i] = read (src + i * from_frame_size);
+            }
+        }
+    } else if (from.channels > to.channels) {
+        size_t group_size
+            = size_t (ceil (from.channels / float (to.channels)));
+        for (size_t j = 0; j < to.channels; j++) {
+            size_t first = j * group_size;
+            if (first >= from.channels) {
+                memset (planes[j], 0, from_num_frames * sizeof (float));
+                continue;
+            }
+            size_t count = std::min (group_size, from.channels - first);
+            for (size_t i = 0; i < from_num_frames; i++) {
+                float sum = 0;
+                for (size_t l = 0; l < count; l++) {
+                    sum += read (from_buf + i * from_frame_size
+                                 + (first + l) * sample_size);
+                }
+                planes[j][i] = sum / float (count);
+            }
+        }
+    } else {
+        for (size_t j = 0; j < to.channels; j++) {
+            if (j >= from.channels) {
+                memset (planes[j], 0, from_num_frames * sizeof (float));
+                continue;
+            }
+            const char *src = from_buf + j * sample_size;
+            for (size_t i = 0; i < from_num_frames; i++) {
+                planes[j][i] = read (src + i * from_frame_size);
+            }
+        }
+    }
+}
+
+bool au_can_convert_to_planar (auSFormat format) {
+    switch (format.data_type) {
+    case auDtype::sInt:
+        return format.bit_depth == 8 || format.bit_depth == 16
+               || format.bit_depth == 24 || format.bit_depth == 32;
+    case auDtype::uInt:
+        return format.bit_depth >= 8 && format.bit_depth <= 32
+               && format.bit_depth % 8 == 0;
+    case auDtype::sFloat:
+        return format.bit_depth == 32;
+    case auDtype::sDouble:
+        return format.bit_depth == 64;
+    default:
+        return false;
+    }
+}
+
+bool au_convert_to_planar (auSFormat from, auSFormat to, const char *from_buf,
+                           size_t fromsize, float **planes) {
+    if (from.sample_rate != to.sample_rate) {
+        spdlog::error ("unimplemented: upsampling/downsampling");
+        return false;
+    }
+    if (!from.verify () || !to.verify ()) { return false; }
+    if (to.data_type != auDtype::sFloat) {
+        spdlog::error ("Planar conversion only targets float!");
+        return false;
+    }
+
+    switch (from.data_type) {
+    case auDtype::sInt:
+        switch (from.bit_depth) {
+        case 8:
+            __to_planar (from, to, from_buf, fromsize, planes,
+                         [] (const char *p) { return int8_t (*p) / 128.0f; });
+            return true;
+        case 16:
+            __to_planar (from, to, from_buf, fromsize, planes,
+                         [] (const char *p) {
+                             int16_t s;
+                             memcpy (&s, p, 2);
+                             return s / 32768.0f;
+                         });
+            return true;
+        case 24:
+            __to_planar (from, to, from_buf, fromsize, planes,
+                         [] (const char *p) {
+                             int32_t s = 0;
+                             memcpy (reinterpret_cast<char *> (&s) + 1, p, 3);
+                             return (s >> 8) / 8388608.0f;
+                         });
+            return true;
+        case 32:
+            __to_planar (from, to, from_buf, fromsize, planes,
+                         [] (const char *p) {
+                             int32_t s;
+                             memcpy (&s, p, 4);
+                             return s / 2147483648.0f;
+                         });
+            return true;
+        default:
+            break;
+        }
+        break;
+    case auDtype::uInt:
+        __to_planar (from, to, from_buf, fromsize, planes,
+                     [&] (const char *p) {
+                         uint64_t u = 0;
+                         memcpy (&u, p, from.bit_depth / 8);
+                         return __s_to_f (__u_to_s (u, from.bit_depth),
+                                          from.bit_depth);
+                     });
+        return true;
+    case auDtype::sFloat:
+        __to_planar (from, to, from_buf, fromsize, planes,
+                     [] (const char *p) {
+                         float f;
+                         memcpy (&f, p, 4);
+                         return f;
+                     });
+        return true;
+    case auDtype::sDouble:
+        __to_planar (from, to, from_buf, fromsize, planes,
+                     [] (const char *p) {
+                         double d;
+                         memcpy (&d, p, 8);
+                         return float (d);
+                     });
+        return true;
+    default:
+        break;
+    }
+
+    spdlog::error ("unimplemented: planar conversion from data type {} with "
+                   "bit depth {}",
+                   int (from.data_type), from.bit_depth);
+    return false;
+}
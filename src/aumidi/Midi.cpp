@@ -0,0 +1,450 @@
+#include "spdlog/spdlog.h"
+#include <Midi.hpp>
+#include <algorithm>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <util/time.h>
+
+// how often the output thread looks for due events
+#define MI_OUTPUT_TICK_NS 500000
+
+static uint8_t message_size (uint8_t status) {
+    if (status < 0xF0) {
+        return (status & 0xE0) == 0xC0 ? 2 : 3; // program, channel pressure
+    }
+    switch (status) {
+    case 0xF1: // time code
+    case 0xF3: // song select
+        return 2;
+    case 0xF2: // song position
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+bool miParser::feed (uint8_t byte, miEvent *out) {
+    if (byte >= 0xF8) {
+        // real-time messages may appear anywhere, even inside others
+        out->size    = 1;
+        out->data[0] = byte;
+        return true;
+    }
+    if (byte & 0x80) {
+        sysex = byte == 0xF0;
+        count = 0;
+        if (byte == 0xF7 || sysex) {
+            status = 0;
+            return false;
+        }
+        expected = message_size (byte) - 1;
+        // system common messages cancel running status
+        status = byte;
+        if (expected == 0) {
+            out->size    = 1;
+            out->data[0] = byte;
+            status       = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (sysex || !status) return false;
+    data[count++] = byte;
+    if (count < expected) return false;
+
+    out->size    = expected + 1;
+    out->data[0] = status;
+    out->data[1] = data[0];
+    out->data[2] = expected > 1 ? data[1] : 0;
+    count        = 0;
+    if (status >= 0xF0) status = 0;
+    return true;
+}
+
+static std::vector<miPortInfo> list_ports (bool inputs) {
+    std::vector<miPortInfo> ports;
+
+    snd_seq_t *seq;
+    if (snd_seq_open (&seq, "default", SND_SEQ_OPEN_DUPLEX, 0) >= 0) {
+        unsigned int want = inputs ? SND_SEQ_PORT_CAP_READ
+                                         | SND_SEQ_PORT_CAP_SUBS_READ
+                                   : SND_SEQ_PORT_CAP_WRITE
+                                         | SND_SEQ_PORT_CAP_SUBS_WRITE;
+
+        snd_seq_client_info_t *client;
+        snd_seq_port_info_t   *port;
+        snd_seq_client_info_alloca (&client);
+        snd_seq_port_info_alloca (&port);
+        snd_seq_client_info_set_client (client, -1);
+        while (snd_seq_query_next_client (seq, client) >= 0) {
+            int id = snd_seq_client_info_get_client (client);
+            if (id == SND_SEQ_CLIENT_SYSTEM) continue;
+
+            snd_seq_port_info_set_client (port, id);
+            snd_seq_port_info_set_port (port, -1);
+            while (snd_seq_query_next_port (seq, port) >= 0) {
+                unsigned int caps = snd_seq_port_info_get_capability (port);
+                if ((caps & want) != want
+                    || (caps & SND_SEQ_PORT_CAP_NO_EXPORT)
+                    || !(snd_seq_port_info_get_type (port)
+                         & SND_SEQ_PORT_TYPE_MIDI_GENERIC)) {
+                    continue;
+                }
+                ports.push_back (
+                    { fmt::format ("seq:{}:{}", id,
+                                   snd_seq_port_info_get_port (port)),
+                      snd_seq_port_info_get_name (port), miPortSeq });
+            }
+        }
+        snd_seq_close (seq);
+    } else {
+        spdlog::warn ("No ALSA sequencer, listing raw MIDI devices only");
+    }
+
+    void **hints;
+    if (snd_device_name_hint (-1, "rawmidi", &hints) < 0) return ports;
+    for (void **hint = hints; *hint; hint++) {
+        char *name = snd_device_name_get_hint (*hint, "NAME");
+        char *desc = snd_device_name_get_hint (*hint, "DESC");
+        char *ioid = snd_device_name_get_hint (*hint, "IOID");
+
+        // no IOID means both directions
+        bool match = !ioid
+                     || std::string (ioid) == (inputs ? "Input" : "Output");
+        if (name && match) {
+            ports.push_back ({ std::string ("raw:") + name,
+                               desc ? desc : name, miPortRaw });
+        }
+        free (name);
+        free (desc);
+        free (ioid);
+    }
+    snd_device_name_free_hint (hints);
+    return ports;
+}
+
+std::vector<miPortInfo> mi_list_inputs () { return list_ports (true); }
+
+std::vector<miPortInfo> mi_list_outputs () { return list_ports (false); }
+
+// opens our own sequencer client with one port connected to `address`
+static int open_seq (snd_seq_t **seq, int *port, const std::string &address,
+                     bool input) {
+    int err;
+    if ((err = snd_seq_open (seq, "default",
+                             input ? SND_SEQ_OPEN_INPUT : SND_SEQ_OPEN_OUTPUT,
+                             SND_SEQ_NONBLOCK))
+        < 0) {
+        spdlog::error ("Failed to open the ALSA sequencer: {}",
+                       snd_strerror (err));
+        return err;
+    }
+    snd_seq_set_client_name (*seq, "bouillabaisse");
+
+    snd_seq_addr_t addr;
+    if ((err = snd_seq_parse_address (*seq, &addr, address.c_str ())) < 0) {
+        spdlog::error ("No sequencer port {}: {}", address,
+                       snd_strerror (err));
+        snd_seq_close (*seq);
+        *seq = nullptr;
+        return err;
+    }
+
+    unsigned int caps
+        = input ? SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE
+                : SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+    if ((*port = snd_seq_create_simple_port (
+             *seq, input ? "in" : "out", caps,
+             SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION))
+        < 0) {
+        err = *port;
+    } else if (input) {
+        err = snd_seq_connect_from (*seq, *port, addr.client, addr.port);
+    } else {
+        err = snd_seq_connect_to (*seq, *port, addr.client, addr.port);
+    }
+    if (err < 0) {
+        spdlog::error ("Failed to connect to sequencer port {}: {}", address,
+                       snd_strerror (err));
+        snd_seq_close (*seq);
+        *seq = nullptr;
+        return err;
+    }
+    return 0;
+}
+
+miInput::~miInput () { close (); }
+
+int miInput::open (const std::string &id, auEngineParams params) {
+    if (is_open ()) close ();
+
+    int err;
+    if (id.starts_with ("seq:")) {
+        if ((err = open_seq (&seq, &port, id.substr (4), true)) < 0) {
+            return err;
+        }
+        if ((err = snd_midi_event_new (16, &decoder)) < 0) {
+            close ();
+            return err;
+        }
+        // every event comes out with its status byte
+        snd_midi_event_no_status (decoder, 1);
+    } else if (id.starts_with ("raw:")) {
+        if ((err = snd_rawmidi_open (&raw, nullptr, id.c_str () + 4,
+                                     SND_RAWMIDI_NONBLOCK))
+            < 0) {
+            spdlog::error ("Failed to open MIDI input {}: {}", id,
+                           snd_strerror (err));
+            raw = nullptr;
+            return err;
+        }
+    } else {
+        spdlog::error ("Unknown MIDI port {}", id);
+        return -EINVAL;
+    }
+
+    if ((wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        err = -errno;
+        close ();
+        return err;
+    }
+
+    parser   = miParser ();
+    has_held = false;
+    running  = true;
+    thread   = std::thread (&miInput::run, this);
+    au_make_realtime (thread, params);
+
+    spdlog::info ("Opened MIDI input {}", id);
+    return 0;
+}
+
+void miInput::close () {
+    running = false;
+    if (thread.joinable ()) {
+        uint64_t one = 1;
+        if (write (wake_fd, &one, sizeof (one)) < 0) {
+            spdlog::warn ("Failed to wake MIDI input: {}", strerror (errno));
+        }
+        thread.join ();
+    }
+    if (wake_fd >= 0) ::close (wake_fd);
+    wake_fd = -1;
+
+    if (decoder) snd_midi_event_free (decoder);
+    if (seq) snd_seq_close (seq);
+    if (raw) snd_rawmidi_close (raw);
+    decoder = nullptr;
+    seq     = nullptr;
+    raw     = nullptr;
+}
+
+void miInput::push (const miEvent &event) {
+    if (queue.write (&event, 1) == 0) {
+        overruns.fetch_add (1, std::memory_order_relaxed);
+    }
+}
+
+void miInput::read_seq () {
+    uint64_t now = au_now_ns ();
+
+    snd_seq_event_t *ev;
+    int              err;
+    while ((err = snd_seq_event_input (seq, &ev)) >= 0 || err == -ENOSPC) {
+        if (err == -ENOSPC) {
+            // the kernel's buffer overflowed, events are gone
+            overruns.fetch_add (1, std::memory_order_relaxed);
+            continue;
+        }
+        unsigned char buf[16];
+        long          size = snd_midi_event_decode (decoder, buf, 16, ev);
+        if (size < 1 || size > 3) continue; // sysex and non-MIDI events
+
+        miEvent event { now, uint8_t (size), {} };
+        memcpy (event.data, buf, size);
+        push (event);
+    }
+}
+
+void miInput::read_raw () {
+    uint64_t now = au_now_ns ();
+
+    uint8_t buf[256];
+    ssize_t size;
+    while ((size = snd_rawmidi_read (raw, buf, sizeof (buf))) > 0) {
+        for (ssize_t i = 0; i < size; i++) {
+            miEvent event { now, 0, {} };
+            if (parser.feed (buf[i], &event)) push (event);
+        }
+    }
+}
+
+void miInput::run () {
+    std::vector<pollfd> fds (1, { wake_fd, POLLIN, 0 });
+    int count = seq ? snd_seq_poll_descriptors_count (seq, POLLIN)
+                    : snd_rawmidi_poll_descriptors_count (raw);
+    fds.resize (1 + count);
+    if (seq) {
+        snd_seq_poll_descriptors (seq, &fds[1], count, POLLIN);
+    } else {
+        snd_rawmidi_poll_descriptors (raw, &fds[1], count);
+    }
+
+    while (running.load (std::memory_order_relaxed)) {
+        if (poll (fds.data (), fds.size (), -1) < 0) {
+            if (errno == EINTR) continue;
+            spdlog::error ("MIDI input poll failed: {}", strerror (errno));
+            break;
+        }
+        if (fds[0].revents) break;
+
+        if (seq) {
+            read_seq ();
+        } else {
+            read_raw ();
+        }
+    }
+}
+
+size_t miInput::read_block (uint64_t block_ns, unsigned int sample_rate,
+                            size_t frames, miBlockEvent *out, size_t max) {
+    uint64_t period_ns = uint64_t (frames) * 1000000000 / sample_rate;
+    uint64_t window    = block_ns > period_ns ? block_ns - period_ns : 0;
+
+    size_t count = 0;
+    while (count < max) {
+        if (!has_held && queue.read (&held, 1) == 0) break;
+        has_held = true;
+        if (held.time_ns >= block_ns) break; // next block's
+
+        uint64_t offset = 0;
+        if (held.time_ns >= window) {
+            offset = (held.time_ns - window) * sample_rate / 1000000000;
+            offset = std::min<uint64_t> (offset, frames - 1);
+        } else {
+            late.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        miBlockEvent &e = out[count++];
+        e.offset        = uint32_t (offset);
+        e.size          = held.size;
+        memcpy (e.data, held.data, sizeof (e.data));
+        has_held = false;
+    }
+    return count;
+}
+
+miOutput::~miOutput () { close (); }
+
+int miOutput::open (const std::string &id, auEngineParams params) {
+    if (is_open ()) close ();
+
+    int err;
+    if (id.starts_with ("seq:")) {
+        if ((err = open_seq (&seq, &port, id.substr (4), false)) < 0) {
+            return err;
+        }
+        if ((err = snd_midi_event_new (16, &encoder)) < 0
+            || (err = snd_midi_event_new (16, &thread_encoder)) < 0) {
+            close ();
+            return err;
+        }
+    } else if (id.starts_with ("raw:")) {
+        if ((err = snd_rawmidi_open (nullptr, &raw, id.c_str () + 4, 0))
+            < 0) {
+            spdlog::error ("Failed to open MIDI output {}: {}", id,
+                           snd_strerror (err));
+            raw = nullptr;
+            return err;
+        }
+    } else {
+        spdlog::error ("Unknown MIDI port {}", id);
+        return -EINVAL;
+    }
+
+    waiting.clear ();
+    waiting.reserve (MI_QUEUE_SIZE);
+    running = true;
+    thread  = std::thread (&miOutput::run, this);
+    au_make_realtime (thread, params);
+
+    spdlog::info ("Opened MIDI output {}", id);
+    return 0;
+}
+
+void miOutput::close () {
+    running = false;
+    if (thread.joinable ()) thread.join ();
+
+    std::lock_guard<std::mutex> lock (device_mutex);
+    if (encoder) snd_midi_event_free (encoder);
+    if (thread_encoder) snd_midi_event_free (thread_encoder);
+    if (seq) snd_seq_close (seq);
+    if (raw) snd_rawmidi_close (raw);
+    encoder        = nullptr;
+    thread_encoder = nullptr;
+    seq            = nullptr;
+    raw            = nullptr;
+}
+
+int miOutput::write (snd_midi_event_t *enc, const uint8_t *data,
+                     size_t size) {
+    std::lock_guard<std::mutex> lock (device_mutex);
+    if (raw) {
+        ssize_t written = snd_rawmidi_write (raw, data, size);
+        return written < 0 ? int (written) : 0;
+    }
+    if (!seq) return -EBADF;
+
+    snd_midi_event_reset_encode (enc);
+    for (size_t i = 0; i < size; i++) {
+        snd_seq_event_t ev;
+        snd_seq_ev_clear (&ev);
+        if (snd_midi_event_encode_byte (enc, data[i], &ev) <= 0) {
+            continue; // incomplete
+        }
+        snd_seq_ev_set_source (&ev, port);
+        snd_seq_ev_set_subs (&ev);
+        snd_seq_ev_set_direct (&ev);
+        int err = snd_seq_event_output_direct (seq, &ev);
+        if (err < 0) return err;
+    }
+    return 0;
+}
+
+int miOutput::send (const uint8_t *data, size_t size) {
+    return write (encoder, data, size);
+}
+
+bool miOutput::schedule (const miEvent &event) {
+    if (queue.write (&event, 1) == 1) return true;
+    overruns.fetch_add (1, std::memory_order_relaxed);
+    return false;
+}
+
+void miOutput::run () {
+    auto later = [] (const miEvent &a, const miEvent &b) {
+        return a.time_ns > b.time_ns;
+    };
+
+    while (running.load (std::memory_order_relaxed)) {
+        miEvent event;
+        while (waiting.size () < MI_QUEUE_SIZE && queue.read (&event, 1)) {
+            waiting.push_back (event);
+            std::push_heap (waiting.begin (), waiting.end (), later);
+        }
+
+        uint64_t now = au_now_ns ();
+        while (!waiting.empty () && waiting.front ().time_ns <= now) {
+            std::pop_heap (waiting.begin (), waiting.end (), later);
+            write (thread_encoder, waiting.back ().data,
+                   waiting.back ().size);
+            waiting.pop_back ();
+        }
+
+        timespec tick { 0, MI_OUTPUT_TICK_NS };
+        clock_nanosleep (CLOCK_MONOTONIC, 0, &tick, nullptr);
+    }
+}
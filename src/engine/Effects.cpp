@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <engine/Effects.hpp>
+
+// 20 * log10 (2), decibels per log2 unit
+#define AU_DB_PER_LOG2 6.0205999f
+
+// keeps the detector's log out of -inf on digital silence
+#define AU_DETECTOR_FLOOR 1e-9f
+
+bool au_biquad_design (const auEqBand &band, float sample_rate,
+                       auBiquadCoefs *out) {
+    if (band.type == auEqOff || band.freq <= 0.f
+        || band.freq >= sample_rate * 0.5f) {
+        return false;
+    }
+    bool shaping = band.type == auEqBell || band.type == auEqLowShelf
+                   || band.type == auEqHighShelf;
+    if (shaping && band.gain_db == 0.f) return false;
+
+    double w0    = 2.0 * M_PI * band.freq / sample_rate;
+    double cw    = cos (w0);
+    double alpha = sin (w0) / (2.0 * std::max (band.q, 0.05f));
+    double a     = pow (10.0, band.gain_db / 40.0);
+    double sq    = 2.0 * sqrt (a) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (band.type) {
+    case auEqBell:
+        b0 = 1.0 + alpha * a;
+        b1 = -2.0 * cw;
+        b2 = 1.0 - alpha * a;
+        a0 = 1.0 + alpha / a;
+        a1 = -2.0 * cw;
+        a2 = 1.0 - alpha / a;
+        break;
+    case auEqLowShelf:
+        b0 = a * ((a + 1.0) - (a - 1.0) * cw + sq);
+        b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cw);
+        b2 = a * ((a + 1.0) - (a - 1.0) * cw - sq);
+        a0 = (a + 1.0) + (a - 1.0) * cw + sq;
+        a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cw);
+        a2 = (a + 1.0) + (a - 1.0) * cw - sq;
+        break;
+    case auEqHighShelf:
+        b0 = a * ((a + 1.0) + (a - 1.0) * cw + sq);
+        b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cw);
+        b2 = a * ((a + 1.0) + (a - 1.0) * cw - sq);
+        a0 = (a + 1.0) - (a - 1.0) * cw + sq;
+        a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cw);
+        a2 = (a + 1.0) - (a - 1.0) * cw - sq;
+        break;
+    case auEqLowCut:
+        b0 = (1.0 + cw) * 0.5;
+        b1 = -(1.0 + cw);
+        b2 = b0;
+        a0 = 1.0 + alpha;
+        a1 = -2.0 * cw;
+        a2 = 1.0 - alpha;
+        break;
+    case auEqHighCut:
+        b0 = (1.0 - cw) * 0.5;
+        b1 = 1.0 - cw;
+        b2 = b0;
+        a0 = 1.0 + alpha;
+        a1 = -2.0 * cw;
+        a2 = 1.0 - alpha;
+        break;
+    default:
+        return false;
+    }
+
+    out->b0 = float (b0 / a0);
+    out->b1 = float (b1 / a0);
+    out->b2 = float (b2 / a0);
+    out->a1 = float (a1 / a0);
+    out->a2 = float (a2 / a0);
+    return true;
+}
+
+auEqNode::auEqNode (unsigned int channels) :
+    channels (channels),
+    state (AU_EQ_MAX_BANDS * channels * sizeof (float), 2),
+    z1 (static_cast<float *> (state.acquire ())),
+    z2 (static_cast<float *> (state.acquire ())) {
+    pack = 1;
+    while (pack < channels && pack < AU_VEC_WIDTH) pack <<= 1;
+}
+
+bool auEqNode::push_band (unsigned int band) {
+    Change c;
+    c.band   = band;
+    c.active = au_biquad_design (bands[band], sample_rate.load (), &c.coefs);
+    return changes.push (c);
+}
+
+bool auEqNode::set_band (unsigned int band, const auEqBand &params) {
+    if (band >= AU_EQ_MAX_BANDS) return false;
+    bands[band] = params;
+    return push_band (band);
+}
+
+void auEqNode::prepare (unsigned int rate, size_t max_frames) {
+    if (float (rate) == sample_rate.load ()) return;
+    sample_rate.store (float (rate));
+    for (unsigned int band = 0; band < AU_EQ_MAX_BANDS; band++) {
+        if (bands[band].type != auEqOff) push_band (band);
+    }
+}
+
+// one pass of up to AU_VEC_WIDTH / C bands over C channel planes, lane
+// slot * C + c holds channel c of the slot's band
+struct auBiquadLanes {
+    auVec8 b0, b1, b2, a1, a2;
+    auVec8 z1, z2;
+};
+
+// the previous step's outputs move up a slot, the next frame enters slot 0
+template <unsigned int C>
+AU_VEC_INLINE auVec8 shift_in (const auVec8 &y, const auVec8 &x) {
+    if constexpr (C == 1) {
+        return __builtin_shufflevector (y, x, 8, 0, 1, 2, 3, 4, 5, 6);
+    } else if constexpr (C == 2) {
+        return __builtin_shufflevector (y, x, 8, 9, 0, 1, 2, 3, 4, 5);
+    } else if constexpr (C == 4) {
+        return __builtin_shufflevector (y, x, 8, 9, 10, 11, 0, 1, 2, 3);
+    } else {
+        return x;
+    }
+}
+
+// slot s handles frame t - s at step t. only the first and last few steps
+// have slots outside the block, those keep their state untouched. frames go
+// through a transposed chunk so every step loads and stores whole vectors
+template <unsigned int C>
+static void run_pass (auBiquadLanes &q, const float *const *src,
+                      float *const *dst, float *buf, unsigned int width,
+                      size_t frames) {
+    constexpr unsigned int slots = AU_VEC_WIDTH / C;
+    constexpr unsigned int last  = (slots - 1) * C;
+
+    auMask8 slot;
+    for (int l = 0; l < AU_VEC_WIDTH; l++) slot[l] = l / C;
+
+    auVec8 z1 = q.z1, z2 = q.z2;
+    auVec8 y  = au_vec_set1 (0.f);
+    size_t steps = frames + slots - 1;
+    for (size_t done = 0; done < steps; done += AU_PARAM_CHUNK) {
+        size_t n = std::min<size_t> (steps - done, AU_PARAM_CHUNK);
+
+        memset (buf, 0, AU_PARAM_CHUNK * AU_VEC_WIDTH * sizeof (float));
+        size_t in = done < frames ? std::min (n, frames - done) : 0;
+        for (unsigned int c = 0; c < width; c++) {
+            const float *p = src[c] + done;
+            for (size_t i = 0; i < in; i++) buf[i * AU_VEC_WIDTH + c] = p[i];
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            size_t t = done + i;
+            auVec8 x = shift_in<C> (y, au_vec_load (buf + i * AU_VEC_WIDTH));
+
+            auVec8 out = q.b0 * x + z1;
+            auVec8 n1  = (q.b1 * x + z2) - q.a1 * out;
+            auVec8 n2  = q.b2 * x - q.a2 * out;
+            if (t + 1 >= slots && t < frames) {
+                z1 = n1;
+                z2 = n2;
+            } else {
+                auMask8 frame = int32_t (t) - slot;
+                auMask8 valid = (frame >= 0) & (frame < int32_t (frames));
+                z1            = au_vec_select (valid, n1, z1);
+                z2            = au_vec_select (valid, n2, z2);
+            }
+            y = out;
+            au_vec_store (buf + i * AU_VEC_WIDTH, out);
+        }
+
+        // the last slot's lanes are finished frames, slots - 1 behind
+        size_t skip = done + 1 < slots ? slots - 1 - done : 0;
+        for (unsigned int c = 0; c < width; c++) {
+            float *p = dst[c];
+            for (size_t i = skip; i < n; i++) {
+                p[done + i + 1 - slots] = buf[i * AU_VEC_WIDTH + last + c];
+            }
+        }
+    }
+    q.z1 = z1;
+    q.z2 = z2;
+}
+
+void auEqNode::process (const float *const *inputs, float *const *outputs,
+                        size_t frames) {
+    Change c;
+    while (changes.pop (&c)) {
+        // a band coming back on starts from rest instead of stale state
+        if (c.active && !active[c.band] && z2) {
+            memset (&z1[c.band * channels], 0, channels * sizeof (float));
+            memset (&z2[c.band * channels], 0, channels * sizeof (float));
+        }
+        active[c.band] = c.active;
+        coefs[c.band]  = c.coefs;
+    }
+
+    unsigned int used[AU_EQ_MAX_BANDS];
+    unsigned int used_count = 0;
+    for (unsigned int band = 0; band < AU_EQ_MAX_BANDS; band++) {
+        if (active[band]) used[used_count++] = band;
+    }
+    // the transposed chunk, without it or state the strip is bypassed
+    float *buf = au_scratch<float> (AU_PARAM_CHUNK * AU_VEC_WIDTH);
+    if (!used_count || !buf || !z2) {
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            if (outputs[ch] != inputs[ch]) {
+                memcpy (outputs[ch], inputs[ch], frames * sizeof (float));
+            }
+        }
+        return;
+    }
+
+    unsigned int slots = AU_VEC_WIDTH / pack;
+    for (unsigned int first = 0; first < channels; first += pack) {
+        unsigned int       width = std::min (pack, channels - first);
+        const float *const *src  = inputs + first;
+
+        for (unsigned int base = 0; base < used_count; base += slots) {
+            // slots past the last band pass their input straight through
+            auBiquadLanes q {};
+            q.b0 = au_vec_set1 (1.f);
+            for (unsigned int s = 0; s < slots && base + s < used_count;
+                 s++) {
+                unsigned int         band = used[base + s];
+                const auBiquadCoefs &k    = coefs[band];
+                for (unsigned int ch = 0; ch < width; ch++) {
+                    unsigned int l = s * pack + ch;
+                    size_t       i = band * channels + first + ch;
+                    q.b0[l]        = k.b0;
+                    q.b1[l]        = k.b1;
+                    q.b2[l]        = k.b2;
+                    q.a1[l]        = k.a1;
+                    q.a2[l]        = k.a2;
+                    q.z1[l]        = z1[i];
+                    q.z2[l]        = z2[i];
+                }
+            }
+
+            switch (pack) {
+            case 1:
+                run_pass<1> (q, src, outputs + first, buf, width, frames);
+                break;
+            case 2:
+                run_pass<2> (q, src, outputs + first, buf, width, frames);
+                break;
+            case 4:
+                run_pass<4> (q, src, outputs + first, buf, width, frames);
+                break;
+            default:
+                run_pass<8> (q, src, outputs + first, buf, width, frames);
+                break;
+            }
+
+            for (unsigned int s = 0; s < slots && base + s < used_count;
+                 s++) {
+                unsigned int band = used[base + s];
+                for (unsigned int ch = 0; ch < width; ch++) {
+                    size_t i = band * channels + first + ch;
+                    z1[i]    = q.z1[s * pack + ch];
+                    z2[i]    = q.z2[s * pack + ch];
+                }
+            }
+            // later passes continue on what this one wrote
+            src = outputs + first;
+        }
+    }
+}
+
+// log2 from the exponent bits and a quadratic over the mantissa, within
+// 0.005 (0.03 dB), plenty for a detector
+AU_VEC_INLINE auVec8 fast_log2 (auVec8 x) {
+    auMask8 bits;
+    memcpy (&bits, &x, sizeof (bits));
+    auVec8 e = __builtin_convertvector ((bits >> 23) & 0xFF, auVec8) - 128.f;
+    bits     = (bits & 0x007FFFFF) | 0x3F800000;
+    auVec8 m;
+    memcpy (&m, &bits, sizeof (m));
+    return e + (-0.34484843f * m + 2.02466578f) * m - 0.67487759f;
+}
+
+// 2^x from the integer part in the exponent bits and a cubic over the rest
+AU_VEC_INLINE auVec8 fast_exp2 (auVec8 x) {
+    x = au_vec_min (au_vec_max (x, au_vec_set1 (-126.f)),
+                    au_vec_set1 (126.f));
+    // truncation rounds negatives up, masks are -1 where that happened
+    auMask8 i = __builtin_convertvector (x, auMask8);
+    i += x < __builtin_convertvector (i, auVec8);
+    auVec8 f = x - __builtin_convertvector (i, auVec8);
+    auVec8 p = 1.f + f * (0.69583356f + f * (0.22606716f + f * 0.078024521f));
+    auMask8 bits = (i + 127) << 23;
+    auVec8  scale;
+    memcpy (&scale, &bits, sizeof (scale));
+    return p * scale;
+}
+
+// one pole coefficient with a time constant of `ms`, instant at 0
+static float smoothing_coef (float ms, float sample_rate) {
+    if (ms <= 0.f) return 1.f;
+    return 1.f - expf (-1000.f / (ms * sample_rate));
+}
+
+// runs the attack and release poles side by side and keeps whichever moved
+// further toward the target: with the faster attack that is the lower one,
+// so attack wins going down and release going up without a branch
+template <bool faster_attack>
+static float follow (float *level, size_t n, float env, float attack,
+                     float release) {
+    for (size_t i = 0; i < n; i++) {
+        float a  = env * (1.f - attack) + level[i] * attack;
+        float r  = env * (1.f - release) + level[i] * release;
+        env      = faster_attack ? std::min (a, r) : std::max (a, r);
+        level[i] = env;
+    }
+    return env;
+}
+
+auCompressorParams au_limiter_params (float ceiling_db, float release_ms) {
+    auCompressorParams p;
+    p.threshold_db = ceiling_db;
+    p.ratio        = INFINITY;
+    p.knee_db      = 0.f;
+    p.attack_ms    = 0.f;
+    p.release_ms   = release_ms;
+    p.makeup_db    = 0.f;
+    return p;
+}
+
+void auCompressorNode::prepare (unsigned int rate, size_t max_frames) {
+    if (float (rate) != sample_rate) sample_rate = float (rate);
+}
+
+void auCompressorNode::update_coefs () {
+    float knee = std::max (params.knee_db / AU_DB_PER_LOG2, 1e-6f);
+    threshold  = params.threshold_db / AU_DB_PER_LOG2;
+    slope      = params.ratio > 1.f ? 1.f - 1.f / params.ratio : 0.f;
+    half_knee  = knee * 0.5f;
+    inv_twice_knee = 0.5f / knee;
+    makeup         = params.makeup_db / AU_DB_PER_LOG2;
+    attack_coef    = smoothing_coef (params.attack_ms, sample_rate);
+    release_coef   = smoothing_coef (params.release_ms, sample_rate);
+    coef_rate      = sample_rate;
+}
+
+void auCompressorNode::process (const float *const *inputs,
+                                float *const *outputs, size_t frames) {
+    auCompressorParams p;
+    bool               changed = false;
+    while (param_changes.pop (&p)) {
+        params  = p;
+        changed = true;
+    }
+    if (changed || coef_rate != sample_rate) update_coefs ();
+
+    const auVec8 zero = au_vec_set1 (0.f);
+    const auVec8 knee = au_vec_set1 (half_knee * 2.f);
+    for (size_t done = 0; done < frames; done += AU_PARAM_CHUNK) {
+        size_t n = std::min<size_t> (frames - done, AU_PARAM_CHUNK);
+        // whole vectors, the frames past n only ever see the floor
+        size_t vn = n - n % AU_VEC_WIDTH;
+
+        // linked peak detector, the loudest channel drives every channel
+        for (size_t i = 0; i < AU_PARAM_CHUNK; i++) {
+            level[i] = AU_DETECTOR_FLOOR;
+        }
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            const float *src = inputs[ch] + done;
+            size_t       i   = 0;
+            for (; i < vn; i += AU_VEC_WIDTH) {
+                auVec8 x = au_vec_load (src + i);
+                auVec8 l = au_vec_load (level + i);
+                au_vec_store (level + i, au_vec_max (l, au_vec_max (x, -x)));
+            }
+            for (; i < n; i++) level[i] = std::max (level[i], fabsf (src[i]));
+        }
+
+        // static curve with a quadratic knee
+        for (size_t i = 0; i < n; i += AU_VEC_WIDTH) {
+            auVec8 over = fast_log2 (au_vec_load (level + i)) - threshold;
+            auVec8 k    = au_vec_min (au_vec_max (over + half_knee, zero),
+                                      knee);
+            auVec8 hard = au_vec_max (over - half_knee, zero);
+            au_vec_store (level + i,
+                          -slope * (k * k * inv_twice_knee + hard));
+        }
+
+        // the envelope is the only serial part
+        envelope = attack_coef >= release_coef
+                       ? follow<true> (level, n, envelope, attack_coef,
+                                       release_coef)
+                       : follow<false> (level, n, envelope, attack_coef,
+                                        release_coef);
+
+        for (size_t i = 0; i < n; i += AU_VEC_WIDTH) {
+            au_vec_store (level + i,
+                          fast_exp2 (au_vec_load (level + i) + makeup));
+        }
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            const float *src = inputs[ch] + done;
+            float       *dst = outputs[ch] + done;
+            size_t       i   = 0;
+            for (; i < vn; i += AU_VEC_WIDTH) {
+                au_vec_store (dst + i, au_vec_load (src + i)
+                                           * au_vec_load (level + i));
+            }
+            for (; i < n; i++) dst[i] = src[i] * level[i];
+        }
+    }
+    reduction_db.store (envelope * AU_DB_PER_LOG2, std::memory_order_relaxed);
+}
+
+// constant power gains for a pan position, balance scales them so the
+// center is unity and only the far side fades
+static inline void pan_gains (float pan, bool balance, float *l, float *r) {
+    float theta = (std::clamp (pan, -1.f, 1.f) + 1.f) * float (M_PI / 4);
+    *l          = cosf (theta);
+    *r          = sinf (theta);
+    if (balance) {
+        *l = std::min (*l * float (M_SQRT2), 1.f);
+        *r = std::min (*r * float (M_SQRT2), 1.f);
+    }
+}
+
+void auPanNode::process (const float *const *in, float *const *out,
+                         size_t frames) {
+    bool  balance = inputs == 2;
+    float curve[AU_PARAM_CHUNK];
+    float left[AU_PARAM_CHUNK], right[AU_PARAM_CHUNK];
+
+    for (size_t done = 0; done < frames; done += AU_PARAM_CHUNK) {
+        size_t n      = std::min<size_t> (frames - done, AU_PARAM_CHUNK);
+        bool   moving = pan.is_smoothing ();
+        pan.render (curve, n);
+
+        // the trig only runs per frame while the position moves
+        if (moving) {
+            for (size_t i = 0; i < n; i++) {
+                pan_gains (curve[i], balance, &left[i], &right[i]);
+            }
+        } else {
+            float l, r;
+            pan_gains (curve[0], balance, &l, &r);
+            for (size_t i = 0; i < n; i++) {
+                left[i]  = l;
+                right[i] = r;
+            }
+        }
+
+        const float *src_l = in[0] + done;
+        const float *src_r = in[inputs - 1] + done;
+        float       *dst_l = out[0] + done;
+        float       *dst_r = out[1] + done;
+        // right first, with a mono input the left output may alias it
+        for (size_t i = 0; i < n; i++) dst_r[i] = src_r[i] * right[i];
+        for (size_t i = 0; i < n; i++) dst_l[i] = src_l[i] * left[i];
+    }
+}
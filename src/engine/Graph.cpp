@@ -0,0 +1,433 @@
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cstring>
+#include <engine/Graph.hpp>
+#include <engine/Messages.hpp>
+#include <engine/Scheduler.hpp>
+
+void auCompiledGraph::run (size_t frames) {
+    auScratchScope use (au_rt_scratch ? *au_rt_scratch : *scratch);
+    for (size_t i = 0; i < steps.size (); i++) run_step (i, frames);
+}
+
+size_t auGraph::add_node (auNodeRef node) {
+    nodes.push_back (std::move (node));
+    return nodes.size () - 1;
+}
+
+void auGraph::remove_node (size_t id) {
+    if (id >= nodes.size ()) return;
+    nodes[id] = nullptr;
+    std::erase_if (edges, [id] (const auGraphEdge &e) {
+        return e.from == id || e.to == id;
+    });
+    std::erase_if (outputs,
+                   [id] (const auGraphOutput &o) { return o.node == id; });
+}
+
+bool auGraph::connect (size_t from, unsigned int from_port, size_t to,
+                       unsigned int to_port) {
+    auNode *src = get_node (from), *dst = get_node (to);
+    if (!src || !dst || from_port >= src->get_output_count ()
+        || to_port >= dst->get_input_count ()) {
+        spdlog::error ("Cant connect {}:{} to {}:{}, no such port", from,
+                       from_port, to, to_port);
+        return false;
+    }
+    disconnect (to, to_port);
+    edges.push_back ({ from, from_port, to, to_port });
+    return true;
+}
+
+void auGraph::disconnect (size_t to, unsigned int to_port) {
+    std::erase_if (edges, [=] (const auGraphEdge &e) {
+        return e.to == to && e.to_port == to_port;
+    });
+}
+
+bool auGraph::set_output (unsigned int channel, size_t node,
+                          unsigned int port) {
+    auNode *src = get_node (node);
+    if (!src || port >= src->get_output_count ()) {
+        spdlog::error ("Cant route {}:{} to output {}, no such port", node,
+                       port, channel);
+        return false;
+    }
+    if (outputs.size () <= channel) {
+        outputs.resize (channel + 1, { SIZE_MAX, 0 });
+    }
+    outputs[channel] = { node, port };
+    return true;
+}
+
+std::unique_ptr<auCompiledGraph> auGraph::compile (unsigned int sample_rate,
+                                                   size_t max_frames) const {
+    const size_t none = SIZE_MAX;
+
+    if (max_frames == 0) {
+        spdlog::error ("Cant compile a graph for blocks of 0 frames");
+        return nullptr;
+    }
+
+    // kahn's algorithm, ties broken by id so equal graphs compile equally
+    std::vector<size_t> indegree (nodes.size (), 0);
+    for (const auGraphEdge &e : edges) indegree[e.to]++;
+
+    std::vector<size_t> order, ready;
+    size_t              live = 0;
+    for (size_t id = 0; id < nodes.size (); id++) {
+        if (!nodes[id]) continue;
+        live++;
+        if (indegree[id] == 0) ready.push_back (id);
+    }
+    std::reverse (ready.begin (), ready.end ());
+    while (!ready.empty ()) {
+        size_t id = ready.back ();
+        ready.pop_back ();
+        order.push_back (id);
+
+        std::vector<size_t> next;
+        for (const auGraphEdge &e : edges) {
+            if (e.from == id && --indegree[e.to] == 0) next.push_back (e.to);
+        }
+        std::sort (next.begin (), next.end (), std::greater<size_t> ());
+        ready.insert (ready.end (), next.begin (), next.end ());
+    }
+    if (order.size () != live) {
+        spdlog::error ("Graph has a cycle, {} of {} nodes could be ordered",
+                       order.size (), live);
+        return nullptr;
+    }
+
+    std::vector<size_t> position (nodes.size (), none);
+    for (size_t i = 0; i < order.size (); i++) position[order[i]] = i;
+
+    // the last step reading each output port, graph outputs live to the end
+    std::vector<std::vector<size_t>> last_use (nodes.size ());
+    for (size_t id : order) {
+        last_use[id].assign (nodes[id]->get_output_count (), position[id]);
+    }
+    for (const auGraphEdge &e : edges) {
+        size_t &use = last_use[e.from][e.from_port];
+        use         = std::max (use, position[e.to]);
+    }
+    for (const auGraphOutput &o : outputs) {
+        if (o.node != none) last_use[o.node][o.port] = none;
+    }
+
+    std::vector<std::vector<std::pair<size_t, unsigned int>>> releases (
+        order.size ());
+    for (size_t id : order) {
+        for (unsigned int p = 0; p < last_use[id].size (); p++) {
+            if (last_use[id][p] != none) {
+                releases[last_use[id][p]].push_back ({ id, p });
+            }
+        }
+    }
+
+    // every step depends on the steps feeding it
+    std::vector<std::vector<uint32_t>> preds (order.size ());
+    for (const auGraphEdge &e : edges) {
+        preds[position[e.to]].push_back (uint32_t (position[e.from]));
+    }
+
+    // in place nodes write output p over input p when nobody else needs
+    // that plane afterwards, returns the edge feeding it or nullptr
+    auto adoptable = [&] (size_t id, unsigned int p) -> const auGraphEdge * {
+        const auGraphEdge *feed = nullptr;
+        for (const auGraphEdge &e : edges) {
+            if (e.to == id && e.to_port == p) feed = &e;
+        }
+        if (!feed || last_use[feed->from][feed->from_port] != position[id]) {
+            return nullptr;
+        }
+        // another input of the same node reading the plane would see it
+        // change halfway through
+        for (const auGraphEdge &e : edges) {
+            if (&e != feed && e.to == id && e.from == feed->from
+                && e.from_port == feed->from_port) {
+                return nullptr;
+            }
+        }
+        return feed;
+    };
+
+    // hand out buffers in execution order. a step's outputs are allocated
+    // before its inputs are released so no node reads and writes one plane,
+    // unless it asked to run in place
+    std::vector<std::vector<size_t>>   buffer_of (nodes.size ());
+    std::vector<size_t>                free_buffers;
+    std::vector<std::vector<uint32_t>> touched (1); // steps using a buffer
+    size_t                             buffer_count = 1; // 0 is silence
+    for (size_t i = 0; i < order.size (); i++) {
+        size_t id = order[i];
+        buffer_of[id].resize (nodes[id]->get_output_count ());
+
+        std::vector<std::pair<size_t, unsigned int>> adopted;
+        for (unsigned int p = 0; p < buffer_of[id].size (); p++) {
+            size_t            &buffer = buffer_of[id][p];
+            const auGraphEdge *feed   = nullptr;
+            if (nodes[id]->is_in_place ()
+                && p < nodes[id]->get_input_count ()) {
+                feed = adoptable (id, p);
+            }
+            if (feed) {
+                buffer = buffer_of[feed->from][feed->from_port];
+                adopted.push_back ({ feed->from, feed->from_port });
+            } else if (free_buffers.empty ()) {
+                buffer = buffer_count++;
+                touched.emplace_back ();
+            } else {
+                buffer = free_buffers.back ();
+                free_buffers.pop_back ();
+            }
+
+            // a reused plane may only be overwritten once everything that
+            // used its old contents is done
+            for (uint32_t step : touched[buffer]) {
+                if (step != i) preds[i].push_back (step);
+            }
+            touched[buffer].assign (1, uint32_t (i));
+            for (const auGraphEdge &e : edges) {
+                if (e.from == id && e.from_port == p) {
+                    touched[buffer].push_back (uint32_t (position[e.to]));
+                }
+            }
+        }
+        for (auto [node, port] : releases[i]) {
+            if (std::find (adopted.begin (), adopted.end (),
+                           std::make_pair (node, port))
+                != adopted.end ()) {
+                continue;
+            }
+            free_buffers.push_back (buffer_of[node][port]);
+        }
+    }
+
+    auto graph          = std::make_unique<auCompiledGraph> ();
+    graph->max_frames   = max_frames;
+    graph->buffer_count = buffer_count;
+
+    // planes padded to the alignment so every one starts on a cache line,
+    // the slab itself is page aligned and zeroed
+    const size_t align  = AU_GRAPH_ALIGN / sizeof (float);
+    size_t       stride = (max_frames + align - 1) / align * align;
+    graph->arena        = auSlab (stride * buffer_count * sizeof (float));
+    if (!graph->arena.get_data ()) return nullptr;
+    graph->scratch = std::make_unique<auArena> (AU_SCRATCH_BYTES);
+    float *base  = static_cast<float *> (graph->arena.get_data ());
+    auto   plane = [&] (size_t buffer) { return base + buffer * stride; };
+
+    for (size_t id : order) {
+        auNode     *node = nodes[id].get ();
+        auGraphStep step { node, graph->ports.size (), 0 };
+
+        for (unsigned int p = 0; p < node->get_input_count (); p++) {
+            float *in = plane (0);
+            for (const auGraphEdge &e : edges) {
+                if (e.to == id && e.to_port == p) {
+                    in = plane (buffer_of[e.from][e.from_port]);
+                }
+            }
+            graph->ports.push_back (in);
+        }
+        step.outputs = graph->ports.size ();
+        for (size_t buffer : buffer_of[id]) {
+            graph->ports.push_back (plane (buffer));
+        }
+
+        node->prepare (sample_rate, max_frames);
+        graph->steps.push_back (step);
+        graph->nodes.push_back (nodes[id]);
+    }
+
+    std::vector<std::vector<uint32_t>> succs (order.size ());
+    graph->dependency_count.assign (order.size (), 0);
+    for (size_t i = 0; i < order.size (); i++) {
+        std::sort (preds[i].begin (), preds[i].end ());
+        preds[i].erase (std::unique (preds[i].begin (), preds[i].end ()),
+                        preds[i].end ());
+        graph->dependency_count[i] = uint32_t (preds[i].size ());
+        for (uint32_t p : preds[i]) succs[p].push_back (uint32_t (i));
+        if (preds[i].empty ()) graph->roots.push_back (uint32_t (i));
+    }
+    for (const std::vector<uint32_t> &s : succs) {
+        graph->successor_offsets.push_back (graph->successors.size ());
+        graph->successors.insert (graph->successors.end (), s.begin (),
+                                  s.end ());
+    }
+    graph->successor_offsets.push_back (graph->successors.size ());
+    graph->waiting
+        = std::make_unique<std::atomic<uint32_t>[]> (order.size ());
+
+    for (const auGraphOutput &o : outputs) {
+        graph->outputs.push_back (o.node == none
+                                      ? plane (0)
+                                      : plane (buffer_of[o.node][o.port]));
+    }
+
+    // the longest chain of declared latencies ending in an output
+    std::vector<uint32_t> path_latency (nodes.size (), 0);
+    for (size_t id : order) {
+        uint32_t in = 0;
+        for (const auGraphEdge &e : edges) {
+            if (e.to == id) in = std::max (in, path_latency[e.from]);
+        }
+        path_latency[id] = in + nodes[id]->get_latency ();
+    }
+    for (const auGraphOutput &o : outputs) {
+        if (o.node == none) continue;
+        graph->latency = std::max (graph->latency, path_latency[o.node]);
+    }
+
+    spdlog::info ("Compiled graph of {} nodes into {} buffers of {} frames",
+                  order.size (), buffer_count, max_frames);
+    return graph;
+}
+
+void auGraphPlayer::swap (std::unique_ptr<auCompiledGraph> graph) {
+    std::lock_guard<std::mutex> lock (retired_mutex);
+    pending.store (graph.get ());
+    graphs.push_back (std::move (graph));
+}
+
+void auGraphPlayer::collect () {
+    std::lock_guard<std::mutex> lock (retired_mutex);
+    auCompiledGraph            *keep = pending.load ();
+    auCompiledGraph            *used = in_use.load ();
+    std::erase_if (graphs, [=] (const std::unique_ptr<auCompiledGraph> &g) {
+        return g.get () != keep && g.get () != used;
+    });
+}
+
+auCompiledGraph *auGraphPlayer::acquire () {
+    auCompiledGraph *p = pending.load ();
+    while (p != current) {
+        // publish before touching it, then check it was not replaced in
+        // between, otherwise collect could already have freed it
+        in_use.store (p);
+        auCompiledGraph *again = pending.load ();
+        if (again == p) {
+            current = p;
+            break;
+        }
+        p = again;
+    }
+    return current;
+}
+
+template <typename F>
+static void interleave (const auCompiledGraph *graph, unsigned int channels,
+                        char *out, size_t offset, size_t frames,
+                        size_t sample_size, F &&convert) {
+    size_t outs = graph->get_output_count ();
+    for (unsigned int ch = 0; ch < channels; ch++) {
+        const float *src = ch < outs ? graph->get_output (ch) : nullptr;
+        char        *dst = out + ((offset * channels) + ch) * sample_size;
+        for (size_t i = 0; i < frames; i++) {
+            float s = src ? std::clamp (src[i], -1.f, 1.f) : 0.f;
+            convert (s, dst);
+            dst += channels * sample_size;
+        }
+    }
+}
+
+void au_graph_write_frames (const auCompiledGraph *graph,
+                            const auStreamConfig &config, char *out,
+                            size_t offset, size_t frames) {
+    unsigned int channels = config.channels;
+    switch (config.format) {
+    case SND_PCM_FORMAT_FLOAT:
+        interleave (graph, channels, out, offset, frames, 4,
+                    [] (float s, char *p) { memcpy (p, &s, 4); });
+        break;
+    case SND_PCM_FORMAT_S16:
+        interleave (graph, channels, out, offset, frames, 2,
+                    [] (float s, char *p) {
+                        int16_t v = int16_t (s * 32767.f);
+                        memcpy (p, &v, 2);
+                    });
+        break;
+    case SND_PCM_FORMAT_S24_3LE:
+        interleave (graph, channels, out, offset, frames, 3,
+                    [] (float s, char *p) {
+                        int32_t v = int32_t (s * 8388607.f);
+                        memcpy (p, &v, 3);
+                    });
+        break;
+    case SND_PCM_FORMAT_S32:
+        interleave (graph, channels, out, offset, frames, 4,
+                    [] (float s, char *p) {
+                        int32_t v = int32_t (double (s) * 2147483647.0);
+                        memcpy (p, &v, 4);
+                    });
+        break;
+    default:
+        snd_pcm_format_set_silence (
+            config.format,
+            out + snd_pcm_format_size (config.format, offset * channels),
+            frames * channels);
+        break;
+    }
+}
+
+void auGraphRenderer::collect () {
+    player.collect ();
+    if (messages) messages->collect ();
+}
+
+void auGraphRenderer::run_graph (auCompiledGraph *graph, size_t frames) {
+    uint64_t now = frame_time.load (std::memory_order_relaxed);
+    if (messages) messages->dispatch (now, frames);
+    frame_time.store (now + frames, std::memory_order_relaxed);
+
+    if (!graph) return;
+    if (!scheduler) {
+        graph->run (frames);
+        return;
+    }
+    scheduler->run (*graph, frames,
+                    (uint64_t (frames) * 1000000000) / config.sample_rate);
+}
+
+void auGraphRenderer::process (void *out, size_t frames) {
+    char            *buf   = static_cast<char *> (out);
+    auCompiledGraph *graph = player.acquire ();
+    if (!graph) {
+        // time still passes, commands due meanwhile are not held back
+        run_graph (nullptr, frames);
+        snd_pcm_format_set_silence (config.format, buf,
+                                    frames * config.channels);
+        return;
+    }
+
+    size_t done = 0;
+    while (done < frames) {
+        size_t chunk = std::min (frames - done, graph->get_max_frames ());
+        run_graph (graph, chunk);
+        au_graph_write_frames (graph, config, buf, done, chunk);
+        done += chunk;
+    }
+}
+
+void auGraphRenderer::process_planar (void **channels, size_t frames) {
+    auCompiledGraph *graph = player.acquire ();
+    size_t           outs  = graph ? graph->get_output_count () : 0;
+
+    size_t done = 0;
+    while (done < frames) {
+        size_t chunk = graph ? std::min (frames - done,
+                                         graph->get_max_frames ())
+                             : frames - done;
+        run_graph (graph, chunk);
+        for (unsigned int ch = 0; ch < config.channels; ch++) {
+            float *dst = static_cast<float *> (channels[ch]) + done;
+            if (ch < outs) {
+                memcpy (dst, graph->get_output (ch), chunk * sizeof (float));
+            } else {
+                memset (dst, 0, chunk * sizeof (float));
+            }
+        }
+        done += chunk;
+    }
+}
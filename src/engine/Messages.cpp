@@ -0,0 +1,152 @@
+#include <engine/Messages.hpp>
+
+void auParam::begin_ramp (float to) {
+    last_target = to;
+    if (ramp_frames == 0) {
+        value     = to;
+        ramp_left = 0;
+        return;
+    }
+    step      = (to - value) / float (ramp_frames);
+    ramp_left = ramp_frames;
+}
+
+bool auParam::set_at (uint32_t offset, float v) {
+    if (event_count == AU_PARAM_MAX_EVENTS) {
+        events[event_count - 1].value = v;
+        return false;
+    }
+
+    // keep them sorted, blocks only ever hold a handful
+    size_t i = event_count;
+    while (i > 0 && events[i - 1].offset > offset) {
+        events[i] = events[i - 1];
+        i--;
+    }
+    events[i] = { offset, v };
+    event_count++;
+    return true;
+}
+
+// drops the events before `frames` and moves the rest to the next call
+void auParam::consume_events (size_t used, size_t frames) {
+    size_t kept = 0;
+    for (size_t i = used; i < event_count; i++) {
+        events[kept]         = events[i];
+        events[kept].offset -= uint32_t (frames);
+        kept++;
+    }
+    event_count = kept;
+}
+
+void auParam::apply_event (size_t i) { begin_ramp (events[i].value); }
+
+// a new target from set, timed events since then are overridden by it
+void auParam::pick_up_target () {
+    float t = target.load (std::memory_order_relaxed);
+    if (t == seen_target) return;
+    seen_target = t;
+    begin_ramp (t);
+}
+
+void auParam::render (float *curve, size_t frames) {
+    pick_up_target ();
+
+    size_t next = 0;
+    for (size_t i = 0; i < frames; i++) {
+        while (next < event_count && events[next].offset <= i) {
+            apply_event (next++);
+        }
+        if (ramp_left > 0) {
+            value += step;
+            if (--ramp_left == 0) value = last_target;
+        }
+        curve[i] = value;
+    }
+    consume_events (next, frames);
+}
+
+float auParam::skip (size_t frames) {
+    pick_up_target ();
+
+    // no curve to get right, changes inside the span apply at its start
+    size_t next = 0;
+    while (next < event_count && events[next].offset < frames) {
+        apply_event (next++);
+    }
+    consume_events (next, frames);
+
+    if (ramp_left > frames) {
+        value     += step * float (frames);
+        ramp_left -= uint32_t (frames);
+    } else {
+        value     = last_target;
+        ramp_left = 0;
+    }
+    return value;
+}
+
+auMessageQueue::auMessageQueue (size_t capacity) :
+    commands (capacity), retired (capacity),
+    held (std::make_unique<auCommand[]> (capacity)),
+    held_capacity (capacity) {}
+
+bool auMessageQueue::send (const auCommand &cmd) {
+    if (!commands.push (cmd)) {
+        dropped.fetch_add (1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void auMessageQueue::apply (const auCommand &cmd, uint64_t block_frame) {
+    uint32_t offset
+        = cmd.frame > block_frame ? uint32_t (cmd.frame - block_frame) : 0;
+
+    switch (cmd.type) {
+    case auCmdParam:
+        // too many changes in one block and the last value still wins
+        cmd.param->set_at (offset, cmd.value);
+        break;
+    case auCmdCall:
+        cmd.call (cmd.ctx, cmd.arg);
+        break;
+    }
+}
+
+void auMessageQueue::dispatch (uint64_t block_frame, size_t frames) {
+    uint64_t end = block_frame + frames;
+
+    // earlier held commands first, they were sent first
+    size_t kept = 0;
+    for (size_t i = 0; i < held_count; i++) {
+        if (held[i].frame < end) {
+            apply (held[i], block_frame);
+        } else {
+            held[kept++] = held[i];
+        }
+    }
+    held_count = kept;
+
+    auCommand cmd;
+    while (commands.pop (&cmd)) {
+        if (cmd.frame < end) {
+            apply (cmd, block_frame);
+        } else if (held_count < held_capacity) {
+            held[held_count++] = cmd;
+        } else {
+            // no room to wait, better early than never
+            apply (cmd, block_frame);
+        }
+    }
+}
+
+size_t auMessageQueue::collect () {
+    auRetired r;
+    size_t    count = 0;
+    while (retired.read (&r, 1) == 1) {
+        r.destroy (r.object);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cstring>
+#include <engine/Nodes.hpp>
+#include <spdlog/spdlog.h>
+
+void auGainNode::process (const float *const *inputs, float *const *outputs,
+                          size_t frames) {
+    float curve[AU_PARAM_CHUNK];
+    for (size_t done = 0; done < frames; done += AU_PARAM_CHUNK) {
+        size_t n = std::min<size_t> (frames - done, AU_PARAM_CHUNK);
+        gain.render (curve, n);
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            const float *src = inputs[ch] + done;
+            float       *dst = outputs[ch] + done;
+            for (size_t i = 0; i < n; i++) dst[i] = src[i] * curve[i];
+        }
+    }
+}
+
+void auMixerNode::process (const float *const *in, float *const *out,
+                           size_t frames) {
+    for (unsigned int ch = 0; ch < channels; ch++) {
+        memset (out[ch], 0, frames * sizeof (float));
+    }
+    float curve[AU_PARAM_CHUNK];
+    for (unsigned int n = 0; n < inputs; n++) {
+        if (!gains[n].is_smoothing () && gains[n].get_value () == 0.f) {
+            gains[n].skip (frames);
+            continue;
+        }
+        for (size_t done = 0; done < frames; done += AU_PARAM_CHUNK) {
+            size_t c = std::min<size_t> (frames - done, AU_PARAM_CHUNK);
+            gains[n].render (curve, c);
+            for (unsigned int ch = 0; ch < channels; ch++) {
+                const float *src = in[n * channels + ch] + done;
+                float       *dst = out[ch] + done;
+                for (size_t i = 0; i < c; i++) dst[i] += src[i] * curve[i];
+            }
+        }
+    }
+}
+
+void auClipNode::process (const float *const *inputs, float *const *outputs,
+                          size_t frames) {
+    unsigned int channels = clip->get_channels ();
+    uint64_t     length   = clip->get_frames ();
+    uint64_t     pos      = position.load (std::memory_order_relaxed);
+
+    size_t done = 0;
+    while (playing.load (std::memory_order_relaxed) && done < frames) {
+        if (pos >= length) {
+            if (!looping.load (std::memory_order_relaxed) || length == 0) {
+                playing.store (false, std::memory_order_relaxed);
+                break;
+            }
+            pos = 0;
+        }
+        size_t chunk = frames - done;
+        if (chunk > length - pos) chunk = length - pos;
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            memcpy (outputs[ch] + done, clip->get_plane (ch) + pos,
+                    chunk * sizeof (float));
+        }
+        pos  += chunk;
+        done += chunk;
+    }
+    for (unsigned int ch = 0; ch < channels; ch++) {
+        memset (outputs[ch] + done, 0, (frames - done) * sizeof (float));
+    }
+    position.store (pos, std::memory_order_relaxed);
+}
+
+auRingInputNode::auRingInputNode (auSFormat s_format,
+                                  size_t    capacity_frames) :
+    s_format (s_format),
+    planar (s_format.sample_rate, 32, s_format.channels, auDtype::sFloat),
+    frame_size ((s_format.bit_depth * s_format.channels) / 8),
+    valid (au_can_convert_to_planar (s_format) && frame_size),
+    ring (capacity_frames * frame_size),
+    scratch (AU_PARAM_CHUNK * frame_size),
+    planes (s_format.channels) {
+    if (!valid) {
+        spdlog::error ("Ring input cannot convert data type {}, bit depth {}"
+                       " to planar floats, it will stay silent!",
+                       int (s_format.data_type), s_format.bit_depth);
+    }
+}
+
+size_t auRingInputNode::write (const void *data, size_t frames) {
+    if (!valid) return 0;
+    size_t room = ring.get_write_available () / frame_size;
+    if (frames > room) frames = room;
+    ring.write (static_cast<const char *> (data), frames * frame_size);
+    return frames;
+}
+
+void auRingInputNode::process (const float *const *inputs,
+                               float *const *outputs, size_t frames) {
+    size_t got = 0;
+    if (valid) {
+        size_t avail = ring.get_read_available () / frame_size;
+        got          = frames < avail ? frames : avail;
+    }
+
+    for (size_t done = 0; done < got; done += AU_PARAM_CHUNK) {
+        size_t n = std::min<size_t> (got - done, AU_PARAM_CHUNK);
+        ring.read (scratch.data (), n * frame_size);
+        for (unsigned int ch = 0; ch < s_format.channels; ch++) {
+            planes[ch] = outputs[ch] + done;
+        }
+        au_convert_to_planar (s_format, planar, scratch.data (),
+                              n * frame_size, planes.data ());
+    }
+    if (got < frames) {
+        if (valid) underflows.fetch_add (1, std::memory_order_relaxed);
+        for (unsigned int ch = 0; ch < s_format.channels; ch++) {
+            memset (outputs[ch] + got, 0, (frames - got) * sizeof (float));
+        }
+    }
+}
@@ -0,0 +1,156 @@
+#include "spdlog/spdlog.h"
+#include <condition_variable>
+#include <engine/Render.hpp>
+#include <engine/Scheduler.hpp>
+#include <mutex>
+#include <thread>
+#include <util/RtAlloc.hpp>
+#include <util/time.h>
+
+// a batch travelling from the renderer to the writer thread
+struct auRenderBatch {
+    std::vector<char> data;
+    size_t            size  = 0;
+    bool              ready = false; // filled, waiting to be written
+};
+
+int auOfflineRenderer::render (auCompiledGraph             &graph,
+                               const std::filesystem::path &path,
+                               AudioFileFormat format, auSFormat s_format,
+                               uint64_t frames, auRenderStats *stats) {
+    if (!s_format.verify ()) return -EINVAL;
+
+    auStreamConfig config;
+    config.sample_rate = s_format.sample_rate;
+    config.channels    = s_format.channels;
+    config.format      = sformat_to_pcm_format (s_format);
+
+    // the formats au_graph_write_frames converts to, anything else would
+    // render silence
+    switch (config.format) {
+    case SND_PCM_FORMAT_FLOAT:
+    case SND_PCM_FORMAT_S16:
+    case SND_PCM_FORMAT_S24_3LE:
+    case SND_PCM_FORMAT_S32: break;
+    default:
+        spdlog::error ("Cannot render to {}, unsupported sample format!",
+                       path.string ());
+        return -EINVAL;
+    }
+
+    auFileWriter writer (path, format, s_format);
+    if (writer.get_error ()) {
+        spdlog::error ("Failed to open {} for writing!", path.string ());
+        return -EIO;
+    }
+
+    // the rendering thread counts as a worker, so one core less
+    unsigned int cores   = std::max (std::thread::hardware_concurrency (), 1u);
+    unsigned int workers = params.workers >= 0 ? unsigned (params.workers)
+                                               : cores - 1;
+    std::unique_ptr<auGraphScheduler> scheduler;
+    if (workers > 0 && graph.get_step_count () > 1) {
+        scheduler = std::make_unique<auGraphScheduler> (workers);
+    }
+
+    size_t batch_frames
+        = params.batch_frames ? params.batch_frames : s_format.sample_rate;
+    size_t frame_size = snd_pcm_format_size (config.format, config.channels);
+
+    auRenderBatch           batches[2];
+    std::mutex              mutex;
+    std::condition_variable cond;
+    bool                    finished    = false;
+    bool                    write_error = false;
+    for (auRenderBatch &b : batches) b.data.resize (batch_frames * frame_size);
+
+    std::thread write_thread ([&] () {
+        for (size_t i = 0;; i ^= 1) {
+            auRenderBatch               &b = batches[i];
+            std::unique_lock<std::mutex> lock (mutex);
+            cond.wait (lock, [&] () { return b.ready || finished; });
+            if (!b.ready) return;
+            lock.unlock ();
+
+            bool ok = writer.write_chunk (b.data.data (), b.size);
+
+            lock.lock ();
+            b.ready = false;
+            if (!ok) write_error = true;
+            cond.notify_all ();
+        }
+    });
+
+    progress  = 0;
+    cancelled = false;
+
+    // the pool's workers flush denormals as real-time threads, this one
+    // renders too
+    auDenormalScope flush;
+
+    int      err      = 0;
+    uint64_t write_ns = 0;
+    uint64_t start    = au_now_ns ();
+    for (size_t i = 0; progress.load () < frames; i ^= 1) {
+        auRenderBatch &b = batches[i];
+        {
+            // wait for the writer to hand this buffer back
+            uint64_t                     wait = au_now_ns ();
+            std::unique_lock<std::mutex> lock (mutex);
+            cond.wait (lock, [&] () { return !b.ready || write_error; });
+            write_ns += au_now_ns () - wait;
+            if (write_error) {
+                err = -EIO;
+                break;
+            }
+        }
+        if (cancelled.load ()) {
+            err = -ECANCELED;
+            break;
+        }
+
+        size_t n = std::min<uint64_t> (batch_frames, frames - progress);
+        for (size_t done = 0; done < n;) {
+            size_t chunk = std::min (n - done, graph.get_max_frames ());
+            if (scheduler) {
+                scheduler->run (graph, chunk);
+            } else {
+                graph.run (chunk);
+            }
+            au_graph_write_frames (&graph, config, b.data.data (), done,
+                                   chunk);
+            done += chunk;
+        }
+        progress += n;
+
+        std::lock_guard<std::mutex> lock (mutex);
+        b.size  = n * frame_size;
+        b.ready = true;
+        cond.notify_all ();
+    }
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        finished = true;
+        cond.notify_all ();
+    }
+    write_thread.join ();
+    uint64_t wall_ns = au_now_ns () - start;
+
+    if (!err && write_error) err = -EIO;
+    if (err == -EIO) {
+        spdlog::error ("Failed to write {}!", path.string ());
+    }
+
+    double seconds = double (progress.load ()) / s_format.sample_rate;
+    double rtf     = wall_ns ? seconds * 1e9 / double (wall_ns) : 0;
+    spdlog::info ("Rendered {:.1f} s to {} in {:.2f} s, {:.1f}x real-time",
+                  seconds, path.string (), double (wall_ns) / 1e9, rtf);
+
+    if (stats) {
+        stats->frames          = progress.load ();
+        stats->wall_ns         = wall_ns;
+        stats->write_ns        = write_ns;
+        stats->realtime_factor = rtf;
+    }
+    return err;
+}
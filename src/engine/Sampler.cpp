@@ -0,0 +1,391 @@
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cstring>
+#include <engine/Sampler.hpp>
+
+// frames a voice moves at once when reading its ring
+#define AU_SAMPLER_CHUNK 256
+
+static auSFormat float_format (const auSFormat &from) {
+    return auSFormat (from.sample_rate, 32, from.channels, auDtype::sFloat);
+}
+
+// floats in a voice ring, a power of two like auSpscRing's own
+static size_t ring_items (const auSamplerParams &params,
+                          unsigned int           sample_rate) {
+    size_t want = size_t (params.ring_ms) * sample_rate / 1000
+                * AU_SAMPLER_MAX_CHANNELS;
+    size_t items = 1;
+    while (items < want) items <<= 1;
+    return items;
+}
+
+auSamplerNode::auSamplerNode (unsigned int sample_rate, unsigned int channels,
+                              auSamplerParams params) :
+    params (params), channels (channels), sample_rate (sample_rate),
+    ring_pool (ring_items (params, sample_rate) * sizeof (float),
+               params.voices),
+    voices (std::make_unique<Voice[]> (params.voices)),
+    requests (params.voices * 4), streams (params.voices) {
+    // the rings live in one locked slab, the heap only if it was refused
+    size_t items = ring_items (params, sample_rate);
+    for (unsigned int v = 0; v < params.voices; v++) {
+        float *storage = static_cast<float *> (ring_pool.acquire ());
+        if (storage) {
+            voices[v].ring = std::make_unique<auSpscRing<float>> (storage,
+                                                                  items);
+        } else {
+            voices[v].ring = std::make_unique<auSpscRing<float>> (items);
+        }
+    }
+
+    running  = true;
+    streamer = std::thread (&auSamplerNode::stream_loop, this);
+}
+
+auSamplerNode::~auSamplerNode () {
+    running = false;
+    if (streamer.joinable ()) streamer.join ();
+}
+
+static std::unique_ptr<auSample> load_head (const auSampleZone &zone,
+                                            unsigned int        sample_rate,
+                                            uint32_t            head_ms) {
+    auFileReader reader (zone.path, AudioFileFormat::AudioFFWav);
+    if (reader.get_error ()) return nullptr;
+
+    auto sample        = std::make_unique<auSample> ();
+    sample->zone       = zone;
+    sample->s_format   = reader.get_s_format ();
+    sample->frame_size = reader.get_frame_size ();
+    sample->frames     = reader.get_frames ();
+
+    // streaming starts anywhere in the file and converts whatever was read,
+    // so frames have to be packed samples. rules out ADPCM's blocks
+    auSFormat &f = sample->s_format;
+    if (!f.verify () || f.channels > AU_SAMPLER_MAX_CHANNELS
+        || f.data_type == auDtype::uDviAdpcm
+        || f.data_type == auDtype::uMsAdpcm
+        || sample->frame_size != f.bit_depth / 8 * f.channels) {
+        spdlog::error ("\"{}\" has an unsupported format",
+                       zone.path.string ());
+        return nullptr;
+    }
+    if (sample->s_format.sample_rate != sample_rate) {
+        spdlog::warn ("\"{}\" runs at {} Hz, it will play off pitch",
+                      zone.path.string (), sample->s_format.sample_rate);
+    }
+
+    sample->head_frames
+        = std::min<uint64_t> (sample->frames,
+                              uint64_t (head_ms) * sample_rate / 1000);
+    size_t            frame_size = sample->frame_size;
+    std::vector<char> raw (sample->head_frames * frame_size);
+    size_t read = reader.read_frames (raw.data (), sample->head_frames);
+
+    sample->head_frames = read;
+    sample->head.resize (read * sample->s_format.channels);
+    if (!au_convert_buffer (sample->s_format, float_format (sample->s_format),
+                            raw.data (), read * frame_size,
+                            reinterpret_cast<char *> (sample->head.data ()))) {
+        return nullptr;
+    }
+    return sample;
+}
+
+size_t auSamplerNode::load (const std::vector<auSampleZone> &zones) {
+    // heads are small, the time goes into opening and seeking files, so
+    // a worker per core reads files in parallel
+    std::vector<std::unique_ptr<auSample>> loaded_heads (zones.size ());
+    std::atomic<size_t>                    next = 0;
+
+    auto worker = [&] () {
+        for (size_t i = next++; i < zones.size (); i = next++) {
+            loaded_heads[i] = load_head (zones[i], sample_rate,
+                                         params.head_ms);
+        }
+    };
+    size_t workers = std::min<size_t> (
+        std::max (std::thread::hardware_concurrency (), 1u), zones.size ());
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < workers; w++) pool.emplace_back (worker);
+    worker ();
+    for (std::thread &t : pool) t.join ();
+
+    size_t loaded = 0;
+    for (auto &sample : loaded_heads) {
+        if (!sample) continue;
+        samples.push_back (std::move (sample));
+        loaded++;
+    }
+
+    // the first zone covering a key and velocity plays it
+    zone_map.assign (128 * 128, nullptr);
+    for (const auto &s : samples) {
+        const auSampleZone &z = s->zone;
+        unsigned int key_high = std::min (z.key_high, uint8_t (127));
+        unsigned int vel_high = std::min (z.vel_high, uint8_t (127));
+        for (unsigned int key = z.key_low; key <= key_high; key++) {
+            for (unsigned int vel = z.vel_low; vel <= vel_high; vel++) {
+                const auSample *&slot = zone_map[key * 128 + vel];
+                if (!slot) slot = s.get ();
+            }
+        }
+    }
+
+    uint64_t total = 0;
+    for (const auto &sample : samples) {
+        total += sample->frames * sample->frame_size;
+    }
+    spdlog::info ("Loaded {} of {} samples, {} MiB on disk, {} MiB in memory",
+                  loaded, zones.size (), total >> 20,
+                  get_head_bytes () >> 20);
+    return loaded;
+}
+
+size_t auSamplerNode::get_head_bytes () const {
+    size_t bytes = 0;
+    for (const auto &sample : samples) {
+        bytes += sample->head.size () * sizeof (float);
+    }
+    return bytes;
+}
+
+bool auSamplerNode::note (uint8_t key, uint8_t velocity) {
+    return notes.push ((uint32_t (key & 0x7F) << 8) | (velocity & 0x7F));
+}
+
+// reads one batch into the voice's ring, false when there was no room
+bool auSamplerNode::fill (unsigned int voice, Stream &stream,
+                          std::vector<char> &raw, std::vector<float> &out) {
+    const auSFormat &format     = stream.sample->s_format;
+    size_t           frame_size = stream.sample->frame_size;
+
+    auSpscRing<float> &ring  = *voices[voice].ring;
+    size_t             space = ring.get_write_available () / format.channels;
+    size_t batch = std::min (params.read_frames,
+                             ring.get_capacity () / format.channels);
+    size_t want  = std::min (space, batch);
+    if (want < batch / 4) return false;
+
+    raw.resize (want * frame_size);
+    out.resize (want * format.channels);
+    size_t read = stream.reader->read_frames (raw.data (), want);
+    if (read == 0
+        || !au_convert_buffer (format, float_format (format), raw.data (),
+                               read * frame_size,
+                               reinterpret_cast<char *> (out.data ()))) {
+        stream.active = false;
+        stream.reader.reset ();
+        return false;
+    }
+    ring.write (out.data (), read * format.channels);
+    return true;
+}
+
+void auSamplerNode::stream_loop () {
+    std::vector<char>  raw;
+    std::vector<float> converted;
+
+    while (running.load (std::memory_order_relaxed)) {
+        Request r;
+        while (requests.pop (&r)) {
+            Stream &stream = streams[r.voice];
+            if (r.frame == UINT64_MAX) {
+                if (r.generation == stream.generation) {
+                    stream.active = false;
+                    stream.reader.reset ();
+                }
+                continue;
+            }
+
+            stream.generation = r.generation;
+            stream.sample     = r.sample;
+            stream.reader     = std::make_unique<auFileReader> (
+                r.sample->zone.path, AudioFileFormat::AudioFFWav);
+            stream.active = !stream.reader->get_error ()
+                            && stream.reader->seek_frame (r.frame);
+            if (!stream.active) stream.reader.reset ();
+
+            // everything for older streams is written by now
+            voices[r.voice].ready.store (r.generation,
+                                         std::memory_order_release);
+        }
+
+        bool busy = false;
+        for (unsigned int v = 0; v < params.voices; v++) {
+            Stream &stream = streams[v];
+            if (!stream.active
+                || voices[v].flushed.load (std::memory_order_acquire)
+                       != stream.generation) {
+                continue;
+            }
+            busy |= fill (v, stream, raw, converted);
+        }
+
+        if (!busy) {
+            timespec nap { 0, 1000000 };
+            clock_nanosleep (CLOCK_MONOTONIC, 0, &nap, nullptr);
+        }
+    }
+}
+
+void auSamplerNode::note_on (uint8_t key, uint8_t velocity) {
+    if (zone_map.empty ()) return;
+    const auSample *sample = zone_map[(key & 0x7F) * 128 + (velocity & 0x7F)];
+    if (!sample) return;
+
+    // a free voice or the oldest one
+    unsigned int pick = 0;
+    for (unsigned int v = 0; v < params.voices; v++) {
+        if (!voices[v].sample) {
+            pick = v;
+            break;
+        }
+        if (voices[v].started < voices[pick].started) pick = v;
+    }
+
+    Voice   &voice = voices[pick];
+    uint32_t old   = voice.generation.load (std::memory_order_relaxed);
+    uint32_t gen   = old + 1;
+
+    // a stolen voice's stream stops, the new note may not stream at all
+    const auSample *stolen = voice.sample;
+    if (stolen && stolen->frames > stolen->head_frames
+        && !requests.push ({ stolen, pick, old, UINT64_MAX })) {
+        dropped.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    voice.generation.store (gen, std::memory_order_relaxed);
+    voice.sample   = sample;
+    voice.position = 0;
+    voice.owed     = 0;
+    voice.started  = note_count++;
+    voice.gain     = float (velocity) / 127.f;
+    voice.release  = 0;
+    voice.note     = key;
+    voice.underran = false;
+
+    if (sample->frames > sample->head_frames
+        && !requests.push ({ sample, pick, gen, sample->head_frames })) {
+        dropped.fetch_add (1, std::memory_order_relaxed);
+    }
+}
+
+void auSamplerNode::note_off (uint8_t key) {
+    float step = 1000.f / (float (std::max (params.release_ms, 1u))
+                           * float (sample_rate));
+    for (unsigned int v = 0; v < params.voices; v++) {
+        Voice &voice = voices[v];
+        if (voice.sample && voice.note == key && voice.release == 0) {
+            voice.release = voice.gain * step;
+        }
+    }
+}
+
+void auSamplerNode::render_voice (Voice &voice, float *const *outputs,
+                                  float *chunk, size_t frames) {
+    const auSample *sample = voice.sample;
+    unsigned int    sc     = sample->s_format.channels;
+    uint32_t        gen    = voice.generation.load (std::memory_order_relaxed);
+
+    // mixes `n` interleaved frames, false once the release finished
+    auto mix = [&] (const float *src, size_t offset, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            for (unsigned int ch = 0; ch < channels; ch++) {
+                outputs[ch][offset + i]
+                    += src[i * sc + std::min (ch, sc - 1)] * voice.gain;
+            }
+            if (voice.release > 0 && (voice.gain -= voice.release) <= 0) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // once the streamer took the request the old stream's leftovers go,
+    // early on so it can fill the ring while the head plays
+    if (voice.flushed.load (std::memory_order_relaxed) != gen
+        && voice.ready.load (std::memory_order_acquire) == gen) {
+        voice.ring->discard ();
+        voice.flushed.store (gen, std::memory_order_release);
+    }
+
+    size_t done = 0;
+    bool   alive = true;
+    while (alive && done < frames && voice.position < sample->frames) {
+        size_t n = std::min<uint64_t> (frames - done,
+                                       sample->frames - voice.position);
+        if (voice.position < sample->head_frames) {
+            n = std::min<uint64_t> (n, sample->head_frames - voice.position);
+            alive = mix (sample->head.data () + voice.position * sc, done,
+                         n);
+            voice.position += n;
+            done           += n;
+            continue;
+        }
+
+        n = std::min<size_t> (n, AU_SAMPLER_CHUNK);
+        auSpscRing<float> &ring = *voice.ring;
+        size_t             got  = 0;
+        if (chunk
+            && voice.flushed.load (std::memory_order_relaxed) == gen) {
+            // frames that were due during an underrun are thrown away so
+            // the voice stays in time
+            while (voice.owed > 0) {
+                size_t skip = std::min<uint64_t> (voice.owed,
+                                                  AU_SAMPLER_CHUNK);
+                size_t dropped_frames = ring.read (chunk, skip * sc) / sc;
+                if (!dropped_frames) break;
+                voice.owed -= dropped_frames;
+            }
+            if (voice.owed == 0) got = ring.read (chunk, n * sc) / sc;
+        }
+        if (got > 0) alive = mix (chunk, done, got);
+        if (got < n) {
+            if (!voice.underran) {
+                underruns.fetch_add (1, std::memory_order_relaxed);
+                voice.underran = true;
+            }
+            underrun_frames.fetch_add (n - got, std::memory_order_relaxed);
+            voice.owed += n - got;
+        }
+        voice.position += n;
+        done           += n;
+    }
+
+    if (!alive || voice.position >= sample->frames) {
+        voice.sample = nullptr;
+        if (sample->frames > sample->head_frames) {
+            requests.push ({ sample, uint32_t (&voice - voices.get ()), gen,
+                             UINT64_MAX });
+        }
+    }
+}
+
+void auSamplerNode::process (const float *const *inputs,
+                             float *const *outputs, size_t frames) {
+    for (unsigned int ch = 0; ch < channels; ch++) {
+        memset (outputs[ch], 0, frames * sizeof (float));
+    }
+
+    uint32_t packed;
+    while (notes.pop (&packed)) {
+        uint8_t key = packed >> 8, velocity = packed & 0x7F;
+        if (velocity) {
+            note_on (key, velocity);
+        } else {
+            note_off (key);
+        }
+    }
+
+    // streamed frames pass through a chunk of scratch, without one they
+    // count as underruns and the voices keep their place
+    float *chunk = au_scratch<float> (AU_SAMPLER_CHUNK
+                                      * AU_SAMPLER_MAX_CHANNELS);
+    for (unsigned int v = 0; v < params.voices; v++) {
+        if (voices[v].sample) {
+            render_voice (voices[v], outputs, chunk, frames);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#include "spdlog/spdlog.h"
+#include <engine/Scheduler.hpp>
+#include <util/RtAlloc.hpp>
+#include <util/time.h>
+
+auGraphScheduler::auGraphScheduler (unsigned int workers, size_t max_steps,
+                                    auEngineParams params) :
+    stats (std::make_unique<auWorkerStats[]> (workers + 1)),
+    capacity (max_steps) {
+    for (unsigned int i = 0; i <= workers; i++) {
+        deques.push_back (std::make_unique<auWorkDeque> (max_steps));
+        scratch.push_back (std::make_unique<auArena> (AU_SCRATCH_BYTES));
+    }
+
+    running = true;
+    for (unsigned int i = 1; i <= workers; i++) {
+        threads.emplace_back (&auGraphScheduler::worker_loop, this, i);
+
+        auEngineParams worker_params = params;
+        if (params.cpu >= 0) worker_params.cpu = params.cpu + int (i);
+        au_make_realtime (threads.back (), worker_params);
+    }
+    spdlog::info ("Graph scheduler running {} workers", workers);
+}
+
+auGraphScheduler::~auGraphScheduler () {
+    running = false;
+    epoch.fetch_add (1, std::memory_order_release);
+    epoch.notify_all ();
+    for (std::thread &t : threads) t.join ();
+}
+
+void auGraphScheduler::execute (unsigned int worker, uint32_t step) {
+    uint64_t start = au_now_ns ();
+    graph->run_step (step, frames);
+
+    // whoever releases a successor's last dependency runs it, keeping the
+    // chain hot in this core's cache
+    for (uint32_t i = graph->successor_offsets[step];
+         i < graph->successor_offsets[step + 1]; i++) {
+        uint32_t next = graph->successors[i];
+        if (graph->waiting[next].fetch_sub (1, std::memory_order_acq_rel)
+            == 1) {
+            deques[worker]->push (next);
+        }
+    }
+
+    stats[worker].block_busy_ns += au_now_ns () - start;
+    stats[worker].steps.fetch_add (1, std::memory_order_relaxed);
+    done.fetch_add (1, std::memory_order_release);
+}
+
+void auGraphScheduler::work (unsigned int worker) {
+    size_t       total = graph->get_step_count ();
+    unsigned int count = get_worker_count ();
+    unsigned int victim = worker;
+    unsigned int spins  = 0;
+
+    while (done.load (std::memory_order_acquire) < total) {
+        uint32_t step;
+        if (deques[worker]->pop (&step)) {
+            execute (worker, step);
+            spins = 0;
+            continue;
+        }
+
+        bool stole = false;
+        for (unsigned int i = 1; i < count && !stole; i++) {
+            victim = (victim + 1) % count;
+            if (victim == worker) continue;
+            stole = deques[victim]->steal (&step);
+        }
+        if (stole) {
+            execute (worker, step);
+            spins = 0;
+        } else {
+            au_backoff (&spins);
+        }
+    }
+}
+
+void auGraphScheduler::worker_loop (unsigned int worker) {
+    // blocks can only start once every worker exists, so the first one is
+    // always epoch 1 even if this thread starts late
+    uint64_t       seen = 0;
+    auRtScope      rt;
+    auScratchScope use (*scratch[worker]);
+    while (true) {
+        epoch.wait (seen, std::memory_order_acquire);
+        seen = epoch.load (std::memory_order_acquire);
+        if (!running.load (std::memory_order_relaxed)) return;
+
+        stats[worker].block_busy_ns = 0;
+        work (worker);
+        active.fetch_sub (1, std::memory_order_release);
+    }
+}
+
+void auGraphScheduler::run (auCompiledGraph &graph, size_t frames,
+                            uint64_t deadline_ns) {
+    uint64_t       start = au_now_ns ();
+    size_t         total = graph.get_step_count ();
+    auScratchScope use (*scratch[0]);
+
+    if (threads.empty () || total > capacity) {
+        if (total > capacity) {
+            fallbacks.fetch_add (1, std::memory_order_relaxed);
+        }
+        graph.run (frames);
+    } else {
+        // the workers are all parked, the block state is ours to set up
+        this->graph  = &graph;
+        this->frames = frames;
+        done.store (0, std::memory_order_relaxed);
+        for (size_t i = 0; i < total; i++) {
+            graph.waiting[i].store (graph.dependency_count[i],
+                                    std::memory_order_relaxed);
+        }
+
+        // spread the roots so every worker starts with something
+        unsigned int count = get_worker_count ();
+        for (size_t i = 0; i < graph.roots.size (); i++) {
+            deques[i % count]->push (graph.roots[i]);
+        }
+
+        active.store (unsigned (threads.size ()), std::memory_order_relaxed);
+        epoch.fetch_add (1, std::memory_order_release);
+        epoch.notify_all ();
+
+        stats[0].block_busy_ns = 0;
+        work (0);
+
+        // nobody may still be touching this block when the next starts
+        unsigned int spins = 0;
+        while (active.load (std::memory_order_acquire) != 0) {
+            au_backoff (&spins);
+        }
+    }
+
+    uint64_t elapsed = au_now_ns () - start;
+    uint64_t budget  = deadline_ns ? deadline_ns : elapsed;
+    if (deadline_ns && elapsed > deadline_ns) {
+        late_blocks.fetch_add (1, std::memory_order_relaxed);
+    }
+    blocks.fetch_add (1, std::memory_order_relaxed);
+
+    if (threads.empty () || total > capacity) {
+        stats[0].block_busy_ns = elapsed;
+    }
+    for (unsigned int i = 0; i < get_worker_count (); i++) {
+        auWorkerStats &s   = stats[i];
+        float          now = budget ? float (s.block_busy_ns) / budget : 0.f;
+        float          old = s.load.load (std::memory_order_relaxed);
+        s.load.store (old + (now - old) * 0.05f, std::memory_order_relaxed);
+        s.busy_ns.fetch_add (s.block_busy_ns, std::memory_order_relaxed);
+        s.block_busy_ns = 0;
+    }
+}
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <engine/Synth.hpp>
+#include <util/time.h>
+
+// envelopes below this in release are done
+#define AU_SYNTH_SILENCE 1e-4f
+
+// attack chases past full scale so the one pole curve reaches 1 in time
+#define AU_SYNTH_ATTACK_TARGET 1.2f
+
+auSynthNode::auSynthNode (unsigned int channels) : channels (channels) {
+    memset (&voices, 0, sizeof (voices));
+    memset (group_mask, 0, sizeof (group_mask));
+    memset (note_voice, -1, sizeof (note_voice));
+    for (int v = 0; v < AU_SYNTH_MAX_VOICES; v++) {
+        stage[v] = Idle;
+        // lowest voices on top so sounding voices pack into few groups
+        free_stack[free_count++] = int16_t (AU_SYNTH_MAX_VOICES - 1 - v);
+    }
+}
+
+void auSynthNode::prepare (unsigned int rate, size_t max_frames) {
+    if (float (rate) != sample_rate) sample_rate = float (rate);
+}
+
+bool auSynthNode::send (const uint8_t *data, uint8_t size) {
+    if (size < 1 || size > 3) return false;
+    miEvent e { au_now_ns (), size, {} };
+    memcpy (e.data, data, size);
+    return events.push (e);
+}
+
+// time constant for a one pole reaching ~99% within `seconds`
+static float envelope_coef (float seconds, float sample_rate) {
+    float frames = std::max (seconds * sample_rate, 1.f);
+    return 1.f - expf (-4.6f / frames);
+}
+
+void auSynthNode::unlink (int16_t v) {
+    bool     released = stage[v] == Release;
+    int16_t &head     = released ? released_head : held_head;
+    int16_t &tail     = released ? released_tail : held_tail;
+    if (prev[v] >= 0) {
+        next[prev[v]] = next[v];
+    } else {
+        head = next[v];
+    }
+    if (next[v] >= 0) {
+        prev[next[v]] = prev[v];
+    } else {
+        tail = prev[v];
+    }
+}
+
+void auSynthNode::append (int16_t v, bool released) {
+    int16_t &head = released ? released_head : held_head;
+    int16_t &tail = released ? released_tail : held_tail;
+    prev[v]       = tail;
+    next[v]       = -1;
+    if (tail >= 0) {
+        next[tail] = v;
+    } else {
+        head = v;
+    }
+    tail = v;
+}
+
+void auSynthNode::free_voice (int16_t v) {
+    unlink (v);
+    if (note_voice[voice_channel[v]][voice_note[v]] == v) {
+        note_voice[voice_channel[v]][voice_note[v]] = -1;
+    }
+    stage[v]         = Idle;
+    voices.level[v]  = 0;
+    voices.amp[v]    = 0;
+    voices.target[v] = 0;
+    group_mask[v / AU_SYNTH_LANES] &= ~(1u << (v % AU_SYNTH_LANES));
+    free_stack[free_count++] = v;
+}
+
+void auSynthNode::release_voice (int16_t v) {
+    unlink (v);
+    if (note_voice[voice_channel[v]][voice_note[v]] == v) {
+        note_voice[voice_channel[v]][voice_note[v]] = -1;
+    }
+    stage[v]         = Release;
+    voices.target[v] = 0;
+    voices.coef[v]   = envelope_coef (params.release, sample_rate);
+    append (v, true);
+}
+
+void auSynthNode::note_on (uint8_t channel, uint8_t note, uint8_t velocity) {
+    // a retriggered key releases its old voice
+    if (note_voice[channel][note] >= 0) {
+        release_voice (note_voice[channel][note]);
+    }
+
+    int16_t v;
+    if (free_count > 0) {
+        v = free_stack[--free_count];
+    } else {
+        v = released_head >= 0 ? released_head : held_head;
+        free_voice (v);
+        free_count--;
+        stolen.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    float freq = 440.f * exp2f ((float (note) - 69.f) / 12.f);
+    float inc  = std::min (freq / sample_rate, 0.5f);
+    voices.phase[v]   = 0;
+    voices.inc[v]     = inc;
+    voices.inv_inc[v] = 1.f / inc;
+    voices.amp[v]     = params.gain * float (velocity) / 127.f;
+
+    voices.level[v]  = 0;
+    voices.target[v] = AU_SYNTH_ATTACK_TARGET;
+    voices.coef[v]   = envelope_coef (params.attack, sample_rate);
+
+    float cutoff
+        = params.cutoff
+          * exp2f (params.key_track * (float (note) - 60.f) / 12.f);
+    cutoff  = std::clamp (cutoff, 20.f, sample_rate * 0.45f);
+    float g = tanf (float (M_PI) * cutoff / sample_rate);
+    float k = 2.f - 2.f * std::clamp (params.resonance, 0.f, 0.98f);
+    voices.a1[v]  = 1.f / (1.f + g * (g + k));
+    voices.a2[v]  = g * voices.a1[v];
+    voices.a3[v]  = g * voices.a2[v];
+    voices.ic1[v] = 0;
+    voices.ic2[v] = 0;
+
+    stage[v]                  = Attack;
+    voice_channel[v]          = channel;
+    voice_note[v]             = note;
+    note_voice[channel][note] = v;
+    group_mask[v / AU_SYNTH_LANES] |= 1u << (v % AU_SYNTH_LANES);
+    append (v, false);
+}
+
+void auSynthNode::note_off (uint8_t channel, uint8_t note) {
+    int16_t v = note_voice[channel][note];
+    if (v >= 0) release_voice (v);
+}
+
+void auSynthNode::all_notes_off () {
+    while (held_head >= 0) release_voice (held_head);
+}
+
+void auSynthNode::handle (const uint8_t *data, uint8_t size) {
+    if (size < 3) return;
+    uint8_t channel = data[0] & 0x0F;
+    uint8_t note    = data[1] & 0x7F;
+    switch (data[0] & 0xF0) {
+    case 0x90:
+        if (data[2]) {
+            note_on (channel, note, data[2] & 0x7F);
+            break;
+        }
+        [[fallthrough]];
+    case 0x80:
+        note_off (channel, note);
+        break;
+    case 0xB0:
+        if (data[1] == 120 || data[1] == 123) all_notes_off ();
+        break;
+    }
+}
+
+// envelope stage changes happen between chunks, the one pole is smooth
+// enough that a chunk of lag never shows
+void auSynthNode::advance_envelopes () {
+    for (int16_t v = held_head; v >= 0; v = next[v]) {
+        if (stage[v] == Attack && voices.level[v] >= 1.f) {
+            voices.level[v]  = 1.f;
+            voices.target[v] = params.sustain;
+            voices.coef[v]   = envelope_coef (params.decay, sample_rate);
+            stage[v]         = Decay;
+        }
+    }
+    for (int16_t v = released_head; v >= 0;) {
+        int16_t n = next[v];
+        if (voices.level[v] < AU_SYNTH_SILENCE) free_voice (v);
+        v = n;
+    }
+}
+
+void auSynthNode::render (auVec8 *mix, float *out, size_t frames) {
+    for (size_t i = 0; i < frames; i++) mix[i] = au_vec_set1 (0.f);
+
+    const auVec8 one = au_vec_set1 (1.f);
+    for (int group = 0; group < AU_SYNTH_GROUPS; group++) {
+        if (!group_mask[group]) continue;
+        size_t base = size_t (group) * AU_SYNTH_LANES;
+
+        auVec8 phase   = au_vec_load (voices.phase + base);
+        auVec8 inc     = au_vec_load (voices.inc + base);
+        auVec8 inv_inc = au_vec_load (voices.inv_inc + base);
+        auVec8 amp     = au_vec_load (voices.amp + base);
+        auVec8 level   = au_vec_load (voices.level + base);
+        auVec8 target  = au_vec_load (voices.target + base);
+        auVec8 coef    = au_vec_load (voices.coef + base);
+        auVec8 a1      = au_vec_load (voices.a1 + base);
+        auVec8 a2      = au_vec_load (voices.a2 + base);
+        auVec8 a3      = au_vec_load (voices.a3 + base);
+        auVec8 ic1     = au_vec_load (voices.ic1 + base);
+        auVec8 ic2     = au_vec_load (voices.ic2 + base);
+
+        for (size_t i = 0; i < frames; i++) {
+            // polyblep saw, the corrections only apply right around the
+            // wrap and are masked in instead of branched to
+            auVec8 saw  = phase * 2.f - 1.f;
+            auVec8 x0   = phase * inv_inc;
+            auVec8 x1   = (phase - 1.f) * inv_inc;
+            auVec8 low  = au_vec_from_mask (phase < inc);
+            auVec8 high = au_vec_from_mask (phase > one - inc);
+            saw -= low * (x0 + x0 - x0 * x0 - 1.f);
+            saw -= high * (x1 * x1 + x1 + x1 + 1.f);
+
+            phase += inc;
+            phase -= au_vec_from_mask (phase >= 1.f);
+
+            level += (target - level) * coef;
+            level = au_vec_min (level, one);
+
+            auVec8 v3 = saw - ic2;
+            auVec8 v1 = a1 * ic1 + a2 * v3;
+            auVec8 v2 = ic2 + a2 * ic1 + a3 * v3;
+            ic1       = v1 + v1 - ic1;
+            ic2       = v2 + v2 - ic2;
+
+            mix[i] += v2 * level * amp;
+        }
+
+        au_vec_store (voices.phase + base, phase);
+        au_vec_store (voices.level + base, level);
+        au_vec_store (voices.ic1 + base, ic1);
+        au_vec_store (voices.ic2 + base, ic2);
+    }
+
+    for (size_t i = 0; i < frames; i++) out[i] = au_vec_sum (mix[i]);
+    advance_envelopes ();
+}
+
+// the clock ticks once per stream period, blocks after the first one of
+// a period start as many frames later as were rendered since
+uint64_t auSynthNode::block_time (size_t frames) {
+    const auAudioClock *c    = clock.load (std::memory_order_acquire);
+    uint64_t            base = c ? c->get_block_ns () : 0;
+    if (!base) return au_now_ns ();
+
+    if (base != clock_base) {
+        clock_base   = base;
+        clock_frames = 0;
+    }
+    uint64_t ns = base + uint64_t (double (clock_frames) * 1e9 / sample_rate);
+    clock_frames += frames;
+    return ns;
+}
+
+void auSynthNode::process (const float *const *inputs,
+                           float *const *outputs, size_t frames) {
+    // voices sum into a chunk of scratch, without one the block is silent
+    // and events wait for the next
+    auVec8 *mix = au_scratch<auVec8> (AU_PARAM_CHUNK);
+    if (!mix) {
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            memset (outputs[ch], 0, frames * sizeof (float));
+        }
+        return;
+    }
+
+    auSynthParams p;
+    while (param_changes.pop (&p)) params = p;
+
+    size_t  count = 0;
+    miEvent e;
+    while (count < AU_SYNTH_MAX_EVENTS && events.pop (&e)) {
+        block_events[count++] = { 0, e.size, { e.data[0], e.data[1],
+                                              e.data[2] } };
+    }
+    // queued events all sit at 0 and come first, the input's are sorted
+    miInput *in = input.load (std::memory_order_acquire);
+    if (in) {
+        count += in->read_block (block_time (frames), unsigned (sample_rate),
+                                 frames, block_events + count,
+                                 AU_SYNTH_MAX_EVENTS - count);
+    }
+
+    float *out  = outputs[0];
+    size_t next = 0;
+    for (size_t done = 0; done < frames;) {
+        while (next < count && block_events[next].offset <= done) {
+            handle (block_events[next].data, block_events[next].size);
+            next++;
+        }
+        size_t until = next < count ? block_events[next].offset : frames;
+        size_t n = std::min<size_t> ({ until - done, frames - done,
+                                       size_t (AU_PARAM_CHUNK) });
+        render (mix, out + done, n);
+        done += n;
+    }
+    for (unsigned int ch = 1; ch < channels; ch++) {
+        memcpy (outputs[ch], out, frames * sizeof (float));
+    }
+
+    active_voices.store (uint32_t (AU_SYNTH_MAX_VOICES - free_count),
+                         std::memory_order_relaxed);
+}
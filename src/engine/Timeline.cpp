@@ -0,0 +1,344 @@
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cstring>
+#include <engine/Messages.hpp>
+#include <engine/Timeline.hpp>
+
+unsigned int auTimeline::add_track (unsigned int channels) {
+    tracks.push_back (channels);
+    return unsigned (tracks.size () - 1);
+}
+
+size_t auTimeline::add_clip (auTimelineClip clip) {
+    if (!clip.source || clip.track >= tracks.size () || !clip.length
+        || clip.offset + clip.length > clip.source->get_frames ()) {
+        spdlog::error ("Clip of {} frames at {} does not fit its source or "
+                       "track",
+                       clip.length, clip.offset);
+        return SIZE_MAX;
+    }
+    std::sort (clip.envelope.begin (), clip.envelope.end (),
+               [] (const auEnvelopePoint &a, const auEnvelopePoint &b) {
+                   return a.frame < b.frame;
+               });
+    clips.push_back (std::move (clip));
+    return clips.size () - 1;
+}
+
+void auTimeline::remove_clip (size_t id) {
+    if (id < clips.size ()) clips[id] = auTimelineClip ();
+}
+
+bool auTimeline::move_clip (size_t id, uint64_t start) {
+    if (!get_clip (id)) return false;
+    clips[id].start = start;
+    return true;
+}
+
+auCompiledTimelineRef auTimeline::compile (unsigned int sample_rate,
+                                           size_t       block_frames) const {
+    auto timeline          = std::make_shared<auCompiledTimeline> ();
+    timeline->block_frames = std::max<size_t> (block_frames, 1);
+
+    for (unsigned int channels : tracks) {
+        timeline->track_ports.push_back (timeline->port_count);
+        timeline->port_count += channels;
+    }
+    timeline->track_ports.push_back (timeline->port_count);
+
+    for (const auTimelineClip &clip : clips) {
+        if (!clip.source) continue;
+        if (clip.source->get_sample_rate () != sample_rate) {
+            spdlog::warn ("Clip source runs at {} Hz on a {} Hz timeline",
+                          clip.source->get_sample_rate (), sample_rate);
+        }
+        timeline->clips.push_back (clip);
+    }
+    std::stable_sort (timeline->clips.begin (), timeline->clips.end (),
+                      [] (const auTimelineClip &a, const auTimelineClip &b) {
+                          return a.start < b.start;
+                      });
+
+    uint64_t end = 0;
+    for (uint32_t i = 0; i < timeline->clips.size (); i++) {
+        const auTimelineClip &clip = timeline->clips[i];
+        end = std::max (end, clip.start + clip.length);
+        timeline->max_end.push_back (end);
+        timeline->events.push_back ({ clip.start, i, 1 });
+        timeline->events.push_back ({ clip.start + clip.length, i, 0 });
+    }
+    timeline->length = end;
+
+    // stops first so back to back clips never overlap
+    std::sort (timeline->events.begin (), timeline->events.end (),
+               [] (const auTimelineEvent &a, const auTimelineEvent &b) {
+                   if (a.frame != b.frame) return a.frame < b.frame;
+                   if (a.start != b.start) return a.start < b.start;
+                   return a.clip < b.clip;
+               });
+
+    size_t active = 0;
+    for (const auTimelineEvent &e : timeline->events) {
+        active = e.start ? active + 1 : active - 1;
+        timeline->max_active = std::max (timeline->max_active, active);
+    }
+    if (timeline->max_active > AU_TIMELINE_MAX_ACTIVE) {
+        spdlog::warn ("{} clips overlap, only {} can sound at once",
+                      timeline->max_active, AU_TIMELINE_MAX_ACTIVE);
+    }
+
+    size_t blocks = end / timeline->block_frames + 1;
+    size_t e      = 0;
+    for (size_t b = 0; b <= blocks; b++) {
+        uint64_t frame = b * timeline->block_frames;
+        while (e < timeline->events.size ()
+               && timeline->events[e].frame < frame) {
+            e++;
+        }
+        timeline->block_offsets.push_back (uint32_t (e));
+    }
+
+    spdlog::info ("Compiled timeline of {} clips on {} tracks, {} frames "
+                  "long",
+                  timeline->clips.size (), tracks.size (), end);
+    return timeline;
+}
+
+size_t auCompiledTimeline::find_event (uint64_t frame) const {
+    size_t block = frame / block_frames;
+    if (block + 1 >= block_offsets.size ()) return events.size ();
+
+    size_t e = block_offsets[block];
+    while (e < events.size () && events[e].frame < frame) e++;
+    return e;
+}
+
+// touches the source pages of every clip sounding in [from, to)
+void auCompiledTimeline::prefetch (uint64_t from, uint64_t to) const {
+    auto last = std::lower_bound (clips.begin (), clips.end (), to,
+                                  [] (const auTimelineClip &c, uint64_t f) {
+                                      return c.start < f;
+                                  });
+    size_t i  = last - clips.begin ();
+    while (i-- > 0 && max_end[i] > from) {
+        const auTimelineClip &clip = clips[i];
+        uint64_t              end  = clip.start + clip.length;
+        if (end <= from) continue;
+
+        uint64_t first = std::max (from, clip.start);
+        clip.source->prefetch (clip.offset + first - clip.start,
+                               std::min (end, to) - first);
+    }
+}
+
+auTimelineNode::auTimelineNode (auCompiledTimelineRef timeline) :
+    port_count (timeline->port_count) {
+    set_timeline (std::move (timeline));
+
+    running    = true;
+    prefetcher = std::thread (&auTimelineNode::prefetch_loop, this);
+}
+
+auTimelineNode::~auTimelineNode () {
+    running = false;
+    if (prefetcher.joinable ()) prefetcher.join ();
+}
+
+void auTimelineNode::prefetch_loop () {
+    const auCompiledTimeline *last  = nullptr;
+    uint64_t                  done  = 0; // prefetched up to here
+    uint64_t                  begin = 0;
+
+    while (running.load (std::memory_order_relaxed)) {
+        // a reference of our own, so collect cannot free the timeline while
+        // the disk is read without the lock
+        auCompiledTimelineRef timeline;
+        {
+            std::lock_guard<std::mutex> lock (timelines_mutex);
+            const auCompiledTimeline   *t = in_use.load ();
+            if (!t) t = pending.load ();
+            for (const auCompiledTimelineRef &ref : timelines) {
+                if (ref.get () == t) timeline = ref;
+            }
+        }
+
+        uint64_t pos = seek_to.load ();
+        if (pos == UINT64_MAX) pos = position.load ();
+
+        // the rest of this index block and all of the next one
+        uint64_t block = timeline->block_frames;
+        uint64_t to    = (pos / block + 2) * block;
+        if (timeline.get () != last || pos < begin || pos > done) {
+            last = timeline.get ();
+            done = pos;
+        }
+        begin = pos;
+        if (to > done) {
+            timeline->prefetch (done, to);
+            done = to;
+        }
+        timeline.reset ();
+
+        timespec nap { 0, 2000000 };
+        clock_nanosleep (CLOCK_MONOTONIC, 0, &nap, nullptr);
+    }
+}
+
+bool auTimelineNode::set_timeline (auCompiledTimelineRef timeline) {
+    if (timeline->port_count != port_count) {
+        spdlog::error ("Timeline has {} ports, the node was built for {}",
+                       timeline->port_count, port_count);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock (timelines_mutex);
+    pending.store (timeline.get ());
+    timelines.push_back (std::move (timeline));
+    return true;
+}
+
+void auTimelineNode::collect () {
+    std::lock_guard<std::mutex> lock (timelines_mutex);
+    const auCompiledTimeline   *keep = pending.load ();
+    const auCompiledTimeline   *used = in_use.load ();
+    std::erase_if (timelines, [=] (const auCompiledTimelineRef &t) {
+        return t.get () != keep && t.get () != used;
+    });
+}
+
+void auTimelineNode::start_voice (uint32_t index) {
+    if (voice_count == AU_TIMELINE_MAX_ACTIVE) {
+        dropped.fetch_add (1, std::memory_order_relaxed);
+        return;
+    }
+    voices[voice_count++] = { &current->clips[index], index, 0 };
+}
+
+void auTimelineNode::stop_voice (uint32_t index) {
+    for (size_t v = 0; v < voice_count; v++) {
+        if (voices[v].index == index) {
+            voices[v] = voices[--voice_count];
+            return;
+        }
+    }
+}
+
+// rebuilds the sounding clips from scratch, only after seeks and swaps
+void auTimelineNode::locate (uint64_t frame) {
+    voice_count = 0;
+    next_event  = current->find_event (frame);
+
+    // clips starting right at `frame` are left to their start events
+    const std::vector<auTimelineClip> &clips = current->clips;
+    auto first = std::lower_bound (clips.begin (), clips.end (), frame,
+                                   [] (const auTimelineClip &c, uint64_t f) {
+                                       return c.start < f;
+                                   });
+    size_t i   = first - clips.begin ();
+    while (i-- > 0 && current->max_end[i] > frame) {
+        if (clips[i].start + clips[i].length > frame) {
+            start_voice (uint32_t (i));
+        }
+    }
+}
+
+static float envelope_at (const std::vector<auEnvelopePoint> &env,
+                          size_t &segment, uint64_t t) {
+    if (env.empty ()) return 1.f;
+    if (t <= env[0].frame) return env[0].gain;
+    while (segment + 1 < env.size () && env[segment + 1].frame <= t) {
+        segment++;
+    }
+    if (segment + 1 == env.size ()) return env[segment].gain;
+
+    const auEnvelopePoint &a = env[segment], &b = env[segment + 1];
+    float                  x = float (t - a.frame) / float (b.frame - a.frame);
+    return a.gain + (b.gain - a.gain) * x;
+}
+
+void auTimelineNode::render (float *const *outputs, size_t offset,
+                             uint64_t frame, size_t frames) {
+    float curve[AU_PARAM_CHUNK];
+    for (size_t v = 0; v < voice_count; v++) {
+        Voice                &voice = voices[v];
+        const auTimelineClip &clip  = *voice.clip;
+        uint64_t              rel   = frame - clip.start;
+
+        unsigned int port     = current->track_ports[clip.track];
+        unsigned int channels = current->track_ports[clip.track + 1] - port;
+        unsigned int sources  = clip.source->get_channels ();
+
+        for (size_t done = 0; done < frames; done += AU_PARAM_CHUNK) {
+            size_t n = std::min<size_t> (frames - done, AU_PARAM_CHUNK);
+            for (size_t i = 0; i < n; i++) {
+                uint64_t t = rel + done + i;
+                float    g = clip.gain
+                          * envelope_at (clip.envelope, voice.envelope, t);
+                if (t < clip.fade_in) g *= float (t) / float (clip.fade_in);
+                if (clip.length - t < clip.fade_out) {
+                    g *= float (clip.length - t) / float (clip.fade_out);
+                }
+                curve[i] = g;
+            }
+
+            // mono sources feed every channel of the track
+            for (unsigned int ch = 0; ch < channels; ch++) {
+                const float *src
+                    = clip.source->get_plane (std::min (ch, sources - 1))
+                      + clip.offset + rel + done;
+                float *dst = outputs[port + ch] + offset + done;
+                for (size_t i = 0; i < n; i++) dst[i] += src[i] * curve[i];
+            }
+        }
+    }
+}
+
+void auTimelineNode::process (const float *const *inputs,
+                              float *const *outputs, size_t frames) {
+    for (unsigned int p = 0; p < port_count; p++) {
+        memset (outputs[p], 0, frames * sizeof (float));
+    }
+
+    const auCompiledTimeline *p = pending.load ();
+    while (p != current) {
+        // same handshake as auGraphPlayer::acquire
+        in_use.store (p);
+        const auCompiledTimeline *again = pending.load ();
+        if (again == p) {
+            current = p;
+            locate (position.load (std::memory_order_relaxed));
+            break;
+        }
+        p = again;
+    }
+
+    uint64_t target = seek_to.exchange (UINT64_MAX);
+    if (target != UINT64_MAX) {
+        position.store (target, std::memory_order_relaxed);
+        locate (target);
+    }
+    if (!playing.load (std::memory_order_relaxed)) return;
+
+    const std::vector<auTimelineEvent> &events = current->events;
+    uint64_t pos  = position.load (std::memory_order_relaxed);
+    size_t   done = 0;
+    while (done < frames) {
+        uint64_t frame = pos + done;
+        if (next_event < events.size ()
+            && events[next_event].frame <= frame) {
+            const auTimelineEvent &e = events[next_event++];
+            if (e.start) {
+                start_voice (e.clip);
+            } else {
+                stop_voice (e.clip);
+            }
+            continue;
+        }
+        uint64_t until = next_event < events.size ()
+                             ? events[next_event].frame
+                             : UINT64_MAX;
+        size_t   n     = std::min<uint64_t> (frames - done, until - frame);
+        if (voice_count) render (outputs, done, frame, n);
+        done += n;
+    }
+    position.store (pos + frames, std::memory_order_relaxed);
+}
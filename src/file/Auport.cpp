@@ -1,5 +1,6 @@
 #include "Audio.hpp"
 #include "spdlog/spdlog.h"
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <file/Auport.hpp>
@@ -150,8 +151,10 @@ auFileReader::auFileReader (std::filesystem::path _path,
         s_format.channels    = num_channels;
         s_format.data_type   = fmt_type_to_dtype (fmt_type, bits_per_sample);
 
-        duration = data_size / bytes_per_sec;
-        buf_size = data_size;
+        duration    = data_size / bytes_per_sec;
+        buf_size    = data_size;
+        data_offset = file.tellg ();
+        frame_size  = block_size;
 
         break;
     }
@@ -166,6 +169,26 @@ bool auFileReader::read_chunk (char *buffer, size_t size) {
     file.read (buffer, size);
     return true;
 }
+
+bool auFileReader::seek_frame (uint64_t frame) {
+    if (error || frame > get_frames ()) return false;
+    file.clear ();
+    file.seekg (data_offset + std::streamoff (frame * frame_size));
+    return bool (file);
+}
+
+size_t auFileReader::read_frames (char *buffer, size_t frames) {
+    if (error || !frame_size) return 0;
+
+    // never read past the data chunk into trailing chunks
+    std::streamoff end = data_offset + std::streamoff (buf_size);
+    std::streamoff pos = file.tellg ();
+    if (pos < data_offset || pos >= end) return 0;
+    frames = std::min<uint64_t> (frames, (end - pos) / frame_size);
+
+    file.read (buffer, std::streamsize (frames * frame_size));
+    return size_t (file.gcount ()) / frame_size;
+}
 auFileWriter::auFileWriter (std::filesystem::path _path,
                             AudioFileFormat _format, auSFormat _s_format) :
     s_format (_s_format) {
@@ -217,7 +240,7 @@ auFileWriter::~auFileWriter () {
 
     file.close ();
 }
-bool auFileWriter::write_chunk (char *buffer, size_t size) {
+bool auFileWriter::write_chunk (const char *buffer, size_t size) {
     file.write (buffer, size);
-    return true;
+    return !file.fail ();
 }
\ No newline at end of file
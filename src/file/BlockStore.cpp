@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cstring>
+#include <file/BlockStore.hpp>
+
+auBlockStore &auBlockStore::get () {
+    static auBlockStore store;
+    return store;
+}
+
+auBlockPtr auBlockStore::create (const float *const *planes,
+                                 uint32_t channels, uint32_t frames) {
+    frames          = std::min<uint32_t> (frames, AU_BLOCK_FRAMES);
+    auAudioBlock *b = new auAudioBlock { channels, frames, {} };
+    b->data.resize (size_t (channels) * frames);
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        memcpy (b->data.data () + size_t (ch) * frames, planes[ch],
+                frames * sizeof (float));
+    }
+
+    uint64_t size = b->data.size () * sizeof (float);
+    blocks.fetch_add (1, std::memory_order_relaxed);
+    bytes.fetch_add (size, std::memory_order_relaxed);
+    return auBlockPtr (b, [this, size] (const auAudioBlock *b) {
+        blocks.fetch_sub (1, std::memory_order_relaxed);
+        bytes.fetch_sub (size, std::memory_order_relaxed);
+        delete b;
+    });
+}
+
+// block frame behind frame `i` of a reference
+static inline uint32_t block_frame (const auBlockRef &ref, uint64_t i) {
+    return ref.reversed ? ref.offset + ref.length - 1 - uint32_t (i)
+                        : ref.offset + uint32_t (i);
+}
+
+auBlockList auBlockList::import (const float *const *planes,
+                                 uint32_t channels, uint64_t frames) {
+    auBlockList                list (channels);
+    std::vector<const float *> at (planes, planes + channels);
+    for (uint64_t done = 0; done < frames; done += AU_BLOCK_FRAMES) {
+        uint32_t n = uint32_t (std::min<uint64_t> (frames - done,
+                                                   AU_BLOCK_FRAMES));
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            at[ch] = planes[ch] + done;
+        }
+        auBlockRef ref;
+        ref.block  = auBlockStore::get ().create (at.data (), channels, n);
+        ref.length = n;
+        list.refs.push_back (std::move (ref));
+    }
+    return list;
+}
+
+uint64_t auBlockList::get_frames () const {
+    uint64_t frames = 0;
+    for (const auBlockRef &ref : refs) frames += ref.length;
+    return frames;
+}
+
+size_t auBlockList::split (uint64_t frame) {
+    uint64_t pos = 0;
+    for (size_t i = 0; i < refs.size (); i++) {
+        if (frame == pos) return i;
+
+        uint32_t length = refs[i].length;
+        if (frame < pos + length) {
+            uint32_t   k     = uint32_t (frame - pos);
+            auBlockRef first = refs[i], second = refs[i];
+            // a reversed window starts at the end of its block range
+            if (refs[i].reversed) {
+                first.offset = refs[i].offset + length - k;
+            } else {
+                second.offset = refs[i].offset + k;
+            }
+            first.length  = k;
+            second.length = length - k;
+            refs[i]       = std::move (first);
+            refs.insert (refs.begin () + i + 1, std::move (second));
+            return i + 1;
+        }
+        pos += length;
+    }
+    return refs.size ();
+}
+
+std::pair<size_t, size_t> auBlockList::range (uint64_t start, uint64_t end) {
+    uint64_t frames = get_frames ();
+    end             = std::min (end, frames);
+    start           = std::min (start, end);
+    size_t first    = split (start);
+    size_t last     = split (end);
+    return { first, last };
+}
+
+void auBlockList::read (uint64_t frame, uint64_t frames,
+                        float *const *planes) const {
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        memset (planes[ch], 0, frames * sizeof (float));
+    }
+
+    uint64_t pos = 0;
+    for (const auBlockRef &ref : refs) {
+        uint64_t end = pos + ref.length;
+        if (end <= frame) {
+            pos = end;
+            continue;
+        }
+        if (pos >= frame + frames) break;
+
+        uint64_t from = std::max (pos, frame);
+        uint64_t to   = std::min (end, frame + frames);
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            const float *src = ref.block->get_plane (ch);
+            float       *dst = planes[ch] + (from - frame);
+            for (uint64_t i = from - pos; i < to - pos; i++) {
+                *dst++ = src[block_frame (ref, i)] * ref.gain;
+            }
+        }
+        pos = end;
+    }
+}
+
+auBlockList auBlockList::copy (uint64_t start, uint64_t end) const {
+    auBlockList whole = *this;
+    return whole.cut (start, end);
+}
+
+auBlockList auBlockList::cut (uint64_t start, uint64_t end) {
+    auto [first, last] = range (start, end);
+    auBlockList removed (channels);
+    removed.refs.assign (refs.begin () + first, refs.begin () + last);
+    refs.erase (refs.begin () + first, refs.begin () + last);
+    return removed;
+}
+
+bool auBlockList::splice (uint64_t at, const auBlockList &other) {
+    if (refs.empty () && !channels) channels = other.channels;
+    if (other.channels != channels) return false;
+
+    size_t i = split (std::min (at, get_frames ()));
+    refs.insert (refs.begin () + i, other.refs.begin (), other.refs.end ());
+    return true;
+}
+
+void auBlockList::apply_gain (uint64_t start, uint64_t end, float gain) {
+    auto [first, last] = range (start, end);
+    for (size_t i = first; i < last; i++) refs[i].gain *= gain;
+}
+
+void auBlockList::reverse (uint64_t start, uint64_t end) {
+    auto [first, last] = range (start, end);
+    std::reverse (refs.begin () + first, refs.begin () + last);
+    for (size_t i = first; i < last; i++) {
+        refs[i].reversed = !refs[i].reversed;
+    }
+}
+
+void auBlockList::write (uint64_t frame, uint64_t frames,
+                         const float *const *planes) {
+    auto [first, last] = range (frame, frame + frames);
+
+    // the range is split at the write's edges, so every ref in it is
+    // replaced whole by a fresh block
+    std::vector<const float *> at (channels);
+    uint64_t                   pos = frame;
+    for (size_t i = first; i < last; i++) {
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            at[ch] = planes[ch] + (pos - frame);
+        }
+        auBlockRef ref;
+        ref.length = refs[i].length;
+        ref.block  = auBlockStore::get ().create (at.data (), channels,
+                                                  ref.length);
+        pos       += ref.length;
+        refs[i]    = std::move (ref);
+    }
+}
+
+static inline bool same_ref (const auBlockRef &a, const auBlockRef &b) {
+    return a.block == b.block && a.offset == b.offset
+           && a.length == b.length && a.gain == b.gain
+           && a.reversed == b.reversed;
+}
+
+auEditHistory::auEditHistory (auBlockList initial, size_t limit) :
+    state (std::move (initial)), limit (std::max<size_t> (limit, 1)) {}
+
+void auEditHistory::commit (auBlockList next) {
+    const std::vector<auBlockRef> &a = state.refs, &b = next.refs;
+
+    // only what lies between the common prefix and suffix changed
+    size_t first = 0;
+    while (first < a.size () && first < b.size ()
+           && same_ref (a[first], b[first])) {
+        first++;
+    }
+    size_t tail = 0;
+    while (tail < a.size () - first && tail < b.size () - first
+           && same_ref (a[a.size () - 1 - tail], b[b.size () - 1 - tail])) {
+        tail++;
+    }
+
+    Step step;
+    step.first = first;
+    step.before.assign (a.begin () + first, a.end () - tail);
+    step.after.assign (b.begin () + first, b.end () - tail);
+    step.before_channels = state.channels;
+    step.after_channels  = next.channels;
+
+    steps.resize (applied);
+    steps.push_back (std::move (step));
+    applied++;
+    if (steps.size () > limit) {
+        steps.erase (steps.begin ());
+        applied--;
+    }
+    state = std::move (next);
+}
+
+void auEditHistory::replace (const Step &step, bool forward) {
+    const std::vector<auBlockRef> &from = forward ? step.before : step.after;
+    const std::vector<auBlockRef> &to   = forward ? step.after : step.before;
+
+    std::vector<auBlockRef> &refs = state.refs;
+    auto                     at   = refs.begin () + step.first;
+    refs.erase (at, at + from.size ());
+    refs.insert (refs.begin () + step.first, to.begin (), to.end ());
+    state.channels = forward ? step.after_channels : step.before_channels;
+}
+
+bool auEditHistory::undo () {
+    if (!can_undo ()) return false;
+    replace (steps[--applied], false);
+    return true;
+}
+
+bool auEditHistory::redo () {
+    if (!can_redo ()) return false;
+    replace (steps[applied++], true);
+    return true;
+}
+
+size_t auEditHistory::get_ref_bytes () const {
+    size_t bytes = state.get_ref_bytes ();
+    for (const Step &step : steps) {
+        bytes += (step.before.size () + step.after.size ())
+                 * sizeof (auBlockRef);
+    }
+    return bytes;
+}
@@ -0,0 +1,145 @@
+#include "spdlog/spdlog.h"
+#include <file/ClipCache.hpp>
+#include <functional>
+
+size_t auClipKeyHash::operator() (const auClipKey &key) const {
+    size_t h = std::hash<std::string> () (key.path);
+    h ^= std::hash<int64_t> () (key.mtime) + 0x9e3779b97f4a7c15 + (h << 6)
+         + (h >> 2);
+    uint64_t f = (uint64_t (key.s_format.sample_rate) << 32)
+                 ^ (uint64_t (key.s_format.bit_depth) << 24)
+                 ^ (uint64_t (key.s_format.channels) << 8)
+                 ^ uint64_t (key.s_format.data_type + 1);
+    h ^= std::hash<uint64_t> () (f) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+    return h;
+}
+
+auClipCache &auClipCache::get () {
+    static auClipCache cache (size_t (512) << 20);
+    return cache;
+}
+
+static auClipRef decode_clip (std::filesystem::path path,
+                              AudioFileFormat format, auSFormat target) {
+    auFileReader reader (path, format);
+    if (reader.get_error ()) { return nullptr; }
+
+    auSFormat s_format = reader.get_s_format ();
+    if (!s_format.verify () || !target.verify ()) { return nullptr; }
+
+    std::vector<char> raw (reader.get_buf_size ());
+    reader.read_chunk (raw.data (), raw.size ());
+
+    auto clip = std::make_shared<auClipBlock> (target);
+    if (s_format == target) {
+        clip->data = std::move (raw);
+        return clip;
+    }
+
+    size_t size = au_convert_buffer_size (s_format, target, raw.size ());
+    if (size == 0) { return nullptr; }
+
+    clip->data.resize (size);
+    if (!au_convert_buffer (s_format, target, raw.data (), raw.size (),
+                            clip->data.data ())) {
+        return nullptr;
+    }
+    return clip;
+}
+
+auClipRef auClipCache::load (std::filesystem::path path,
+                             AudioFileFormat format, auSFormat target) {
+    std::error_code ec;
+    auto            mtime = std::filesystem::last_write_time (path, ec);
+    if (ec) {
+        spdlog::error ("Could not stat \"{}\": {}", path.string (),
+                       ec.message ());
+        return nullptr;
+    }
+
+    auClipKey key { std::filesystem::absolute (path).string (),
+                    int64_t (mtime.time_since_epoch ().count ()), target };
+
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        auto                        it = index.find (key);
+        if (it != index.end ()) {
+            slots[it->second].referenced = true;
+            hits++;
+            return slots[it->second].clip;
+        }
+    }
+    misses++;
+
+    // decode without holding the lock, a concurrent miss on the same key
+    // just decodes twice and the second insert is dropped
+    auClipRef clip = decode_clip (path, format, target);
+    if (!clip) { return nullptr; }
+
+    std::lock_guard<std::mutex> lock (mutex);
+    if (index.find (key) == index.end ()) { insert (key, clip); }
+    return clip;
+}
+
+void auClipCache::insert (const auClipKey &key, auClipRef clip) {
+    size_t size = clip->get_size ();
+    if (size > budget) {
+        spdlog::warn ("Clip \"{}\" ({} bytes) is larger than the cache "
+                      "budget, not caching it",
+                      key.path, size);
+        return;
+    }
+
+    while (used + size > budget && evict_one ()) {}
+
+    size_t slot;
+    if (!free_slots.empty ()) {
+        slot = free_slots.back ();
+        free_slots.pop_back ();
+        slots[slot] = { key, std::move (clip), false };
+    } else {
+        slot = slots.size ();
+        slots.push_back ({ key, std::move (clip), false });
+    }
+    index.emplace (key, slot);
+    used += size;
+}
+
+bool auClipCache::evict_one () {
+    if (index.empty ()) { return false; }
+
+    // second chance: referenced slots get cleared and skipped once
+    while (true) {
+        if (hand >= slots.size ()) { hand = 0; }
+        auClipSlot &slot = slots[hand];
+        if (slot.clip) {
+            if (slot.referenced) {
+                slot.referenced = false;
+            } else {
+                used -= slot.clip->get_size ();
+                index.erase (slot.key);
+                slot.clip.reset ();
+                free_slots.push_back (hand);
+                evictions++;
+                hand++;
+                return true;
+            }
+        }
+        hand++;
+    }
+}
+
+void auClipCache::set_budget (size_t bytes) {
+    std::lock_guard<std::mutex> lock (mutex);
+    budget = bytes;
+    while (used > budget && evict_one ()) {}
+}
+
+void auClipCache::clear () {
+    std::lock_guard<std::mutex> lock (mutex);
+    slots.clear ();
+    free_slots.clear ();
+    index.clear ();
+    hand = 0;
+    used = 0;
+}
\ No newline at end of file
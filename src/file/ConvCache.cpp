@@ -0,0 +1,278 @@
+#include "spdlog/spdlog.h"
+#include <cstring>
+#include <fcntl.h>
+#include <file/ConvCache.hpp>
+#include <fmt/core.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t CONV_CACHE_VERSION = 1;
+
+static size_t plane_stride (uint64_t frames) {
+    return (frames + 15) & ~uint64_t (15); // 64 byte aligned planes
+}
+
+auPlanarClip::auPlanarClip (void *_map, size_t _map_size) :
+    map (_map), map_size (_map_size) {
+    auConvCacheHeader header;
+    memcpy (&header, map, sizeof (header));
+    sample_rate = header.sample_rate;
+    channels    = header.channels;
+    frames      = header.frames;
+    stride      = plane_stride (frames);
+}
+
+auPlanarClip::~auPlanarClip () {
+    if (map) { munmap (map, map_size); }
+}
+
+const float *auPlanarClip::get_plane (uint32_t channel) const {
+    if (channel >= channels) { return nullptr; }
+    return reinterpret_cast<const float *> (static_cast<const char *> (map)
+                                            + sizeof (auConvCacheHeader))
+           + channel * stride;
+}
+
+void auPlanarClip::prefetch (uint64_t first, uint64_t count) const {
+    if (first >= frames) return;
+    if (count > frames - first) count = frames - first;
+
+    uintptr_t page = uintptr_t (sysconf (_SC_PAGESIZE));
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        const float *from  = get_plane (ch) + first;
+        uintptr_t    begin = reinterpret_cast<uintptr_t> (from) & ~(page - 1);
+        uintptr_t    end   = reinterpret_cast<uintptr_t> (from + count);
+        madvise (reinterpret_cast<void *> (begin), end - begin,
+                 MADV_WILLNEED);
+
+        // the advice only starts readahead, touching waits for it
+        for (uintptr_t p = begin; p < end; p += page) {
+            (void)*reinterpret_cast<const volatile char *> (p);
+        }
+    }
+}
+
+auConvCache::auConvCache (std::filesystem::path project_dir) {
+    dir = project_dir / ".bouillabaisse-cache";
+
+    std::error_code ec;
+    std::filesystem::create_directories (dir, ec);
+    if (ec) {
+        spdlog::error ("Could not create cache directory \"{}\": {}",
+                       dir.string (), ec.message ());
+        return;
+    }
+    load_index ();
+}
+
+void auConvCache::load_index () {
+    std::ifstream file (dir / "index");
+    if (file.fail ()) { return; }
+
+    auConvIndexEntry entry;
+    std::string      path;
+    while (file >> std::hex >> entry.hash >> std::dec >> entry.size
+           >> entry.mtime) {
+        file >> std::ws;
+        if (!std::getline (file, path)) { break; }
+        index[path] = entry; // later lines win
+    }
+}
+
+void auConvCache::append_index (const std::string &path,
+                                auConvIndexEntry   entry) {
+    std::ofstream file (dir / "index", std::ios::app);
+    file << fmt::format ("{:016x} {} {} {}\n", entry.hash, entry.size,
+                         entry.mtime, path);
+}
+
+bool auConvCache::get_hash (const std::filesystem::path &path,
+                            uint64_t                    *hash) {
+    std::error_code ec;
+    std::string     key   = std::filesystem::absolute (path).string ();
+    uint64_t        size  = std::filesystem::file_size (path, ec);
+    int64_t         mtime = 0;
+    if (!ec) {
+        mtime = std::filesystem::last_write_time (path, ec)
+                    .time_since_epoch ()
+                    .count ();
+    }
+    if (ec) {
+        spdlog::error ("Could not stat \"{}\": {}", path.string (),
+                       ec.message ());
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        auto                        it = index.find (key);
+        if (it != index.end () && it->second.size == size
+            && it->second.mtime == mtime) {
+            *hash = it->second.hash;
+            return true;
+        }
+    }
+
+    std::ifstream file (path, std::ios::binary);
+    if (file.fail ()) {
+        spdlog::error ("Could not open \"{}\"!", path.string ());
+        return false;
+    }
+
+    // FNV-1a, fast enough to be bounded by the disk
+    uint64_t          h = 0xcbf29ce484222325;
+    std::vector<char> chunk (1 << 20);
+    while (file) {
+        file.read (chunk.data (), chunk.size ());
+        std::streamsize n = file.gcount ();
+        for (std::streamsize i = 0; i < n; i++) {
+            h ^= uint8_t (chunk[i]);
+            h *= 0x100000001b3;
+        }
+    }
+
+    auConvIndexEntry entry { h, size, mtime };
+    std::lock_guard<std::mutex> lock (mutex);
+    index[key] = entry;
+    append_index (key, entry);
+
+    *hash = h;
+    return true;
+}
+
+std::filesystem::path auConvCache::get_entry_path (uint64_t  hash,
+                                                   auSFormat target) {
+    return dir
+           / fmt::format ("{:016x}-{}-{}.f32", hash, target.sample_rate,
+                          target.channels);
+}
+
+bool auConvCache::write_entry (const std::filesystem::path &entry_path,
+                               std::filesystem::path        source,
+                               AudioFileFormat format, auSFormat target,
+                               uint64_t hash) {
+    auFileReader reader (source, format);
+    if (reader.get_error ()) { return false; }
+
+    auSFormat s_format = reader.get_s_format ();
+    if (!s_format.verify ()) { return false; }
+    if (!au_can_convert_to_planar (s_format)) {
+        spdlog::error ("Cannot convert \"{}\" to planar floats(data type {}, "
+                       "bit depth {})!",
+                       source.string (), int (s_format.data_type),
+                       s_format.bit_depth);
+        return false;
+    }
+
+    std::vector<char> raw (reader.get_buf_size ());
+    reader.read_chunk (raw.data (), raw.size ());
+
+    uint64_t frames
+        = raw.size () / ((s_format.bit_depth / 8) * s_format.channels);
+    size_t stride = plane_stride (frames);
+
+    std::vector<float>   planar (stride * target.channels, 0.0f);
+    std::vector<float *> planes (target.channels);
+    for (uint32_t i = 0; i < target.channels; i++) {
+        planes[i] = planar.data () + i * stride;
+    }
+    if (!au_convert_to_planar (s_format, target, raw.data (), raw.size (),
+                               planes.data ())) {
+        return false;
+    }
+
+    auConvCacheHeader header {};
+    memcpy (header.magic, "BCCF", 4);
+    header.version     = CONV_CACHE_VERSION;
+    header.hash        = hash;
+    header.sample_rate = target.sample_rate;
+    header.channels    = target.channels;
+    header.frames      = frames;
+
+    // write to a temporary name so a crash never leaves a torn entry
+    std::filesystem::path tmp_path = entry_path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file (tmp_path, std::ios::binary);
+        file.write (reinterpret_cast<const char *> (&header),
+                    sizeof (header));
+        file.write (reinterpret_cast<const char *> (planar.data ()),
+                    planar.size () * sizeof (float));
+        if (file.fail ()) {
+            spdlog::error ("Could not write cache entry \"{}\"!",
+                           tmp_path.string ());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename (tmp_path, entry_path, ec);
+    if (ec) {
+        spdlog::error ("Could not rename cache entry \"{}\": {}",
+                       tmp_path.string (), ec.message ());
+        return false;
+    }
+    return true;
+}
+
+static auPlanarClipRef map_entry (const std::filesystem::path &entry_path,
+                                  uint64_t hash, auSFormat target) {
+    int fd = open (entry_path.c_str (), O_RDONLY);
+    if (fd < 0) { return nullptr; }
+
+    struct stat st;
+    if (fstat (fd, &st) < 0
+        || size_t (st.st_size) < sizeof (auConvCacheHeader)) {
+        close (fd);
+        return nullptr;
+    }
+
+    void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) { return nullptr; }
+
+    auConvCacheHeader header;
+    memcpy (&header, map, sizeof (header));
+    size_t expected = sizeof (header)
+                      + plane_stride (header.frames) * header.channels
+                            * sizeof (float);
+    if (memcmp (header.magic, "BCCF", 4)
+        || header.version != CONV_CACHE_VERSION || header.hash != hash
+        || header.sample_rate != target.sample_rate
+        || header.channels != target.channels
+        || size_t (st.st_size) < expected) {
+        spdlog::warn ("Ignoring stale cache entry \"{}\"",
+                      entry_path.string ());
+        munmap (map, st.st_size);
+        return nullptr;
+    }
+
+    madvise (map, st.st_size, MADV_WILLNEED);
+    return std::make_shared<auPlanarClip> (map, st.st_size);
+}
+
+auPlanarClipRef auConvCache::load (std::filesystem::path source,
+                                   AudioFileFormat format, auSFormat target) {
+    if (target.data_type != auDtype::sFloat || target.bit_depth != 32) {
+        spdlog::error ("Conversion cache only stores 32 bit float!");
+        return nullptr;
+    }
+
+    uint64_t hash;
+    if (!get_hash (source, &hash)) { return nullptr; }
+
+    std::filesystem::path entry_path = get_entry_path (hash, target);
+    if (auPlanarClipRef clip = map_entry (entry_path, hash, target)) {
+        hits++;
+        return clip;
+    }
+    misses++;
+
+    if (!write_entry (entry_path, source, format, target, hash)) {
+        return nullptr;
+    }
+    return map_entry (entry_path, hash, target);
+}
\ No newline at end of file
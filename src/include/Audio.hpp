@@ -36,8 +36,24 @@ struct auSFormat {
         data_type   = dt;
     }
     bool verify ();
+
+    inline bool operator== (const auSFormat &other) const {
+        return sample_rate == other.sample_rate
+               && bit_depth == other.bit_depth && channels == other.channels
+               && data_type == other.data_type;
+    }
 };
 
 size_t au_convert_buffer_size (auSFormat from, auSFormat to, size_t size);
 bool   au_convert_buffer (auSFormat from, auSFormat to, char *from_buf,
-                          size_t fromsize, char *to_buf);
\ No newline at end of file
+                          size_t fromsize, char *to_buf);
+
+// whether au_convert_to_planar can read `format`, false for the companded
+// and ADPCM types and for odd bit depths
+bool au_can_convert_to_planar (auSFormat format);
+
+// converts interleaved frames into the engine's native planar float layout,
+// planes must hold to.channels pointers with room for fromsize / frame size
+// samples each
+bool au_convert_to_planar (auSFormat from, auSFormat to, const char *from_buf,
+                           size_t fromsize, float **planes);
\ No newline at end of file
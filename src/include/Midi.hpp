@@ -0,0 +1,152 @@
+#pragma once
+
+#include "io/OutputEngine.hpp"
+#include "util/SpscRing.hpp"
+#include <alsa/asoundlib.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// events buffered between a port's thread and its consumer
+#define MI_QUEUE_SIZE 1024
+
+// a channel or system message, sysex is not carried
+struct miEvent {
+    uint64_t time_ns; // au_now_ns clock
+    uint8_t  size;    // 1 to 3
+    uint8_t  data[3];
+};
+
+// an event placed inside an audio block
+struct miBlockEvent {
+    uint32_t offset; // frames into the block
+    uint8_t  size;
+    uint8_t  data[3];
+};
+
+enum miPortType {
+    miPortSeq = 0, // an ALSA sequencer port, "seq:<client>:<port>"
+    miPortRaw = 1, // a raw MIDI device, "raw:<alsa device>"
+};
+
+struct miPortInfo {
+    std::string id; // what miInput::open and miOutput::open take
+    std::string name;
+    miPortType  type;
+};
+
+std::vector<miPortInfo> mi_list_inputs ();
+std::vector<miPortInfo> mi_list_outputs ();
+
+// reassembles a raw MIDI byte stream into messages, running status and
+// interleaved real-time bytes included
+class miParser {
+    uint8_t status   = 0;
+    uint8_t data[2]  = {};
+    uint8_t count    = 0;
+    uint8_t expected = 0;
+    bool    sysex    = false;
+
+public:
+    // true when `byte` completed a message, its time is left untouched
+    bool feed (uint8_t byte, miEvent *out);
+};
+
+// receives from one port on its own real-time thread, stamping each event
+// on arrival. one audio thread drains it per block
+class miInput {
+    snd_seq_t        *seq     = nullptr;
+    snd_midi_event_t *decoder = nullptr;
+    snd_rawmidi_t    *raw     = nullptr;
+    int               port    = -1;
+    miParser          parser;
+
+    auSpscRing<miEvent> queue { MI_QUEUE_SIZE };
+
+    std::thread           thread;
+    std::atomic<bool>     running  = false;
+    std::atomic<uint64_t> overruns = 0; // events lost before delivery
+    std::atomic<uint64_t> late     = 0; // events older than a period
+    int                   wake_fd  = -1;
+
+    // consumer side, the first event not due yet
+    miEvent held;
+    bool    has_held = false;
+
+    void push (const miEvent &event);
+    void read_seq ();
+    void read_raw ();
+    void run ();
+
+public:
+    miInput () = default;
+    ~miInput ();
+
+    miInput (const miInput &)            = delete;
+    miInput &operator= (const miInput &) = delete;
+
+    int  open (const std::string &id, auEngineParams params = {});
+    void close ();
+
+    inline bool is_open () const { return seq || raw; }
+
+    // real-time side. hands out the events of the period before the block
+    // starting at `block_ns`, each at the offset it arrived at, so every
+    // event is delayed by exactly one period. events that missed their
+    // period land on offset 0. `block_ns` should come from a filtered clock
+    // for the offsets to be free of wakeup jitter
+    size_t read_block (uint64_t block_ns, unsigned int sample_rate,
+                       size_t frames, miBlockEvent *out, size_t max);
+
+    inline uint64_t get_overruns () const { return overruns.load (); }
+
+    inline uint64_t get_late () const { return late.load (); }
+};
+
+// sends to one port. events can be sent right away from a control thread or
+// scheduled from one real-time thread, the port's thread sends those once
+// their time came
+class miOutput {
+    snd_seq_t     *seq  = nullptr;
+    snd_rawmidi_t *raw  = nullptr;
+    int            port = -1;
+
+    // send and the port's thread each encode with their own parser state
+    // and take turns on the device
+    snd_midi_event_t *encoder        = nullptr; // control side
+    snd_midi_event_t *thread_encoder = nullptr; // port thread
+    std::mutex        device_mutex;
+
+    auSpscRing<miEvent> queue { MI_QUEUE_SIZE };
+    std::vector<miEvent> waiting; // sorted by time, port thread only
+
+    std::thread           thread;
+    std::atomic<bool>     running  = false;
+    std::atomic<uint64_t> overruns = 0;
+
+    void run ();
+    int  write (snd_midi_event_t *enc, const uint8_t *data, size_t size);
+
+public:
+    miOutput () = default;
+    ~miOutput ();
+
+    miOutput (const miOutput &)            = delete;
+    miOutput &operator= (const miOutput &) = delete;
+
+    int  open (const std::string &id, auEngineParams params = {});
+    void close ();
+
+    inline bool is_open () const { return seq || raw; }
+
+    // control side, may block
+    int send (const uint8_t *data, size_t size);
+
+    // real-time side, false when the queue is full
+    bool schedule (const miEvent &event);
+
+    inline uint64_t get_overruns () const { return overruns.load (); }
+};
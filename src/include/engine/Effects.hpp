@@ -0,0 +1,171 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "engine/Messages.hpp"
+#include "util/MpscQueue.hpp"
+#include "util/Simd.hpp"
+#include <atomic>
+#include <memory>
+
+#define AU_EQ_MAX_BANDS 8
+
+enum auEqType : uint8_t {
+    auEqOff,
+    auEqBell,
+    auEqLowShelf,
+    auEqHighShelf,
+    auEqLowCut,
+    auEqHighCut,
+};
+
+struct auEqBand {
+    auEqType type    = auEqOff;
+    float    freq    = 1000.f; // Hz
+    float    gain_db = 0.f;     // bells and shelves only
+    float    q       = 0.707f;
+};
+
+// normalized so a0 is 1
+struct auBiquadCoefs {
+    float b0 = 1.f, b1 = 0.f, b2 = 0.f;
+    float a1 = 0.f, a2 = 0.f;
+};
+
+// the audio eq cookbook designs. false when the band leaves the signal alone
+// or its frequency is out of range
+bool au_biquad_design (const auEqBand &band, float sample_rate,
+                       auBiquadCoefs *out);
+
+// cascaded transposed direct form II biquads. bands and channels share the
+// lanes of a vector: a band takes a slot of `pack` lanes, one per channel,
+// and runs a frame behind the band in the slot before it. a stereo strip so
+// runs four bands per vector op instead of leaving six lanes idle, the skew
+// is unwound at the block edges so there is no latency
+class auEqNode : public auNode {
+    struct Change {
+        unsigned int  band;
+        bool          active;
+        auBiquadCoefs coefs;
+    };
+
+    unsigned int channels;
+    unsigned int pack; // channels per slot, a power of two up to a vector
+
+    std::atomic<float>  sample_rate = 48000.f;
+    auEqBand            bands[AU_EQ_MAX_BANDS]; // control side only
+    auMpscQueue<Change> changes { AU_EQ_MAX_BANDS * 4 };
+
+    // real-time side only
+    auBiquadCoefs coefs[AU_EQ_MAX_BANDS];
+    bool          active[AU_EQ_MAX_BANDS] = {};
+
+    // filter state per band and channel, band * channels + channel. both
+    // halves come from a locked pool, nullptr if it could not be mapped
+    auBufferPool state;
+    float       *z1, *z2;
+
+    bool push_band (unsigned int band);
+
+public:
+    explicit auEqNode (unsigned int channels);
+
+    // control side, takes effect at the next block. false once the queue
+    // is full or the band is out of range
+    bool set_band (unsigned int band, const auEqBand &params);
+
+    inline auEqBand get_band (unsigned int band) const { return bands[band]; }
+
+    unsigned int get_input_count () const override { return channels; }
+    unsigned int get_output_count () const override { return channels; }
+
+    bool is_in_place () const override { return true; }
+
+    void prepare (unsigned int sample_rate, size_t max_frames) override;
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
+
+struct auCompressorParams {
+    float threshold_db = -18.f;
+    float ratio        = 4.f; // infinity limits
+    float knee_db      = 6.f;
+    float attack_ms    = 10.f;
+    float release_ms   = 100.f;
+    float makeup_db    = 0.f;
+};
+
+// a peak limiter holding the output under `ceiling_db`. the attack is
+// instant so no peak gets past, without lookahead it clips the first sample
+// of a transient into the gain curve instead
+auCompressorParams au_limiter_params (float ceiling_db,
+                                      float release_ms = 50.f);
+
+// feed forward compressor with one detector linked across channels. the
+// level, gain curve and envelope all stay in the log domain, so attack and
+// release are one pole filters on decibels and the curve costs a fast log2
+// and exp2 per frame
+class auCompressorNode : public auNode {
+    unsigned int channels;
+    float        sample_rate = 48000.f;
+
+    auMpscQueue<auCompressorParams> param_changes { 4 };
+
+    // real-time side only, levels in log2 units
+    auCompressorParams params;
+    float              threshold, slope, half_knee, inv_twice_knee, makeup;
+    float              attack_coef, release_coef;
+    float              envelope  = 0.f; // current gain reduction, <= 0
+    float              coef_rate = 0.f; // the rate the coefs were made for
+
+    float level[AU_PARAM_CHUNK];
+
+    std::atomic<float> reduction_db = 0.f;
+
+    void update_coefs ();
+
+public:
+    explicit auCompressorNode (unsigned int channels) : channels (channels) {}
+
+    // any thread, takes effect at the next block
+    inline bool set_params (const auCompressorParams &p) {
+        return param_changes.push (p);
+    }
+
+    // the gain reduction at the end of the last block, for meters
+    inline float get_reduction_db () const { return reduction_db.load (); }
+
+    unsigned int get_input_count () const override { return channels; }
+    unsigned int get_output_count () const override { return channels; }
+
+    bool is_in_place () const override { return true; }
+
+    void prepare (unsigned int sample_rate, size_t max_frames) override;
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
+
+// constant power panner from -1 (left) to 1 (right). a mono input is spread
+// over both outputs at -3 dB in the center, a stereo input is balanced so
+// the center leaves it untouched
+class auPanNode : public auNode {
+    unsigned int inputs;
+    auParam      pan { 0.f };
+
+public:
+    // one or two inputs
+    explicit auPanNode (unsigned int inputs = 2) :
+        inputs (inputs == 1 ? 1 : 2) {}
+
+    inline void set_pan (float p) { pan.set (p); }
+
+    // for sample-accurate changes through auMessageQueue::set_param
+    inline auParam *get_pan_param () { return &pan; }
+
+    unsigned int get_input_count () const override { return inputs; }
+    unsigned int get_output_count () const override { return 2; }
+
+    bool is_in_place () const override { return true; }
+
+    void process (const float *const *in, float *const *out,
+                  size_t frames) override;
+};
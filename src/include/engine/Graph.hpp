@@ -0,0 +1,215 @@
+#pragma once
+
+#include "io/OutputEngine.hpp"
+#include "util/RtAlloc.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class auGraphScheduler;
+class auMessageQueue;
+
+// every graph buffer is one mono plane of 32 bit floats
+#define AU_GRAPH_ALIGN AU_RT_ALIGN
+
+// a processing step, ports are mono planes. process runs on the real-time
+// thread and must not lock, allocate or log
+class auNode {
+public:
+    virtual ~auNode () = default;
+
+    virtual unsigned int get_input_count () const  = 0;
+    virtual unsigned int get_output_count () const = 0;
+
+    // unconnected inputs read silence, `frames` never exceeds the max block
+    // size the graph was compiled for
+    virtual void process (const float *const *inputs, float *const *outputs,
+                          size_t frames)
+        = 0;
+
+    // called off the real-time thread whenever a graph holding the node is
+    // compiled. an older graph may still be running it, so state should only
+    // be reallocated when the parameters changed
+    virtual void prepare (unsigned int sample_rate, size_t max_frames) {}
+
+    // in place nodes may be handed output p aliasing input p, they have to
+    // cope with both aliased and separate planes
+    virtual bool is_in_place () const { return false; }
+
+    // frames the node delays its input by, and keeps sounding after its
+    // input went silent
+    virtual uint32_t get_latency () const { return 0; }
+    virtual uint32_t get_tail () const { return 0; }
+};
+
+typedef std::shared_ptr<auNode> auNodeRef;
+
+struct auGraphStep {
+    auNode *node;
+    size_t  inputs;  // offset into auCompiledGraph::ports
+    size_t  outputs; // offset into auCompiledGraph::ports
+};
+
+// the flattened graph the real-time thread runs, immutable once built
+class auCompiledGraph {
+    friend class auGraph;
+    friend class auGraphScheduler;
+
+    std::vector<auNodeRef>   nodes; // keeps the nodes alive
+    std::vector<auGraphStep> steps;
+    std::vector<float *>     ports;
+    std::vector<float *>     outputs;
+
+    // step dependencies for parallel runs: data edges plus the ordering
+    // buffer reuse needs, successors of step i are
+    // successors[successor_offsets[i] .. successor_offsets[i + 1]]
+    std::vector<uint32_t>                 dependency_count;
+    std::vector<uint32_t>                 successor_offsets;
+    std::vector<uint32_t>                 successors;
+    std::vector<uint32_t>                 roots;
+    std::unique_ptr<std::atomic<uint32_t>[]> waiting; // per block countdown
+
+    auSlab                   arena; // buffer 0 is silence and never written
+    std::unique_ptr<auArena> scratch; // for threads that bring none
+    size_t   buffer_count = 0;
+    size_t   max_frames   = 0;
+    uint32_t latency      = 0;
+
+public:
+    // runs every node once, in order
+    void run (size_t frames);
+
+    // the thread's scratch arena is reset, nodes never keep scratch from
+    // one step to the next
+    inline void run_step (size_t step, size_t frames) {
+        const auGraphStep &s = steps[step];
+        if (au_rt_scratch) au_rt_scratch->reset ();
+        s.node->process (&ports[s.inputs], &ports[s.outputs], frames);
+    }
+
+    inline size_t get_step_count () const { return steps.size (); }
+
+    inline size_t get_max_frames () const { return max_frames; }
+
+    inline size_t get_buffer_count () const { return buffer_count; }
+
+    inline size_t get_output_count () const { return outputs.size (); }
+
+    // the worst input to output latency the nodes declared at compile time
+    inline uint32_t get_latency () const { return latency; }
+
+    // valid until the next run
+    inline const float *get_output (size_t channel) const {
+        return outputs[channel];
+    }
+};
+
+struct auGraphEdge {
+    size_t       from;
+    unsigned int from_port;
+    size_t       to;
+    unsigned int to_port;
+};
+
+struct auGraphOutput {
+    size_t       node;
+    unsigned int port;
+};
+
+// the editable topology, lives on the control thread. compiling it builds a
+// new auCompiledGraph that can be swapped in while audio runs
+class auGraph {
+    std::vector<auNodeRef>     nodes; // removed nodes leave a nullptr
+    std::vector<auGraphEdge>   edges;
+    std::vector<auGraphOutput> outputs;
+
+public:
+    // returns the node's id
+    size_t add_node (auNodeRef node);
+    void   remove_node (size_t id);
+
+    // an input takes one edge, connecting it again replaces the old one
+    bool connect (size_t from, unsigned int from_port, size_t to,
+                  unsigned int to_port);
+    void disconnect (size_t to, unsigned int to_port);
+
+    // the graph's output channels, in order
+    bool set_output (unsigned int channel, size_t node, unsigned int port);
+
+    inline auNode *get_node (size_t id) const {
+        return id < nodes.size () ? nodes[id].get () : nullptr;
+    }
+
+    // sorts the nodes topologically and lays the buffers out so planes
+    // nobody reads anymore get reused. returns nullptr on cycles and for a
+    // max_frames of 0
+    std::unique_ptr<auCompiledGraph> compile (unsigned int sample_rate,
+                                              size_t       max_frames) const;
+};
+
+// hands compiled graphs to the real-time thread without locks. old graphs
+// are freed by the control thread once the real-time side moved on
+class auGraphPlayer {
+    std::mutex                                    retired_mutex;
+    std::vector<std::unique_ptr<auCompiledGraph>> graphs;
+
+    std::atomic<auCompiledGraph *> pending = nullptr;
+    std::atomic<auCompiledGraph *> in_use  = nullptr;
+
+    auCompiledGraph *current = nullptr; // real-time side only
+
+public:
+    // control side, takes effect at the next block
+    void swap (std::unique_ptr<auCompiledGraph> graph);
+
+    // control side, frees graphs the real-time thread no longer uses
+    void collect ();
+
+    // real-time side, returns the graph to run for this block or nullptr
+    auCompiledGraph *acquire ();
+};
+
+// converts `frames` frames of the graph's last outputs into `config`'s
+// interleaved format, starting `offset` frames into `out`
+void au_graph_write_frames (const auCompiledGraph *graph,
+                            const auStreamConfig &config, char *out,
+                            size_t offset, size_t frames);
+
+// renders a graph into an output stream, converting the planar float
+// outputs into the stream's interleaved format. with a scheduler the graph's
+// independent branches run in parallel. with a message queue its commands
+// are dispatched before every block, timed by the frames rendered so far
+class auGraphRenderer : public auRenderCallback {
+    auGraphPlayer    &player;
+    auStreamConfig    config;
+    auGraphScheduler *scheduler;
+    auMessageQueue   *messages;
+
+    std::atomic<uint64_t> frame_time = 0; // written by the real-time side
+
+    void run_graph (auCompiledGraph *graph, size_t frames);
+
+public:
+    auGraphRenderer (auGraphPlayer &player, const auStreamConfig &config,
+                     auGraphScheduler *scheduler = nullptr,
+                     auMessageQueue   *messages  = nullptr) :
+        player (player), config (config), scheduler (scheduler),
+        messages (messages) {}
+
+    // the frame the next block starts at, for commands with a frame time
+    inline uint64_t get_frame_time () const {
+        return frame_time.load (std::memory_order_relaxed);
+    }
+
+    // control side, frees the graphs and retired objects the real-time
+    // side is done with. call it periodically
+    void collect ();
+
+    void process (void *out, size_t frames) override;
+    void process_planar (void **channels, size_t frames) override;
+
+    bool has_planar () const override {
+        return config.format == SND_PCM_FORMAT_FLOAT;
+    }
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "util/MpscQueue.hpp"
+#include "util/SpscRing.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#define AU_PARAM_MAX_EVENTS 16
+
+// nodes render parameter curves in chunks of this many frames on the stack
+#define AU_PARAM_CHUNK 64
+
+// a smoothed parameter. the control side sets a target, the real-time side
+// renders it as a per-sample curve that ramps linearly to every new value.
+// changes can land on any frame of a block
+class auParam {
+    std::atomic<float> target;
+    uint32_t           ramp_frames;
+
+    // real-time side only. timed events never touch `target`, a set racing
+    // them would be lost. seen_target is the last target picked up,
+    // last_target where the current ramp heads
+    float    value;
+    float    seen_target;
+    float    last_target;
+    float    step      = 0;
+    uint32_t ramp_left = 0;
+
+    struct Event {
+        uint32_t offset;
+        float    value;
+    };
+    Event  events[AU_PARAM_MAX_EVENTS];
+    size_t event_count = 0;
+
+    void begin_ramp (float to);
+    void pick_up_target ();
+    void apply_event (size_t i);
+    void consume_events (size_t used, size_t frames);
+
+public:
+    explicit auParam (float initial = 0.f, uint32_t ramp_frames = 64) :
+        target (initial), ramp_frames (ramp_frames), value (initial),
+        seen_target (initial), last_target (initial) {}
+
+    auParam (const auParam &)            = delete;
+    auParam &operator= (const auParam &) = delete;
+
+    // any thread, picked up at the start of the next block
+    inline void set (float v) { target.store (v, std::memory_order_relaxed); }
+
+    // jumps to `v` without a ramp, only while nothing renders the param
+    inline void reset (float v) {
+        target.store (v, std::memory_order_relaxed);
+        value = seen_target = last_target = v;
+        ramp_left           = 0;
+        event_count         = 0;
+    }
+
+    // the last value set from a control thread, timed events aside
+    inline float get_target () const {
+        return target.load (std::memory_order_relaxed);
+    }
+
+    // real-time side, a change `offset` frames into the next rendered block.
+    // returns false when the block already holds too many, `v` then
+    // replaces the value of the last one so it still wins
+    bool set_at (uint32_t offset, float v);
+
+    // real-time side, the current value without rendering a curve
+    inline float get_value () const { return value; }
+
+    inline bool is_smoothing () const {
+        return ramp_left > 0 || event_count > 0
+               || target.load (std::memory_order_relaxed) != seen_target;
+    }
+
+    // real-time side, writes one value per frame. a block can be rendered
+    // in several calls, event offsets count from the first
+    void render (float *curve, size_t frames);
+
+    // real-time side, advances like render when no curve is needed, e.g. a
+    // node that is bypassed. returns the value at the end of the block
+    float skip (size_t frames);
+};
+
+enum auCommandType {
+    auCmdParam = 0, // param->set_at
+    auCmdCall  = 1, // call (ctx, arg) on the real-time thread
+};
+
+// trivially copyable so it can travel through the queue without allocating
+struct auCommand {
+    auCommandType type  = auCmdCall;
+    uint64_t      frame = 0; // absolute frame time, 0 for the next block
+
+    auParam *param = nullptr;
+    float    value = 0.f;
+
+    void (*call) (void *ctx, uint64_t arg) = nullptr;
+    void    *ctx                           = nullptr;
+    uint64_t arg                           = 0;
+};
+
+// something the real-time thread is done with, freed on the control side
+struct auRetired {
+    void *object;
+    void (*destroy) (void *object);
+};
+
+// control threads talk to the audio thread through here. commands go in
+// through a wait-free queue, objects the audio thread dropped come back
+// through a ring so it never frees memory itself
+class auMessageQueue {
+    auMpscQueue<auCommand> commands;
+    auSpscRing<auRetired>  retired;
+
+    // commands for a later block, real-time side only
+    std::unique_ptr<auCommand[]> held;
+    size_t                       held_count = 0;
+    size_t                       held_capacity;
+
+    std::atomic<uint64_t> dropped = 0; // full queues on either side
+
+    void apply (const auCommand &cmd, uint64_t block_frame);
+
+public:
+    explicit auMessageQueue (size_t capacity = 1024);
+
+    auMessageQueue (const auMessageQueue &)            = delete;
+    auMessageQueue &operator= (const auMessageQueue &) = delete;
+
+    // control side, false when the queue is full
+    bool send (const auCommand &cmd);
+
+    inline bool set_param (auParam *param, float value, uint64_t frame = 0) {
+        auCommand cmd;
+        cmd.type  = auCmdParam;
+        cmd.frame = frame;
+        cmd.param = param;
+        cmd.value = value;
+        return send (cmd);
+    }
+
+    inline bool call (void (*fn) (void *, uint64_t), void *ctx,
+                      uint64_t arg = 0, uint64_t frame = 0) {
+        auCommand cmd;
+        cmd.frame = frame;
+        cmd.call  = fn;
+        cmd.ctx   = ctx;
+        cmd.arg   = arg;
+        return send (cmd);
+    }
+
+    // real-time side, once per block before processing. applies every
+    // command due before `block_frame + frames`
+    void dispatch (uint64_t block_frame, size_t frames);
+
+    // real-time side, hands `object` back to be deleted by collect
+    template <typename T> void retire (T *object) {
+        auRetired r { object,
+                      [] (void *p) { delete static_cast<T *> (p); } };
+        if (retired.write (&r, 1) == 0) {
+            // leaking beats freeing on the audio thread
+            dropped.fetch_add (1, std::memory_order_relaxed);
+        }
+    }
+
+    // control side, frees everything retired so far
+    size_t collect ();
+
+    inline uint64_t get_dropped () const { return dropped.load (); }
+};
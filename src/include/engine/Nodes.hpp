@@ -0,0 +1,121 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "engine/Messages.hpp"
+#include "file/ConvCache.hpp"
+#include "util/SpscRing.hpp"
+#include <atomic>
+#include <vector>
+
+// scales every channel by one smoothed gain
+class auGainNode : public auNode {
+    unsigned int channels;
+    auParam      gain { 1.f };
+
+public:
+    explicit auGainNode (unsigned int channels) : channels (channels) {}
+
+    inline void set_gain (float g) { gain.set (g); }
+
+    // for sample-accurate changes through auMessageQueue::set_param
+    inline auParam *get_gain_param () { return &gain; }
+
+    unsigned int get_input_count () const override { return channels; }
+    unsigned int get_output_count () const override { return channels; }
+
+    bool is_in_place () const override { return true; }
+
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
+
+// sums `inputs` buses of `channels` planes each, input n's channel c is port
+// n * channels + c
+class auMixerNode : public auNode {
+    unsigned int inputs;
+    unsigned int channels;
+
+    std::unique_ptr<auParam[]> gains;
+
+public:
+    auMixerNode (unsigned int inputs, unsigned int channels) :
+        inputs (inputs), channels (channels),
+        gains (std::make_unique<auParam[]> (inputs)) {
+        for (unsigned int n = 0; n < inputs; n++) gains[n].reset (1.f);
+    }
+
+    inline void set_gain (unsigned int input, float g) {
+        gains[input].set (g);
+    }
+
+    inline auParam *get_gain_param (unsigned int input) {
+        return &gains[input];
+    }
+
+    unsigned int get_input_count () const override {
+        return inputs * channels;
+    }
+    unsigned int get_output_count () const override { return channels; }
+
+    void process (const float *const *in, float *const *out,
+                  size_t frames) override;
+};
+
+// plays a converted clip straight from the conversion cache
+class auClipNode : public auNode {
+    auPlanarClipRef clip;
+
+    std::atomic<uint64_t> position = 0;
+    std::atomic<bool>     playing  = false;
+    std::atomic<bool>     looping  = false;
+
+public:
+    explicit auClipNode (auPlanarClipRef clip) : clip (std::move (clip)) {}
+
+    inline void play () { playing.store (true); }
+    inline void pause () { playing.store (false); }
+    inline void seek (uint64_t frame) { position.store (frame); }
+    inline void set_looping (bool loop) { looping.store (loop); }
+
+    inline uint64_t get_position () const { return position.load (); }
+
+    unsigned int get_input_count () const override { return 0; }
+    unsigned int get_output_count () const override {
+        return clip->get_channels ();
+    }
+
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
+
+// converter source: interleaved frames in any format are written from
+// another thread and come out as float planes, missing frames as silence
+class auRingInputNode : public auNode {
+    auSFormat        s_format;
+    auSFormat        planar;
+    size_t           frame_size;
+    bool             valid; // whether the converter can read s_format
+    auSpscRing<char> ring;
+
+    // blocks are converted AU_PARAM_CHUNK frames at a time, so neither
+    // buffer depends on the block size a graph was compiled for
+    std::vector<char>     scratch;
+    std::vector<float *>  planes;
+    std::atomic<uint64_t> underflows = 0;
+
+public:
+    auRingInputNode (auSFormat s_format, size_t capacity_frames);
+
+    // producer side, returns how many whole frames were queued
+    size_t write (const void *data, size_t frames);
+
+    inline uint64_t get_underflows () const { return underflows.load (); }
+
+    unsigned int get_input_count () const override { return 0; }
+    unsigned int get_output_count () const override {
+        return s_format.channels;
+    }
+
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
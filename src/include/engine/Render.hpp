@@ -0,0 +1,49 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "file/Auport.hpp"
+#include <atomic>
+#include <filesystem>
+
+struct auRenderParams {
+    // frames handed to the writer at once, 0 means one second
+    size_t batch_frames = 0;
+
+    // scheduler workers besides the rendering thread, -1 uses every core
+    int workers = -1;
+};
+
+struct auRenderStats {
+    uint64_t frames   = 0;
+    uint64_t wall_ns  = 0;
+    uint64_t write_ns = 0; // time the renderer waited on the disk
+
+    // seconds of audio rendered per second of wall time
+    double realtime_factor = 0;
+};
+
+// bounces a graph to a file without a clock: blocks are rendered back to
+// back on every core while a second thread writes the previous batch
+class auOfflineRenderer {
+    auRenderParams params;
+
+    std::atomic<uint64_t> progress  = 0;
+    std::atomic<bool>     cancelled = false;
+
+public:
+    explicit auOfflineRenderer (auRenderParams params = auRenderParams ()) :
+        params (params) {}
+
+    // blocks until `frames` frames are written or the render was cancelled.
+    // the graph must not be running anywhere else meanwhile. s_format has to
+    // be 32 bit float or 16, 24 or 32 bit signed, -EINVAL otherwise
+    int render (auCompiledGraph &graph, const std::filesystem::path &path,
+                AudioFileFormat format, auSFormat s_format, uint64_t frames,
+                auRenderStats *stats = nullptr);
+
+    // any thread, render returns -ECANCELED soon after
+    inline void cancel () { cancelled = true; }
+
+    // frames rendered so far by the running render
+    inline uint64_t get_progress () const { return progress.load (); }
+};
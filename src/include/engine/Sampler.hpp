@@ -0,0 +1,137 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "file/Auport.hpp"
+#include "util/MpscQueue.hpp"
+#include "util/SpscRing.hpp"
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define AU_SAMPLER_MAX_CHANNELS 2
+
+struct auSamplerParams {
+    unsigned int voices     = 64;
+    uint32_t     head_ms    = 250; // preloaded per sample
+    uint32_t     ring_ms    = 1000; // streamed ahead per voice
+    uint32_t     release_ms = 100;
+    size_t       read_frames = 8192; // per file read
+};
+
+// where a sample sits on the keyboard, played back at its own pitch
+struct auSampleZone {
+    std::filesystem::path path;
+    uint8_t               key_low  = 0, key_high  = 127;
+    uint8_t               vel_low  = 1, vel_high  = 127;
+};
+
+// a sample's preloaded head, the rest stays on disk
+struct auSample {
+    auSampleZone zone;
+    auSFormat    s_format { 0, 0, 0, auDtype::eInvalid };
+    uint32_t     frame_size  = 0; // bytes per frame on disk
+    uint64_t     frames      = 0;
+    uint64_t     head_frames = 0;
+    std::vector<float> head; // interleaved float
+};
+
+// plays samples of any length from a small preloaded head per sample while
+// a background thread streams the rest into per voice rings. voices the
+// disk could not keep up with play silence and are counted
+class auSamplerNode : public auNode {
+    struct Voice {
+        const auSample *sample = nullptr;
+        uint64_t        position = 0; // frames into the sample
+        uint64_t        owed     = 0; // ring frames to drop after underruns
+        uint64_t        started  = 0; // note-on order, for stealing
+        float           gain     = 0;
+        float           release  = 0; // gain step per frame, 0 while held
+        uint8_t         note     = 0;
+        bool            underran = false;
+
+        // the streamer refills `ring` for stream `generation` once the
+        // real-time side flushed the previous stream's leftovers
+        std::unique_ptr<auSpscRing<float>> ring;
+        std::atomic<uint32_t>              generation = 0;
+        std::atomic<uint32_t>              ready      = 0;
+        std::atomic<uint32_t>              flushed    = 0;
+    };
+
+    // real-time thread to streamer
+    struct Request {
+        const auSample *sample;
+        uint32_t        voice;
+        uint32_t        generation;
+        uint64_t        frame; // first frame to stream, UINT64_MAX stops
+    };
+
+    // streamer side state per voice
+    struct Stream {
+        std::unique_ptr<auFileReader> reader;
+        const auSample               *sample     = nullptr;
+        uint32_t                      generation = 0;
+        bool                          active     = false;
+    };
+
+    auSamplerParams params;
+    unsigned int    channels;
+    unsigned int    sample_rate;
+
+    std::vector<std::unique_ptr<auSample>> samples;
+    std::vector<const auSample *>          zone_map; // key * 128 + velocity
+    auBufferPool                           ring_pool; // a ring per voice
+    std::unique_ptr<Voice[]>               voices;
+    uint64_t                               note_count = 0;
+
+    auMpscQueue<Request>  requests;
+    auMpscQueue<uint32_t> notes { 256 }; // packed midi, control side
+
+    std::vector<Stream> streams; // streamer thread only
+    std::thread         streamer;
+    std::atomic<bool>   running = false;
+
+    std::atomic<uint64_t> underruns       = 0; // voices that ran dry
+    std::atomic<uint64_t> underrun_frames = 0;
+    std::atomic<uint64_t> dropped         = 0; // requests that did not fit
+
+    bool fill (unsigned int voice, Stream &stream, std::vector<char> &raw,
+               std::vector<float> &converted);
+    void stream_loop ();
+
+    void note_on (uint8_t note, uint8_t velocity);
+    void note_off (uint8_t note);
+    void render_voice (Voice &voice, float *const *outputs, float *chunk,
+                       size_t frames);
+
+public:
+    auSamplerNode (unsigned int sample_rate, unsigned int channels = 2,
+                   auSamplerParams params = auSamplerParams ());
+    ~auSamplerNode () override;
+
+    auSamplerNode (const auSamplerNode &)            = delete;
+    auSamplerNode &operator= (const auSamplerNode &) = delete;
+
+    // reads every zone's header and head, a worker per core. only before
+    // the node is running, returns how many zones loaded
+    size_t load (const std::vector<auSampleZone> &zones);
+
+    // bytes held in memory for the heads
+    size_t get_head_bytes () const;
+
+    // any thread, note-on with velocity 0 is a note-off
+    bool note (uint8_t key, uint8_t velocity);
+
+    inline uint64_t get_underruns () const { return underruns.load (); }
+
+    inline uint64_t get_underrun_frames () const {
+        return underrun_frames.load ();
+    }
+
+    unsigned int get_input_count () const override { return 0; }
+    unsigned int get_output_count () const override { return channels; }
+
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
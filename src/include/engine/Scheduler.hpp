@@ -0,0 +1,76 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "io/OutputEngine.hpp"
+#include "util/WorkDeque.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct alignas (64) auWorkerStats {
+    std::atomic<uint64_t> steps   = 0;
+    std::atomic<uint64_t> busy_ns = 0;
+    std::atomic<float>    load    = 0; // smoothed share of the period
+
+    uint64_t block_busy_ns = 0; // owned by the worker during a block
+};
+
+// runs the independent steps of a compiled graph on a pool of real-time
+// workers. the calling audio thread works along and only returns once every
+// step is done and every worker left the block
+class auGraphScheduler {
+    std::vector<std::thread>                  threads;
+    std::vector<std::unique_ptr<auWorkDeque>> deques; // 0 is the caller's
+    std::vector<std::unique_ptr<auArena>>     scratch; // per worker too
+    std::unique_ptr<auWorkerStats[]>          stats;
+    size_t                                    capacity;
+
+    std::atomic<bool>     running = false;
+    std::atomic<uint64_t> epoch   = 0;
+    std::atomic<unsigned> active  = 0;
+
+    // the block being run, written by the caller before the epoch moves
+    auCompiledGraph    *graph  = nullptr;
+    size_t              frames = 0;
+    std::atomic<size_t> done   = 0;
+
+    std::atomic<uint64_t> blocks      = 0;
+    std::atomic<uint64_t> late_blocks = 0;
+    std::atomic<uint64_t> fallbacks   = 0;
+
+    void execute (unsigned int worker, uint32_t step);
+    void work (unsigned int worker);
+    void worker_loop (unsigned int worker);
+
+public:
+    // `workers` threads besides the caller, pinned from params.cpu upward
+    // when it is set. graphs of more than `max_steps` steps run serially
+    auGraphScheduler (unsigned int workers, size_t max_steps = 4096,
+                      auEngineParams params = auEngineParams ());
+    ~auGraphScheduler ();
+
+    auGraphScheduler (const auGraphScheduler &)            = delete;
+    auGraphScheduler &operator= (const auGraphScheduler &) = delete;
+
+    // real-time side. `deadline_ns` is the time the block may take, usually
+    // the period, 0 skips deadline accounting
+    void run (auCompiledGraph &graph, size_t frames, uint64_t deadline_ns = 0);
+
+    // includes the caller as worker 0
+    inline unsigned int get_worker_count () const {
+        return unsigned (deques.size ());
+    }
+
+    inline const auWorkerStats &get_worker_stats (unsigned int worker) const {
+        return stats[worker];
+    }
+
+    inline uint64_t get_blocks () const { return blocks.load (); }
+
+    // blocks that took longer than their deadline
+    inline uint64_t get_late_blocks () const { return late_blocks.load (); }
+
+    // blocks run serially because the graph outgrew the deques
+    inline uint64_t get_fallbacks () const { return fallbacks.load (); }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Midi.hpp"
+#include "engine/Graph.hpp"
+#include "engine/Messages.hpp"
+#include "io/Drift.hpp"
+#include "util/MpscQueue.hpp"
+#include "util/Simd.hpp"
+#include <atomic>
+
+#define AU_SYNTH_MAX_VOICES 256
+#define AU_SYNTH_LANES      AU_VEC_WIDTH
+#define AU_SYNTH_GROUPS     (AU_SYNTH_MAX_VOICES / AU_SYNTH_LANES)
+
+// events taken from the MIDI input and the queue per block
+#define AU_SYNTH_MAX_EVENTS 256
+
+struct auSynthParams {
+    float attack  = 0.005f; // seconds
+    float decay   = 0.2f;
+    float sustain = 0.7f; // level
+    float release = 0.3f;
+
+    float cutoff    = 6000.f; // Hz at middle c
+    float resonance = 0.2f;   // 0 to 1
+    float key_track = 0.5f;   // octaves of cutoff per octave of pitch
+
+    float gain = 0.2f; // per voice at full velocity
+};
+
+// voice state as structure of arrays, lane i of group g is voice
+// g * AU_SYNTH_LANES + i
+struct alignas (AU_RT_ALIGN) auSynthVoices {
+    float phase[AU_SYNTH_MAX_VOICES];
+    float inc[AU_SYNTH_MAX_VOICES]; // cycles per frame
+    float inv_inc[AU_SYNTH_MAX_VOICES];
+    float amp[AU_SYNTH_MAX_VOICES];
+
+    // one pole envelope chasing target
+    float level[AU_SYNTH_MAX_VOICES];
+    float target[AU_SYNTH_MAX_VOICES];
+    float coef[AU_SYNTH_MAX_VOICES];
+
+    // trapezoidal state variable lowpass
+    float a1[AU_SYNTH_MAX_VOICES];
+    float a2[AU_SYNTH_MAX_VOICES];
+    float a3[AU_SYNTH_MAX_VOICES];
+    float ic1[AU_SYNTH_MAX_VOICES];
+    float ic2[AU_SYNTH_MAX_VOICES];
+};
+
+// polyphonic subtractive synth, a polyblep saw through an envelope and a
+// resonant lowpass per voice. voices are rendered a lane group at a time,
+// groups with no sounding voice cost nothing
+class auSynthNode : public auNode {
+    enum Stage : uint8_t { Idle, Attack, Decay, Sustain, Release };
+
+    unsigned int channels;
+    float        sample_rate = 48000.f;
+
+    std::atomic<miInput *>            input = nullptr;
+    std::atomic<const auAudioClock *> clock = nullptr;
+    auMpscQueue<miEvent>              events { AU_SYNTH_MAX_EVENTS };
+    auMpscQueue<auSynthParams>        param_changes { 4 };
+
+    // real-time side only, everything preallocated
+    auSynthParams params;
+    auSynthVoices voices;
+    Stage         stage[AU_SYNTH_MAX_VOICES];
+    uint8_t       voice_channel[AU_SYNTH_MAX_VOICES];
+    uint8_t       voice_note[AU_SYNTH_MAX_VOICES];
+    uint32_t      group_mask[AU_SYNTH_GROUPS]; // sounding lanes
+
+    // free voices as a stack, the others in two lists oldest first so
+    // stealing is O(1): released voices go before held ones
+    int16_t free_stack[AU_SYNTH_MAX_VOICES];
+    int     free_count = 0;
+    int16_t prev[AU_SYNTH_MAX_VOICES];
+    int16_t next[AU_SYNTH_MAX_VOICES];
+    int16_t held_head = -1, held_tail = -1;
+    int16_t released_head = -1, released_tail = -1;
+    int16_t note_voice[16][128]; // the voice holding a key, -1 if none
+
+    uint64_t clock_base   = 0; // the clock's last block time
+    uint64_t clock_frames = 0; // rendered since, blocks may be split
+
+    miBlockEvent block_events[AU_SYNTH_MAX_EVENTS];
+
+    std::atomic<uint32_t> active_voices = 0;
+    std::atomic<uint64_t> stolen        = 0;
+
+    void unlink (int16_t v);
+    void append (int16_t v, bool released);
+    void free_voice (int16_t v);
+    void release_voice (int16_t v);
+
+    void note_on (uint8_t channel, uint8_t note, uint8_t velocity);
+    void note_off (uint8_t channel, uint8_t note);
+    void all_notes_off ();
+    void handle (const uint8_t *data, uint8_t size);
+
+    void render (auVec8 *mix, float *out, size_t frames);
+    void advance_envelopes ();
+    uint64_t block_time (size_t frames);
+
+public:
+    explicit auSynthNode (unsigned int channels = 2);
+
+    // the input is drained by process, it has to outlive the node
+    inline void set_input (miInput *in) { input.store (in); }
+
+    // where input events are timed against, e.g. the clock of the stream
+    // rendering the node. it has to outlive the node, without one they are
+    // timed by the wakeup of each block
+    inline void set_clock (const auAudioClock *c) { clock.store (c); }
+
+    // any thread, played at the start of the next block
+    bool send (const uint8_t *data, uint8_t size);
+
+    // any thread, applies to notes started afterwards
+    inline bool set_params (const auSynthParams &p) {
+        return param_changes.push (p);
+    }
+
+    inline uint32_t get_active_voices () const {
+        return active_voices.load ();
+    }
+
+    // voices taken from a sounding note because the pool ran out
+    inline uint64_t get_stolen () const { return stolen.load (); }
+
+    unsigned int get_input_count () const override { return 0; }
+    unsigned int get_output_count () const override { return channels; }
+
+    void prepare (unsigned int sample_rate, size_t max_frames) override;
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "file/ConvCache.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// clips sounding at once per timeline node, more are dropped with a warning
+#define AU_TIMELINE_MAX_ACTIVE 256
+
+// default spacing of the per-block event index
+#define AU_TIMELINE_BLOCK 1024
+
+struct auEnvelopePoint {
+    uint64_t frame; // relative to the clip's start on the timeline
+    float    gain;
+};
+
+// a slice of a converted source placed on a track, all in frames
+struct auTimelineClip {
+    auPlanarClipRef source; // nullptr once removed
+    unsigned int    track  = 0;
+    uint64_t        start  = 0; // on the timeline
+    uint64_t        offset = 0; // into the source
+    uint64_t        length = 0;
+
+    float    gain     = 1.f;
+    uint64_t fade_in  = 0; // linear
+    uint64_t fade_out = 0;
+
+    // linear segments, sorted by frame and held flat past both ends
+    std::vector<auEnvelopePoint> envelope;
+};
+
+struct auTimelineEvent {
+    uint64_t frame;
+    uint32_t clip;  // into auCompiledTimeline::clips
+    uint32_t start; // 0 stops the clip, stops sort first
+};
+
+// the flattened arrangement the timeline node plays, immutable once built
+class auCompiledTimeline {
+    friend class auTimeline;
+    friend class auTimelineNode;
+
+    std::vector<auTimelineClip>  clips; // sorted by start
+    std::vector<uint64_t>        max_end; // running max over clips[0..i]
+    std::vector<auTimelineEvent> events;  // sorted by frame
+
+    // events of index block b start at events[block_offsets[b]]
+    std::vector<uint32_t> block_offsets;
+    size_t                block_frames = AU_TIMELINE_BLOCK;
+
+    std::vector<unsigned int> track_ports; // first output port per track
+    unsigned int              port_count = 0;
+
+    uint64_t length     = 0;
+    size_t   max_active = 0;
+
+    // first event at or after `frame`
+    size_t find_event (uint64_t frame) const;
+
+    void prefetch (uint64_t from, uint64_t to) const;
+
+public:
+    inline uint64_t get_length () const { return length; }
+
+    inline size_t get_clip_count () const { return clips.size (); }
+
+    // the most clips sounding at the same time
+    inline size_t get_max_active () const { return max_active; }
+
+    inline unsigned int get_track_port (unsigned int track) const {
+        return track_ports[track];
+    }
+};
+
+typedef std::shared_ptr<const auCompiledTimeline> auCompiledTimelineRef;
+
+// the editable arrangement, lives on the control thread
+class auTimeline {
+    std::vector<unsigned int>   tracks; // channels per track
+    std::vector<auTimelineClip> clips;  // removed clips have no source
+
+public:
+    // returns the track's id
+    unsigned int add_track (unsigned int channels);
+
+    inline size_t get_track_count () const { return tracks.size (); }
+
+    // returns the clip's id or SIZE_MAX if it does not fit its source
+    size_t add_clip (auTimelineClip clip);
+    void   remove_clip (size_t id);
+    bool   move_clip (size_t id, uint64_t start);
+
+    inline const auTimelineClip *get_clip (size_t id) const {
+        return id < clips.size () && clips[id].source ? &clips[id] : nullptr;
+    }
+
+    // sorts the clips into one event list indexed every `block_frames`
+    auCompiledTimelineRef compile (unsigned int sample_rate,
+                                   size_t block_frames
+                                   = AU_TIMELINE_BLOCK) const;
+};
+
+// plays a compiled timeline, track t's channel c comes out of port
+// get_track_port (t) + c. a block only costs as much as the clips sounding
+// in it
+class auTimelineNode : public auNode {
+    struct Voice {
+        const auTimelineClip *clip;
+        uint32_t              index;    // into the compiled clips
+        size_t                envelope; // current envelope segment
+    };
+
+    unsigned int port_count;
+
+    // control side
+    std::mutex                         timelines_mutex;
+    std::vector<auCompiledTimelineRef> timelines;
+
+    std::atomic<const auCompiledTimeline *> pending = nullptr;
+    std::atomic<const auCompiledTimeline *> in_use  = nullptr;
+
+    std::atomic<uint64_t> position = 0;
+    std::atomic<uint64_t> seek_to  = UINT64_MAX;
+    std::atomic<bool>     playing  = false;
+    std::atomic<uint64_t> dropped  = 0;
+
+    // faults the clips of the next index block in ahead of the real-time
+    // side, the planes are mapped and would otherwise page fault there
+    std::thread       prefetcher;
+    std::atomic<bool> running = false;
+
+    // real-time side only
+    const auCompiledTimeline *current = nullptr;
+    Voice                     voices[AU_TIMELINE_MAX_ACTIVE];
+    size_t                    voice_count = 0;
+    size_t                    next_event  = 0;
+
+    void locate (uint64_t frame);
+    void start_voice (uint32_t index);
+    void stop_voice (uint32_t index);
+    void render (float *const *outputs, size_t offset, uint64_t frame,
+                 size_t frames);
+    void prefetch_loop ();
+
+public:
+    // the port layout is fixed, timelines swapped in later must match it
+    explicit auTimelineNode (auCompiledTimelineRef timeline);
+    ~auTimelineNode () override;
+
+    auTimelineNode (const auTimelineNode &)            = delete;
+    auTimelineNode &operator= (const auTimelineNode &) = delete;
+
+    // control side, takes effect at the next block
+    bool set_timeline (auCompiledTimelineRef timeline);
+
+    // control side, drops timelines the real-time thread no longer plays
+    void collect ();
+
+    inline void play () { playing.store (true); }
+    inline void pause () { playing.store (false); }
+    inline void seek (uint64_t frame) { seek_to.store (frame); }
+
+    inline uint64_t get_position () const { return position.load (); }
+
+    // clip starts skipped because AU_TIMELINE_MAX_ACTIVE were sounding
+    inline uint64_t get_dropped () const { return dropped.load (); }
+
+    unsigned int get_input_count () const override { return 0; }
+    unsigned int get_output_count () const override { return port_count; }
+
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
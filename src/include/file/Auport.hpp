@@ -16,6 +16,8 @@ class auFileReader {
     auSFormat             s_format;
     uint32_t              duration;
     uint32_t              buf_size;
+    std::streamoff        data_offset = 0;
+    uint32_t              frame_size  = 0;
 
 public:
     auFileReader (std::filesystem::path path, AudioFileFormat format);
@@ -26,6 +28,19 @@ public:
     uint32_t  get_buf_size ();
     auSFormat get_s_format ();
     bool      read_chunk (char *buffer, size_t size);
+
+    inline uint64_t get_frames () const {
+        return frame_size ? buf_size / frame_size : 0;
+    }
+
+    // bytes read_frames stores per frame, the file's block align
+    inline uint32_t get_frame_size () const { return frame_size; }
+
+    // positions the next read at `frame`, false past the end
+    bool seek_frame (uint64_t frame);
+
+    // returns how many whole frames were read, 0 at the end
+    size_t read_frames (char *buffer, size_t frames);
 };
 
 class auFileWriter {
@@ -41,5 +56,5 @@ public:
     ~auFileWriter ();
 
     bool get_error ();
-    bool write_chunk (char *buffer, size_t size);
+    bool write_chunk (const char *buffer, size_t size);
 };
\ No newline at end of file
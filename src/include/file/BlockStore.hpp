@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// frames per block, edits never copy more than one block per boundary
+#define AU_BLOCK_FRAMES 4096
+
+// planar float audio that never changes once it was created
+struct auAudioBlock {
+    uint32_t           channels;
+    uint32_t           frames;
+    std::vector<float> data; // channel c starts at c * frames
+
+    inline const float *get_plane (uint32_t channel) const {
+        return data.data () + size_t (channel) * frames;
+    }
+};
+
+typedef std::shared_ptr<const auAudioBlock> auBlockPtr;
+
+// hands out blocks and keeps count of the audio alive across all edits
+class auBlockStore {
+    std::atomic<uint64_t> blocks = 0;
+    std::atomic<uint64_t> bytes  = 0;
+
+public:
+    // process-wide instance
+    static auBlockStore &get ();
+
+    // copies `frames` frames, at most AU_BLOCK_FRAMES, out of `planes`
+    auBlockPtr create (const float *const *planes, uint32_t channels,
+                       uint32_t frames);
+
+    inline uint64_t get_block_count () const { return blocks.load (); }
+
+    inline uint64_t get_bytes () const { return bytes.load (); }
+};
+
+// a window into a block. gain and direction are applied when reading, so
+// neither costs a copy
+struct auBlockRef {
+    auBlockPtr block;
+    uint32_t   offset   = 0;
+    uint32_t   length   = 0;
+    float      gain     = 1.f;
+    bool       reversed = false;
+};
+
+// a clip as an ordered list of block windows. copying one is cheap, the
+// audio is shared, edits only touch the references around them
+class auBlockList {
+    friend class auEditHistory;
+
+    uint32_t                channels = 0;
+    std::vector<auBlockRef> refs;
+
+    // index of the ref starting at `frame`, splitting one if needed
+    size_t split (uint64_t frame);
+
+    // the refs covering [start, end)
+    std::pair<size_t, size_t> range (uint64_t start, uint64_t end);
+
+public:
+    auBlockList () = default;
+    explicit auBlockList (uint32_t channels) : channels (channels) {}
+
+    // chops planar audio into fresh blocks
+    static auBlockList import (const float *const *planes, uint32_t channels,
+                               uint64_t frames);
+
+    inline uint32_t get_channels () const { return channels; }
+
+    inline size_t get_ref_count () const { return refs.size (); }
+
+    // what the list itself costs, the blocks are shared
+    inline size_t get_ref_bytes () const {
+        return refs.size () * sizeof (auBlockRef);
+    }
+
+    uint64_t get_frames () const;
+
+    // renders [frame, frame + frames) into `planes`, silence past the end
+    void read (uint64_t frame, uint64_t frames, float *const *planes) const;
+
+    // edits, ranges are clamped to the list
+    auBlockList copy (uint64_t start, uint64_t end) const;
+    auBlockList cut (uint64_t start, uint64_t end);
+    bool        splice (uint64_t at, const auBlockList &other);
+    void        apply_gain (uint64_t start, uint64_t end, float gain);
+    void        reverse (uint64_t start, uint64_t end);
+
+    // overwrites audio in place, only the blocks written to are copied
+    void write (uint64_t frame, uint64_t frames, const float *const *planes);
+};
+
+// undo as a list of diffs. a step keeps the references an edit replaced
+// and their replacement, the rest of the list is shared with its neighbours
+// so a step costs only the references around the edit
+class auEditHistory {
+    struct Step {
+        size_t                  first; // where the replaced refs started
+        std::vector<auBlockRef> before, after;
+        uint32_t                before_channels, after_channels;
+    };
+
+    auBlockList       state;
+    std::vector<Step> steps;
+    size_t            applied = 0; // steps[0..applied) are in state
+    size_t            limit;
+
+    void replace (const Step &step, bool forward);
+
+public:
+    explicit auEditHistory (auBlockList initial, size_t limit = 256);
+
+    inline const auBlockList &get_current () const { return state; }
+
+    // drops the redo branch
+    void commit (auBlockList state);
+
+    bool undo ();
+    bool redo ();
+
+    inline bool can_undo () const { return applied > 0; }
+    inline bool can_redo () const { return applied < steps.size (); }
+
+    // bytes of references held by the current list and every step
+    size_t get_ref_bytes () const;
+};
\ No newline at end of file
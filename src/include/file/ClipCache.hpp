@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Audio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <file/Auport.hpp>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// decoded and converted audio, never modified once it left the cache
+struct auClipBlock {
+    auSFormat         s_format;
+    std::vector<char> data;
+
+    auClipBlock (auSFormat s_format) : s_format (s_format) {}
+
+    inline size_t get_size () const { return data.size (); }
+};
+
+typedef std::shared_ptr<const auClipBlock> auClipRef;
+
+struct auClipKey {
+    std::string path;
+    int64_t     mtime;
+    auSFormat   s_format;
+
+    inline bool operator== (const auClipKey &other) const {
+        return mtime == other.mtime && s_format == other.s_format
+               && path == other.path;
+    }
+};
+
+struct auClipKeyHash {
+    size_t operator() (const auClipKey &key) const;
+};
+
+class auClipCache {
+    struct auClipSlot {
+        auClipKey key;
+        auClipRef clip;
+        bool      referenced;
+    };
+
+    std::mutex mutex;
+
+    // CLOCK ring, the index maps a key to its slot
+    std::vector<auClipSlot>                              slots;
+    std::vector<size_t>                                  free_slots;
+    std::unordered_map<auClipKey, size_t, auClipKeyHash> index;
+    size_t                                               hand = 0;
+
+    // written under the mutex, atomic so the getters can skip it
+    std::atomic<size_t> budget;
+    std::atomic<size_t> used = 0;
+
+    std::atomic<uint64_t> hits      = 0;
+    std::atomic<uint64_t> misses    = 0;
+    std::atomic<uint64_t> evictions = 0;
+
+    bool evict_one ();
+    void insert (const auClipKey &key, auClipRef clip);
+
+public:
+    auClipCache (size_t budget) : budget (budget) {}
+
+    // process-wide instance, 512MiB budget unless changed
+    static auClipCache &get ();
+
+    // returns nullptr if the file could not be read or converted
+    auClipRef load (std::filesystem::path path, AudioFileFormat format,
+                    auSFormat target);
+
+    void set_budget (size_t bytes);
+    void clear ();
+
+    inline size_t get_budget () const { return budget.load (); }
+
+    inline size_t get_used () const { return used.load (); }
+
+    inline uint64_t get_hits () const { return hits.load (); }
+
+    inline uint64_t get_misses () const { return misses.load (); }
+
+    inline uint64_t get_evictions () const { return evictions.load (); }
+};
\ No newline at end of file
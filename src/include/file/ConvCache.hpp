@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Audio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <file/Auport.hpp>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// on-disk entry layout: one 64 byte header followed by the planes, each plane
+// padded to a multiple of 64 bytes
+struct auConvCacheHeader {
+    char     magic[4]; // "BCCF"
+    uint32_t version;
+    uint64_t hash;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint64_t frames;
+    uint8_t  reserved[32];
+};
+
+static_assert (sizeof (auConvCacheHeader) == 64);
+
+// a converted source mapped straight from the cache directory
+class auPlanarClip {
+    void  *map      = nullptr;
+    size_t map_size = 0;
+
+    uint32_t sample_rate = 0;
+    uint32_t channels    = 0;
+    uint64_t frames      = 0;
+    size_t   stride      = 0; // floats between planes
+
+public:
+    auPlanarClip (void *map, size_t map_size);
+    ~auPlanarClip ();
+
+    auPlanarClip (const auPlanarClip &)            = delete;
+    auPlanarClip &operator= (const auPlanarClip &) = delete;
+
+    inline uint32_t get_sample_rate () const { return sample_rate; }
+
+    inline uint32_t get_channels () const { return channels; }
+
+    inline uint64_t get_frames () const { return frames; }
+
+    const float *get_plane (uint32_t channel) const;
+
+    // faults frames [first, first + count) of every plane in, so a
+    // real-time reader of them does not wait on the disk
+    void prefetch (uint64_t first, uint64_t count) const;
+};
+
+typedef std::shared_ptr<const auPlanarClip> auPlanarClipRef;
+
+struct auConvIndexEntry {
+    uint64_t hash;
+    uint64_t size;
+    int64_t  mtime;
+};
+
+class auConvCache {
+    std::filesystem::path dir;
+
+    std::mutex mutex;
+
+    // source path -> content hash, so unchanged sources are never re-hashed
+    std::unordered_map<std::string, auConvIndexEntry> index;
+
+    std::atomic<uint64_t> hits   = 0;
+    std::atomic<uint64_t> misses = 0;
+
+    void     load_index ();
+    void     append_index (const std::string &path, auConvIndexEntry entry);
+    bool     get_hash (const std::filesystem::path &path, uint64_t *hash);
+    bool     write_entry (const std::filesystem::path &entry_path,
+                          std::filesystem::path source, AudioFileFormat format,
+                          auSFormat target, uint64_t hash);
+    std::filesystem::path get_entry_path (uint64_t hash, auSFormat target);
+
+public:
+    // the cache lives in "<project_dir>/.bouillabaisse-cache"
+    auConvCache (std::filesystem::path project_dir);
+
+    // target must be 32 bit float, returns nullptr on failure
+    auPlanarClipRef load (std::filesystem::path source, AudioFileFormat format,
+                          auSFormat target);
+
+    inline uint64_t get_hits () const { return hits.load (); }
+
+    inline uint64_t get_misses () const { return misses.load (); }
+};
\ No newline at end of file
@@ -1,11 +1,112 @@
 #pragma once
 
 #include "Audio.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <alsa/asoundlib.h>
 
+snd_pcm_format_t sformat_to_pcm_format (auSFormat s_format);
+
+#define AU_MAX_CHANNELS 64
+
+enum auAccessMode {
+    // snd_pcm_writei/readi, one copy into the kernel ring per period
+    auAccessRw              = 0,
+    // render straight into the device's DMA area
+    auAccessMmapInterleaved = 1,
+    auAccessMmapPlanar      = 2
+};
+
+// what the caller asks ALSA for, zeroes leave the choice to the defaults
+struct auStreamParams {
+    snd_pcm_uframes_t period_size     = 256;
+    unsigned int      period_count    = 2;
+    snd_pcm_uframes_t start_threshold = 0; // 0 = full buffer(playback)
+    snd_pcm_uframes_t avail_min       = 0; // 0 = one period
+    bool              soft_resample   = true;
+    // mmap modes fall back to the other mmap layout, then to rw
+    auAccessMode      access          = auAccessRw;
+};
+
+// what ALSA actually granted
+struct auStreamConfig {
+    unsigned int      sample_rate     = 0;
+    unsigned int      channels        = 0;
+    snd_pcm_format_t  format          = SND_PCM_FORMAT_UNKNOWN;
+    snd_pcm_uframes_t period_size     = 0;
+    unsigned int      period_count    = 0;
+    snd_pcm_uframes_t buffer_size     = 0;
+    snd_pcm_uframes_t start_threshold = 0;
+    snd_pcm_uframes_t avail_min       = 0;
+    uint32_t          latency_us      = 0; // one full buffer
+    auAccessMode      access          = auAccessRw;
+};
+
+// one mmap transfer window, pointers already point at the first frame
+struct auMmapWindow {
+    snd_pcm_uframes_t offset = 0;
+    snd_pcm_uframes_t frames = 0;
+    // set only when the channels are interleaved in one block
+    void             *interleaved = nullptr;
+    void             *channels[AU_MAX_CHANNELS];
+    size_t            step = 0; // bytes between two samples of a channel
+};
+
+// works for playback and capture streams opened with an mmap access mode,
+// may grant fewer frames than asked for
+int au_mmap_begin (snd_pcm_t *handle, const auStreamConfig &config,
+                   snd_pcm_uframes_t frames, auMmapWindow *window);
+int au_mmap_commit (snd_pcm_t *handle, const auMmapWindow &window);
+
+// stream health, written by whoever drives the stream and readable from any
+// thread without locking
+struct auStreamStats {
+    std::atomic<uint64_t> periods         = 0;
+    std::atomic<uint64_t> xruns           = 0;
+    std::atomic<uint64_t> short_transfers = 0; // short writes or reads
+    std::atomic<uint64_t> late_periods    = 0; // callback overran a period
+    std::atomic<uint64_t> max_callback_ns = 0; // high-water mark
+
+    void record_callback (uint64_t ns, uint64_t period_ns);
+    void reset ();
+};
+
+// recovers from xruns and suspends, playback streams are pre-filled with
+// silence so they restart with a full buffer. `silence` has to hold one
+// period. Safe to call from a real-time thread.
+int au_pcm_recover (snd_pcm_t *handle, int err, snd_pcm_stream_t stream,
+                    const auStreamConfig &config, auStreamStats *stats,
+                    const char *silence);
+
+// queues `frames` of silence on a playback stream
+int au_pcm_prefill (snd_pcm_t *handle, snd_pcm_uframes_t frames,
+                    const auStreamConfig &config, const char *silence);
+
+// what a device can do natively, probed once and shared between copies
+struct auDeviceCaps {
+    bool probed = false;
+
+    std::vector<snd_pcm_format_t> formats;
+    std::vector<unsigned int>     rates; // the common rates it accepts
+    unsigned int                  rate_min         = 0;
+    unsigned int                  rate_max         = 0;
+    unsigned int                  channels_min     = 0;
+    unsigned int                  channels_max     = 0;
+    snd_pcm_uframes_t             period_min       = 0;
+    snd_pcm_uframes_t             period_max       = 0;
+    unsigned int                  periods_min      = 0;
+    unsigned int                  periods_max      = 0;
+    bool                          mmap_interleaved = false;
+    bool                          mmap_planar      = false;
+
+    bool supports (auSFormat s_format) const;
+};
+
 class auDevice {
 protected:
     int card_number;
@@ -25,6 +126,14 @@ protected:
     std::string device_name;
     std::string dev_string;
 
+    std::shared_ptr<std::mutex> caps_mutex = std::make_shared<std::mutex> ();
+    std::shared_ptr<auDeviceCaps> caps
+        = std::make_shared<auDeviceCaps> ();
+
+    const auDeviceCaps &probe_caps (snd_pcm_stream_t stream);
+    auSFormat           choose_format (snd_pcm_stream_t stream,
+                                       auSFormat        source);
+
 public:
     auDevice (int card_num, int dev_num, std::string card_n,
               std::string device_n, std::string dev_str, int shared_card,
@@ -75,11 +184,70 @@ class auInputDevice : public auDevice {
 public:
     using auDevice::auDevice;
 
+    snd_pcm_t *handle = nullptr;
+
+    auStreamConfig config;
+
+    // shared between copies of the device, like the stream itself
+    std::shared_ptr<auStreamStats> stats = std::make_shared<auStreamStats> ();
+
     int open_stream (snd_pcm_t **handle, auSFormat s_format,
-                     size_t latency = 500000);
+                     auStreamParams params = auStreamParams ());
+
+    inline const auStreamConfig &get_stream_config () const { return config; }
+
+    inline const auStreamStats &get_stream_stats () const { return *stats; }
+
+    // blocks until `num_frames` interleaved frames were captured
+    int read_chunk (void *data, size_t num_frames);
+
+    inline const auDeviceCaps &get_caps () {
+        return probe_caps (SND_PCM_STREAM_CAPTURE);
+    }
+
+    // the supported format closest to `source`, so recordings need at most
+    // one conversion
+    inline auSFormat choose_format (auSFormat source) {
+        return auDevice::choose_format (SND_PCM_STREAM_CAPTURE, source);
+    }
+
+    // opens the stream in choose_format (source), which is stored in `native`
+    inline int open_native_stream (snd_pcm_t **handle, auSFormat source,
+                                   auSFormat     *native,
+                                   auStreamParams params = auStreamParams ()) {
+        *native = choose_format (source);
+        return open_stream (handle, *native, params);
+    }
 };
 
-class auOutputDevice : public auDevice {
+// anything playback can be sent to, real hardware or a stand-in
+class auOutputSink {
+public:
+    virtual ~auOutputSink () = default;
+
+    auStreamConfig config;
+
+    // shared between copies of the sink, like the stream itself
+    std::shared_ptr<auStreamStats> stats = std::make_shared<auStreamStats> ();
+
+    virtual int open (auSFormat      s_format,
+                      auStreamParams params = auStreamParams ())
+        = 0;
+
+    // blocks until all `num_frames` interleaved frames were taken
+    virtual int  write (const void *data, size_t num_frames) = 0;
+    virtual void close ()                                    = 0;
+
+    virtual std::string get_sink_name () const = 0;
+
+    inline bool is_open () const { return config.sample_rate != 0; }
+
+    inline const auStreamConfig &get_stream_config () const { return config; }
+
+    inline const auStreamStats &get_stream_stats () const { return *stats; }
+};
+
+class auOutputDevice : public auDevice, public auOutputSink {
 public:
     using auDevice::auDevice;
 
@@ -87,14 +255,82 @@ public:
 
     unsigned int sample_rate = 48000;
 
+    // one period of silence in the stream's format, used for xrun recovery
+    std::vector<char> silence;
+
     int open_stream (snd_pcm_t **handle, auSFormat s_format,
-                     size_t latency = 500000);
+                     auStreamParams params = auStreamParams ());
 
     int play_chunk (const void *data, size_t num_frames);
+
+    int open (auSFormat      s_format,
+              auStreamParams params = auStreamParams ()) override;
+
+    inline int write (const void *data, size_t num_frames) override {
+        return play_chunk (data, num_frames);
+    }
+
+    void close () override;
+
+    inline std::string get_sink_name () const override {
+        return dev_string;
+    }
+
+    inline const auDeviceCaps &get_caps () {
+        return probe_caps (SND_PCM_STREAM_PLAYBACK);
+    }
+
+    // the cheapest supported format for `source`, `source` itself when the
+    // device takes it as is
+    inline auSFormat choose_format (auSFormat source) {
+        return auDevice::choose_format (SND_PCM_STREAM_PLAYBACK, source);
+    }
+
+    // opens the stream in choose_format (source), which is stored in `native`
+    inline int open_native_stream (snd_pcm_t **handle, auSFormat source,
+                                   auSFormat     *native,
+                                   auStreamParams params = auStreamParams ()) {
+        *native = choose_format (source);
+        return open_stream (handle, *native, params);
+    }
 };
 
+// device lists are scanned once and cached, the watcher thread rescans only
+// when cards come, go or drop control elements
 class auDeviceManager {
+    std::mutex                  mutex;
+    std::vector<auInputDevice>  input_devices;
+    std::vector<auOutputDevice> output_devices;
+    bool                        scanned    = false;
+    std::atomic<uint64_t>       generation = 0;
+
+    std::thread watcher;
+    int         wake_fd = -1;
+
+    void scan ();
+    void watch ();
+
 public:
+    auDeviceManager () = default;
+    ~auDeviceManager ();
+
+    auDeviceManager (const auDeviceManager &)            = delete;
+    auDeviceManager &operator= (const auDeviceManager &) = delete;
+
     std::vector<auInputDevice>  get_input_devices ();
     std::vector<auOutputDevice> get_output_devices ();
+
+    // "null" paces itself like hardware, "null:freewheel" runs as fast as
+    // it is fed, "wav:<path>" records to a file, anything else is looked up
+    // as an ALSA device string. returns nullptr when nothing matches
+    std::unique_ptr<auOutputSink> create_sink (const std::string &spec);
+
+    // forces a rescan
+    void refresh ();
+
+    void start_watching ();
+    void stop_watching ();
+
+    // bumped on every rescan, cheap to poll from a UI
+    inline uint64_t get_generation () const { return generation.load (); }
 };
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "io/Alsa.hpp"
+#include <atomic>
+#include <vector>
+
+// measures a device's real sample rate with a second order delay-locked loop
+// over (time, hardware position) pairs, updated from the stream's thread once
+// per period
+class auDriftTracker {
+    double nominal_rate = 0;
+    double period       = 0; // nominal frames between updates
+
+    double b = 0, c = 0; // loop coefficients
+
+    bool     started       = false;
+    uint64_t last_position = 0;
+    double   t_pred        = 0; // filtered time of last_position in ns
+    double   ns_per_frame  = 0;
+
+    std::atomic<double> rate = 0;
+
+public:
+    // `bandwidth` is in Hz, lower settles slower but rejects more jitter
+    void reset (unsigned int nominal_rate, size_t period_frames,
+                double bandwidth = 0.5);
+
+    // `position` counts frames the hardware actually played or captured
+    void update (uint64_t time_ns, uint64_t position);
+
+    // derives the hardware position from snd_pcm_delay and the frames moved
+    // through the stream so far
+    int update (snd_pcm_t *handle, snd_pcm_stream_t stream,
+                uint64_t transferred);
+
+    // stream thread, the filtered time the hardware reaches `position` at.
+    // 0 before the first update
+    uint64_t get_time_ns (uint64_t position) const;
+
+    inline double get_rate () const {
+        return rate.load (std::memory_order_relaxed);
+    }
+
+    inline double get_nominal_rate () const { return nominal_rate; }
+
+    // deviation from the nominal rate in parts per million
+    inline double get_ppm () const {
+        return (get_rate () / nominal_rate - 1.0) * 1e6;
+    }
+};
+
+// the filtered start time of the block being rendered, published by a
+// stream's thread once per period from its drift tracker. block to block it
+// advances by the hardware's period without the thread's wakeup jitter
+class auAudioClock {
+    std::atomic<uint64_t> block_ns = 0;
+
+public:
+    inline void publish (uint64_t ns) {
+        block_ns.store (ns, std::memory_order_release);
+    }
+
+    // any thread, 0 until the stream ran its first period
+    inline uint64_t get_block_ns () const {
+        return block_ns.load (std::memory_order_acquire);
+    }
+};
+
+// variable-ratio resampler for small corrections, 4 point hermite
+// interpolation over interleaved float frames. it sits on the producer side
+// of a ring and consumes every frame it is given
+class auDriftResampler {
+    unsigned int channels;
+
+    std::vector<float> history; // the last 3 input frames
+    size_t             index = 0;
+    double             frac  = 0;
+
+    std::atomic<double> step = 1.0; // input frames per output frame
+
+public:
+    explicit auDriftResampler (unsigned int channels);
+
+    // clamped to [0.5, 2], the ratio only ever moves by a few ppm
+    void set_ratio (double input_per_output);
+
+    inline double get_ratio () const {
+        return step.load (std::memory_order_relaxed);
+    }
+
+    // upper bound of what process can return for `in_frames`
+    inline size_t get_max_output (size_t in_frames) const {
+        return size_t (in_frames / get_ratio ()) + 2;
+    }
+
+    // returns the frames written to `out`, `max_out` should come from
+    // get_max_output. real-time safe
+    size_t process (const float *in, size_t in_frames, float *out,
+                    size_t max_out);
+
+    void reset ();
+};
+
+// keeps a slave stream locked to a master: the tracked rates give the base
+// ratio, the fill of the ring between them steers out what is left
+class auClockLock {
+    auDriftTracker   &input;
+    auDriftTracker   &output;
+    auDriftResampler &resampler;
+
+    double target_fill;
+    double gain;
+
+public:
+    // `target_fill` is the ring level in frames to hold, usually half of it
+    auClockLock (auDriftTracker &input, auDriftTracker &output,
+                 auDriftResampler &resampler, size_t target_fill,
+                 double gain = 0.0005) :
+        input (input), output (output), resampler (resampler),
+        target_fill (double (target_fill)), gain (gain) {}
+
+    // call once per period from the producer with the ring's current level
+    void update (size_t fill_frames);
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "io/Alsa.hpp"
+#include "io/Drift.hpp"
+#include "io/OutputEngine.hpp"
+#include "util/SpscRing.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// called from the real-time thread once per period with the block that was
+// just captured, must not lock, allocate or log
+class auDuplexCallback {
+public:
+    virtual ~auDuplexCallback () = default;
+
+    // both blocks are interleaved in their stream's format
+    virtual void process (const void *in, void *out, size_t frames) = 0;
+};
+
+// capture and playback run from one real-time loop, linked so both start on
+// the same clock when the devices allow it. unlinked devices each keep their
+// own clock, playback paces the loop then and capture is resampled to it
+class auDuplexStream {
+    auInputDevice    &input;
+    auOutputDevice   &output;
+    auDuplexCallback *callback;
+
+    bool linked = false;
+
+    std::thread       thread;
+    std::atomic<bool> running    = false;
+    std::atomic<int>  last_error = 0;
+
+    // measured capture + playback delay, refreshed every period
+    std::atomic<uint32_t> round_trip_frames = 0;
+
+    // each side's real rate, and the block clock taken from the capture
+    // side since a block starts once its input arrived
+    auDriftTracker in_tracker;
+    auDriftTracker out_tracker;
+    auAudioClock   clock;
+    uint64_t       in_transferred  = 0; // real-time side only
+    uint64_t       out_transferred = 0;
+
+    std::vector<char> in_buf;
+    std::vector<char> out_buf;
+    size_t            period_size = 0;
+    uint64_t          period_ns   = 0;
+    auSFormat         in_format { 0, 0, 0, auDtype::eInvalid };
+
+    // unlinked streams only. captured frames go through the resampler into
+    // a ring the callback takes its periods from, the lock holds the ring
+    // at two periods by nudging the ratio
+    std::unique_ptr<auDriftResampler>  resampler;
+    std::unique_ptr<auClockLock>       clock_lock;
+    std::unique_ptr<auSpscRing<float>> ring;
+    std::vector<char>                  capture_buf;
+    std::vector<float>                 capture_float;
+    std::vector<float>                 resampled;
+    std::vector<float>                 period_float;
+    std::atomic<uint64_t>              ring_underruns = 0;
+
+    int  restart ();
+    bool recover (int err);
+    void run ();
+
+    snd_pcm_sframes_t capture_linked (snd_pcm_t *handle, auAccessMode access);
+    snd_pcm_sframes_t capture_resampled (snd_pcm_t   *handle,
+                                         auAccessMode access);
+
+public:
+    auDuplexStream (auInputDevice &input, auOutputDevice &output,
+                    auDuplexCallback *callback) :
+        input (input), output (output), callback (callback) {}
+    ~auDuplexStream ();
+
+    auDuplexStream (const auDuplexStream &)            = delete;
+    auDuplexStream &operator= (const auDuplexStream &) = delete;
+
+    // opens both streams with the same period layout and links them, planar
+    // access is not supported
+    int open (auSFormat in_format, auSFormat out_format,
+              auStreamParams params = auStreamParams ());
+
+    int  start (auEngineParams params = auEngineParams ());
+    void stop ();
+
+    inline bool is_linked () const { return linked; }
+
+    inline bool is_running () const { return running.load (); }
+
+    inline int get_last_error () const { return last_error.load (); }
+
+    // what the negotiated buffers allow: one capture period plus the whole
+    // playback buffer
+    uint32_t get_nominal_round_trip_us () const;
+
+    // what the devices currently report through snd_pcm_delay
+    uint32_t get_round_trip_us () const;
+
+    // the start of the block the callback is rendering, for consumers that
+    // place timestamped events like MIDI input
+    inline const auAudioClock &get_clock () const { return clock; }
+
+    inline double get_input_ppm () const { return in_tracker.get_ppm (); }
+
+    inline double get_output_ppm () const { return out_tracker.get_ppm (); }
+
+    // how far playback runs ahead of capture, stays near 0 on linked
+    // streams and is what the resampler corrects on unlinked ones
+    inline double get_drift_ppm () const {
+        return out_tracker.get_ppm () - in_tracker.get_ppm ();
+    }
+
+    // input frames per output frame the resampler runs at, 1 when linked
+    inline double get_resample_ratio () const {
+        return resampler ? resampler->get_ratio () : 1.0;
+    }
+
+    // periods the callback got less capture than it needed, unlinked only
+    inline uint64_t get_ring_underruns () const {
+        return ring_underruns.load ();
+    }
+};
\ No newline at end of file
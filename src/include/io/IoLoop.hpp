@@ -0,0 +1,71 @@
+#pragma once
+
+#include "io/Alsa.hpp"
+#include "io/OutputEngine.hpp"
+#include <atomic>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+// called from the real-time thread once per captured period, must not lock,
+// allocate or log
+class auCaptureCallback {
+public:
+    virtual ~auCaptureCallback () = default;
+
+    // `in` holds `frames` interleaved frames in the stream's format
+    virtual void process (const void *in, size_t frames) = 0;
+};
+
+struct auIoStream {
+    snd_pcm_t            *handle  = nullptr;
+    snd_pcm_stream_t      stream  = SND_PCM_STREAM_PLAYBACK;
+    const auStreamConfig *config  = nullptr;
+    auStreamStats        *stats   = nullptr;
+    const char           *silence = nullptr; // playback only
+
+    auRenderCallback  *render  = nullptr;
+    auCaptureCallback *capture = nullptr;
+
+    std::vector<char> buf; // one period, unused for mmap streams
+    size_t            fd_offset = 0;
+    unsigned int      fd_count  = 0;
+    uint64_t          period_ns = 0;
+    bool              failed    = false;
+};
+
+// services any number of opened streams from one real-time thread, woken by
+// the streams' poll descriptors
+class auIoLoop {
+    std::vector<auIoStream> streams;
+    std::vector<pollfd>     fds;
+
+    std::thread       thread;
+    std::atomic<bool> running    = false;
+    std::atomic<int>  last_error = 0;
+    int               wake_fd    = -1;
+
+    bool service_playback (auIoStream &s);
+    bool service_capture (auIoStream &s);
+    bool recover (auIoStream &s, int err);
+    void run ();
+
+public:
+    auIoLoop () = default;
+    ~auIoLoop ();
+
+    auIoLoop (const auIoLoop &)            = delete;
+    auIoLoop &operator= (const auIoLoop &) = delete;
+
+    // streams can only be added while the loop is stopped, the devices have
+    // to stay alive until it is destroyed
+    int add_output (auOutputDevice &device, auRenderCallback *callback);
+    int add_input (auInputDevice &device, auCaptureCallback *callback);
+
+    int  start (auEngineParams params = auEngineParams ());
+    void stop ();
+
+    inline bool is_running () const { return running.load (); }
+
+    inline int get_last_error () const { return last_error.load (); }
+};
\ No newline at end of file
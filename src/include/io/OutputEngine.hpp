@@ -0,0 +1,109 @@
+#pragma once
+
+#include "io/Alsa.hpp"
+#include "io/Drift.hpp"
+#include "util/SpscRing.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// called from the real-time thread once per period, must not lock, allocate
+// or log
+class auRenderCallback {
+public:
+    virtual ~auRenderCallback () = default;
+
+    // fill `frames` interleaved frames in the stream's format
+    virtual void process (void *out, size_t frames) = 0;
+
+    // non-interleaved variant used by planar mmap streams, one pointer per
+    // channel
+    virtual void process_planar (void **channels, size_t frames) {}
+
+    virtual bool has_planar () const { return false; }
+};
+
+// render callback fed by a producer thread through a wait-free ring, missing
+// frames are played as silence
+class auRingSource : public auRenderCallback {
+    auSpscRing<char> ring;
+    auSFormat        s_format;
+    size_t           frame_size;
+
+    std::atomic<uint64_t> underflows = 0;
+
+public:
+    auRingSource (auSFormat s_format, size_t capacity_frames);
+
+    // producer side, returns how many whole frames were queued
+    size_t write (const void *data, size_t frames);
+
+    void process (void *out, size_t frames) override;
+
+    inline size_t get_write_available () const {
+        return ring.get_write_available () / frame_size;
+    }
+
+    inline uint64_t get_underflows () const { return underflows.load (); }
+};
+
+struct auEngineParams {
+    int priority = 80; // SCHED_FIFO priority
+    int cpu      = -1; // pin to this cpu, -1 leaves it floating
+};
+
+// applies the scheduling policy and affinity to a freshly started thread
+int au_make_realtime (std::thread &thread, auEngineParams params);
+
+// drives an opened output sink from a dedicated SCHED_FIFO thread, ALSA
+// devices get the xrun-aware rw and mmap loops
+class auOutputEngine {
+    auOutputSink     &sink;
+    auOutputDevice   *device; // null for stand-in sinks
+    auRenderCallback *callback;
+
+    std::thread       thread;
+    std::atomic<bool> running    = false;
+    std::atomic<int>  last_error = 0;
+    auAudioClock      clock; // when each period's callback started
+
+    // real-time thread only, frames handed to the sink so far
+    auDriftTracker tracker;
+    uint64_t       transferred = 0;
+
+    std::vector<char> period_buf;
+    size_t            period_size = 0;
+    size_t            buffer_size = 0;
+    size_t            frame_size  = 0;
+    uint64_t          period_ns   = 0;
+
+    void     reset_clock ();
+    uint64_t block_time (uint64_t woke) const;
+    bool     recover (int err);
+    void run ();
+    void run_rw ();
+    void run_mmap ();
+    void run_sink ();
+
+public:
+    auOutputEngine (auOutputSink &sink, auRenderCallback *callback) :
+        sink (sink), device (dynamic_cast<auOutputDevice *> (&sink)),
+        callback (callback) {}
+    ~auOutputEngine ();
+
+    auOutputEngine (const auOutputEngine &)            = delete;
+    auOutputEngine &operator= (const auOutputEngine &) = delete;
+
+    // the sink has to be opened already
+    int  start (auEngineParams params = auEngineParams ());
+    void stop ();
+
+    inline bool is_running () const { return running.load (); }
+
+    // last unrecoverable error seen by the real-time thread
+    inline int get_last_error () const { return last_error.load (); }
+
+    // the filtered start time of the period being rendered, locked to the
+    // hardware's position so it carries no wakeup jitter
+    inline const auAudioClock &get_clock () const { return clock; }
+};
\ No newline at end of file
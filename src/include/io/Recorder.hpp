@@ -0,0 +1,96 @@
+#pragma once
+
+#include "file/Auport.hpp"
+#include "io/Alsa.hpp"
+#include "io/IoLoop.hpp"
+#include "util/SpscRing.hpp"
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct auRecordParams {
+    uint32_t ring_ms       = 4000; // capture headroom before frames drop
+    uint32_t batch_ms      = 250;  // the writer waits for this much audio
+    uint32_t preallocate_s = 0;    // disk space reserved up front, 0 for none
+};
+
+// one armed input, filled by the capture thread and drained by the writer
+class auRecordTrack : public auCaptureCallback {
+    friend class auRecorder;
+
+    auInputDevice         device;
+    std::filesystem::path path;
+    auSFormat             s_format;
+    size_t                frame_size;
+
+    auSpscRing<char>              ring;
+    std::vector<char>             batch;
+    std::unique_ptr<auFileWriter> writer;
+
+    std::atomic<uint64_t> captured = 0;
+    std::atomic<uint64_t> dropped  = 0;
+    std::atomic<uint64_t> written  = 0;
+
+public:
+    auRecordTrack (const auInputDevice &device, std::filesystem::path path,
+                   auSFormat s_format, auRecordParams params);
+
+    // capture side, never blocks, frames that do not fit are dropped
+    void process (const void *in, size_t frames) override;
+
+    inline const std::filesystem::path &get_path () const { return path; }
+
+    inline uint64_t get_captured_frames () const { return captured.load (); }
+
+    inline uint64_t get_dropped_frames () const { return dropped.load (); }
+
+    inline uint64_t get_written_frames () const { return written.load (); }
+};
+
+// records any number of inputs at once, one real-time capture loop feeds the
+// rings and a plain thread writes them out so the capture side never waits on
+// the disk
+class auRecorder {
+    auRecordParams params;
+
+    std::vector<std::unique_ptr<auRecordTrack>> tracks;
+    std::unique_ptr<auIoLoop>                   loop;
+
+    std::thread       writer;
+    std::atomic<bool> recording  = false;
+    std::atomic<int>  last_error = 0;
+
+    bool drain (auRecordTrack &track, bool flush);
+    void write_loop ();
+
+public:
+    explicit auRecorder (auRecordParams params = auRecordParams ()) :
+        params (params) {}
+    ~auRecorder ();
+
+    auRecorder (const auRecorder &)            = delete;
+    auRecorder &operator= (const auRecorder &) = delete;
+
+    // opens the device's capture stream and reserves its file, only while
+    // stopped. returns the track or nullptr
+    auRecordTrack *arm (const auInputDevice &device, auSFormat s_format,
+                        std::filesystem::path path,
+                        auStreamParams stream_params = auStreamParams ());
+    void           disarm (auRecordTrack *track);
+
+    int  start (auEngineParams engine_params = auEngineParams ());
+    void stop ();
+
+    inline bool is_recording () const { return recording.load (); }
+
+    inline int get_last_error () const { return last_error.load (); }
+
+    inline const std::vector<std::unique_ptr<auRecordTrack>> &
+    get_tracks () const {
+        return tracks;
+    }
+
+    uint64_t get_dropped_frames () const;
+};
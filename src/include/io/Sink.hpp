@@ -0,0 +1,66 @@
+#pragma once
+
+#include "file/Auport.hpp"
+#include "io/Alsa.hpp"
+#include <filesystem>
+#include <memory>
+
+enum auSinkClock {
+    auClockRealtime  = 0, // drains at the sample rate like a sound card
+    auClockFreewheel = 1, // takes frames as fast as they come
+};
+
+// stand-in for a sound card, discards everything but keeps the timing of a
+// real buffer so the engine can run headless
+class auNullSink : public auOutputSink {
+    auSinkClock clock;
+
+    // simulated playback buffer, restarted after an underrun
+    uint64_t start_ns      = 0;
+    uint64_t queued_frames = 0;
+
+    std::atomic<uint64_t> frames_written = 0;
+
+protected:
+    size_t frame_size = 0;
+
+    // blocks like a full hardware buffer would
+    void pace (size_t num_frames);
+
+public:
+    explicit auNullSink (auSinkClock clock = auClockRealtime) :
+        clock (clock) {}
+
+    int open (auSFormat      s_format,
+              auStreamParams params = auStreamParams ()) override;
+    int write (const void *data, size_t num_frames) override;
+    void close () override;
+
+    std::string get_sink_name () const override;
+
+    inline auSinkClock get_clock () const { return clock; }
+
+    inline uint64_t get_frames_written () const {
+        return frames_written.load ();
+    }
+};
+
+// writes everything played into an audio file, freewheeling by default
+class auFileSink : public auNullSink {
+    std::filesystem::path         path;
+    AudioFileFormat               format;
+    std::unique_ptr<auFileWriter> writer;
+
+public:
+    auFileSink (std::filesystem::path path, AudioFileFormat format,
+                auSinkClock clock = auClockFreewheel) :
+        auNullSink (clock), path (std::move (path)), format (format) {}
+    ~auFileSink () override;
+
+    int open (auSFormat      s_format,
+              auStreamParams params = auStreamParams ()) override;
+    int write (const void *data, size_t num_frames) override;
+    void close () override;
+
+    std::string get_sink_name () const override;
+};
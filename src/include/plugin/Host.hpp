@@ -0,0 +1,104 @@
+#pragma once
+
+#include "engine/Graph.hpp"
+#include "plugin/Plugin.h"
+#include "util/MpscQueue.hpp"
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define AU_PLUGIN_MAX_EVENTS   256
+#define AU_PLUGIN_MAX_CHANNELS 64
+
+// one dlopen'ed plugin binary, unloaded once nothing references it
+class auPluginLibrary {
+    void                                   *handle = nullptr;
+    std::filesystem::path                   path;
+    std::vector<const auPluginDescriptor *> descriptors;
+
+    auPluginLibrary () = default;
+
+public:
+    ~auPluginLibrary ();
+
+    auPluginLibrary (const auPluginLibrary &)            = delete;
+    auPluginLibrary &operator= (const auPluginLibrary &) = delete;
+
+    // nullptr when the file is no plugin or speaks another ABI version
+    static std::shared_ptr<auPluginLibrary> open (std::filesystem::path path);
+
+    inline const std::filesystem::path &get_path () const { return path; }
+
+    inline const std::vector<const auPluginDescriptor *> &
+    get_descriptors () const {
+        return descriptors;
+    }
+
+    const auPluginDescriptor *find (const std::string &id) const;
+};
+
+struct auPluginParamChange {
+    uint64_t frame; // in the instance's frame time, 0 for the next block
+    uint32_t param;
+    float    value;
+};
+
+// a plugin instance as a graph node, its planes are handed over in place
+class auPluginNode : public auNode {
+    std::shared_ptr<auPluginLibrary> library; // keeps the code mapped
+    const auPluginDescriptor        *desc;
+    void                            *instance = nullptr;
+    unsigned int                     sample_rate;
+    size_t                           max_frames;
+
+    auMpscQueue<auPluginParamChange> changes;
+
+    // real-time side only
+    auPluginParamChange held[AU_PLUGIN_MAX_EVENTS];
+    size_t              held_count = 0;
+    auPluginEvent       events[AU_PLUGIN_MAX_EVENTS];
+
+    std::atomic<uint64_t> frame_time = 0; // written by the real-time side
+
+    size_t collect_events (size_t frames);
+    void   apply_defaults ();
+
+public:
+    auPluginNode (std::shared_ptr<auPluginLibrary> library,
+                  const auPluginDescriptor *desc, unsigned int sample_rate,
+                  size_t max_frames);
+    ~auPluginNode () override;
+
+    // false when the instance could not be created
+    inline bool is_valid () const { return instance != nullptr; }
+
+    inline const auPluginDescriptor *get_descriptor () const { return desc; }
+
+    // any thread, false when the queue is full
+    bool set_param (uint32_t param, float value, uint64_t frame = 0);
+
+    // the frame the next block starts at, for set_param's `frame`
+    inline uint64_t get_frame_time () const {
+        return frame_time.load (std::memory_order_relaxed);
+    }
+
+    // clears the instance's internal state, e.g. after a transport jump.
+    // only while no graph runs the node
+    void reset ();
+
+    unsigned int get_input_count () const override { return desc->channels; }
+    unsigned int get_output_count () const override {
+        return desc->channels;
+    }
+
+    bool is_in_place () const override { return true; }
+
+    uint32_t get_latency () const override;
+    uint32_t get_tail () const override;
+
+    void prepare (unsigned int sample_rate, size_t max_frames) override;
+    void process (const float *const *inputs, float *const *outputs,
+                  size_t frames) override;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+// the C ABI between bouillabaisse and in-process plugins. a plugin is a
+// shared object exporting AU_PLUGIN_ENTRY, everything crossing the boundary
+// is plain C so plugins can be built with any compiler
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AU_PLUGIN_ABI_VERSION 1
+#define AU_PLUGIN_ENTRY "au_plugin_get_descriptor"
+
+// get_tail result for plugins that never go quiet on their own
+#define AU_PLUGIN_TAIL_INFINITE UINT32_MAX
+
+typedef struct auPluginParamInfo {
+    const char *name;
+    float       min;
+    float       max;
+    float       def;
+} auPluginParamInfo;
+
+// a parameter change landing `offset` frames into the block
+typedef struct auPluginEvent {
+    uint32_t offset;
+    uint32_t param;
+    float    value;
+} auPluginEvent;
+
+typedef struct auPluginBlock {
+    // one plane per channel, processed in place
+    float *const *channels;
+    uint32_t      channel_count;
+    uint32_t      frames;
+
+    // sorted by offset, all offsets are below `frames`
+    const auPluginEvent *events;
+    uint32_t             event_count;
+
+    // frames processed by this instance before this block
+    uint64_t frame_time;
+} auPluginBlock;
+
+typedef struct auPluginDescriptor {
+    uint32_t    abi_version; // AU_PLUGIN_ABI_VERSION
+    const char *id;          // unique and stable, e.g. "org.example.gain"
+    const char *name;
+    const char *vendor;
+
+    uint32_t channels;
+
+    uint32_t                 param_count;
+    const auPluginParamInfo *params;
+
+    // everything but process is called off the real-time thread
+    void *(*create) (uint32_t sample_rate, uint32_t max_frames);
+    void (*destroy) (void *instance);
+    void (*reset) (void *instance); // optional, clears internal state
+
+    // real-time, must not lock, allocate or block
+    void (*process) (void *instance, const auPluginBlock *block);
+
+    // frames, may change after parameter events
+    uint32_t (*get_latency) (void *instance); // optional
+    uint32_t (*get_tail) (void *instance);    // optional
+} auPluginDescriptor;
+
+// returns descriptor `index`, NULL past the last one
+typedef const auPluginDescriptor *(*auPluginEntry) (uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// bounded multi producer single consumer queue after Vyukov, every slot
+// carries a sequence number so producers only race on the head index and the
+// consumer never waits. the capacity is rounded up to a power of two
+template <typename T> class auMpscQueue {
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t                  mask;
+
+    alignas (64) std::atomic<size_t> head = 0; // next slot to write
+    alignas (64) size_t tail              = 0; // consumer only
+
+public:
+    explicit auMpscQueue (size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots = std::make_unique<Slot[]> (size);
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store (i, std::memory_order_relaxed);
+        }
+        mask = size - 1;
+    }
+
+    auMpscQueue (const auMpscQueue &)            = delete;
+    auMpscQueue &operator= (const auMpscQueue &) = delete;
+
+    inline size_t get_capacity () const { return mask + 1; }
+
+    // any thread, false when the queue is full
+    bool push (const T &value) {
+        size_t pos = head.load (std::memory_order_relaxed);
+        while (true) {
+            Slot    &slot = slots[pos & mask];
+            size_t   seq  = slot.sequence.load (std::memory_order_acquire);
+            intptr_t diff = intptr_t (seq) - intptr_t (pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak (pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.sequence.store (pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load (std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer only, false when nothing is ready
+    bool pop (T *value) {
+        Slot  &slot = slots[tail & mask];
+        size_t seq  = slot.sequence.load (std::memory_order_acquire);
+        if (seq != tail + 1) return false;
+
+        *value = slot.value;
+        slot.sequence.store (tail + mask + 1, std::memory_order_release);
+        tail++;
+        return true;
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#define AU_RT_ALIGN 64
+#define AU_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+inline thread_local unsigned int au_rt_thread      = 0;
+inline thread_local unsigned int au_rt_allow_depth = 0;
+
+// marks the calling thread as real-time until leave. builds with
+// AU_RT_ALLOC_TRAP then trap every malloc/new/free/delete it makes outside an
+// auRtAllowAlloc scope. denormals are flushed to zero meanwhile, decaying
+// filters and envelopes would otherwise crawl through them
+void au_rt_enter ();
+void au_rt_leave ();
+
+// flushes denormals to zero on the calling thread for its lifetime, for
+// threads that render without being real-time
+class auDenormalScope {
+    uint64_t saved;
+
+public:
+    auDenormalScope ();
+    ~auDenormalScope ();
+
+    auDenormalScope (const auDenormalScope &)            = delete;
+    auDenormalScope &operator= (const auDenormalScope &) = delete;
+};
+
+// wraps a real-time loop, the thread's own teardown may allocate again
+struct auRtScope {
+    auRtScope () { au_rt_enter (); }
+    ~auRtScope () { au_rt_leave (); }
+};
+
+// allocations that are known and accepted, e.g. a log line on a fatal error
+struct auRtAllowAlloc {
+    auRtAllowAlloc () { au_rt_allow_depth++; }
+    ~auRtAllowAlloc () { au_rt_allow_depth--; }
+};
+
+inline bool au_rt_alloc_forbidden () {
+    return au_rt_thread && !au_rt_allow_depth;
+}
+
+// locked, prefaulted memory straight from mmap. hugepages are tried first so
+// a whole slab usually costs one TLB entry
+class auSlab {
+    void  *data = nullptr;
+    size_t size = 0;
+    bool   huge = false;
+
+public:
+    auSlab () = default;
+    explicit auSlab (size_t bytes);
+    ~auSlab ();
+
+    auSlab (auSlab &&other) noexcept;
+    auSlab &operator= (auSlab &&other) noexcept;
+
+    auSlab (const auSlab &)            = delete;
+    auSlab &operator= (const auSlab &) = delete;
+
+    inline void *get_data () const { return data; }
+
+    inline size_t get_size () const { return size; }
+
+    inline bool is_huge () const { return huge; }
+};
+
+// bump allocator for scratch memory that lives for one block, reset at the
+// start of every block. used by one thread at a time
+class auArena {
+    auSlab slab;
+    size_t offset     = 0;
+    size_t high_water = 0;
+
+    std::atomic<uint64_t> failures = 0;
+
+public:
+    explicit auArena (size_t bytes) : slab (bytes) {}
+
+    // nullptr when the arena is exhausted, never falls back to the heap
+    void *alloc (size_t bytes, size_t align = AU_RT_ALIGN);
+
+    template <typename T> T *alloc_array (size_t count) {
+        static_assert (std::is_trivially_default_constructible_v<T>,
+                       "arena memory is never constructed");
+        return static_cast<T *> (alloc (count * sizeof (T),
+                                        alignof (T) > AU_RT_ALIGN
+                                            ? alignof (T)
+                                            : AU_RT_ALIGN));
+    }
+
+    // save and restore points for nested scratch use
+    inline size_t mark () const { return offset; }
+    inline void   rewind (size_t to) { offset = to; }
+    inline void   reset () { offset = 0; }
+
+    inline size_t get_capacity () const { return slab.get_size (); }
+
+    inline size_t get_high_water () const { return high_water; }
+
+    inline uint64_t get_failures () const { return failures.load (); }
+};
+
+// fixed-size buffers handed out and returned from any thread without locks
+class auBufferPool {
+    auSlab slab;
+    size_t buffer_size;
+    size_t stride;
+    size_t count;
+
+    std::unique_ptr<std::atomic<uint32_t>[]> next; // free list links
+    std::atomic<uint64_t> head      = 0; // tag << 32 | index + 1, 0 if empty
+    std::atomic<size_t>   available = 0;
+
+public:
+    auBufferPool (size_t buffer_size, size_t count);
+
+    auBufferPool (const auBufferPool &)            = delete;
+    auBufferPool &operator= (const auBufferPool &) = delete;
+
+    // nullptr when every buffer is taken
+    void *acquire ();
+    void  release (void *buffer);
+
+    inline size_t get_buffer_size () const { return buffer_size; }
+
+    inline size_t get_available () const { return available.load (); }
+};
+
+// what each thread running graph steps gets for per-block scratch
+#define AU_SCRATCH_BYTES (256 * 1024)
+
+// the arena nodes take scratch from while they process, installed by
+// whatever runs graph steps on this thread and reset before every step
+inline thread_local auArena *au_rt_scratch = nullptr;
+
+// installs an arena as the thread's scratch until the scope ends
+class auScratchScope {
+    auArena *saved;
+
+public:
+    explicit auScratchScope (auArena &arena) : saved (au_rt_scratch) {
+        au_rt_scratch = &arena;
+    }
+    ~auScratchScope () { au_rt_scratch = saved; }
+
+    auScratchScope (const auScratchScope &)            = delete;
+    auScratchScope &operator= (const auScratchScope &) = delete;
+};
+
+// valid until the node returns, nullptr without an arena or once it ran out
+template <typename T> T *au_scratch (size_t count) {
+    return au_rt_scratch ? au_rt_scratch->alloc_array<T> (count) : nullptr;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// portable vectors through the compiler's vector extensions, they lower to
+// whatever the target has (two sse ops or one avx op for 8 floats). the
+// helpers are forced inline so no 32 byte vector ever crosses a call, which
+// would need avx to be enabled
+#define AU_VEC_WIDTH 8
+#define AU_VEC_INLINE inline __attribute__ ((always_inline))
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+typedef float   auVec8 __attribute__ ((vector_size (32)));
+typedef int32_t auMask8 __attribute__ ((vector_size (32)));
+
+AU_VEC_INLINE auVec8 au_vec_set1 (float v) { return auVec8 {} + v; }
+
+AU_VEC_INLINE auVec8 au_vec_load (const float *p) {
+    auVec8 v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+}
+
+AU_VEC_INLINE void au_vec_store (float *p, auVec8 v) {
+    memcpy (p, &v, sizeof (v));
+}
+
+// 1 where the mask is set, 0 elsewhere
+AU_VEC_INLINE auVec8 au_vec_from_mask (auMask8 m) {
+    return -__builtin_convertvector (m, auVec8);
+}
+
+AU_VEC_INLINE auVec8 au_vec_select (auMask8 m, auVec8 a, auVec8 b) {
+    auMask8 ai, bi;
+    memcpy (&ai, &a, sizeof (ai));
+    memcpy (&bi, &b, sizeof (bi));
+    auMask8 r = (ai & m) | (bi & ~m);
+    auVec8  v;
+    memcpy (&v, &r, sizeof (v));
+    return v;
+}
+
+AU_VEC_INLINE auVec8 au_vec_min (auVec8 a, auVec8 b) {
+    return au_vec_select (a < b, a, b);
+}
+
+AU_VEC_INLINE auVec8 au_vec_max (auVec8 a, auVec8 b) {
+    return au_vec_select (a > b, a, b);
+}
+
+AU_VEC_INLINE float au_vec_sum (auVec8 v) {
+    float s = 0;
+    for (int i = 0; i < AU_VEC_WIDTH; i++) s += v[i];
+    return s;
+}
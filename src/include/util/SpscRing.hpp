@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// wait-free single producer single consumer ring, the capacity is rounded up
+// to a power of two and never changes after construction
+template <typename T> class auSpscRing {
+    std::vector<T> owned;
+    T             *buffer;
+    size_t         size;
+    size_t         mask;
+
+    alignas (64) std::atomic<size_t> head = 0; // written by the producer
+    alignas (64) std::atomic<size_t> tail = 0; // written by the consumer
+
+public:
+    auSpscRing (size_t capacity) {
+        size = 1;
+        while (size < capacity) size <<= 1;
+        owned.resize (size);
+        buffer = owned.data ();
+        mask   = size - 1;
+    }
+
+    // runs in caller owned memory of `capacity` items, a power of two, that
+    // has to outlive the ring
+    auSpscRing (T *storage, size_t capacity) :
+        buffer (storage), size (capacity), mask (capacity - 1) {}
+
+    auSpscRing (const auSpscRing &)            = delete;
+    auSpscRing &operator= (const auSpscRing &) = delete;
+
+    inline size_t get_capacity () const { return size; }
+
+    inline size_t get_read_available () const {
+        return head.load (std::memory_order_acquire)
+               - tail.load (std::memory_order_relaxed);
+    }
+
+    inline size_t get_write_available () const {
+        return size - (head.load (std::memory_order_relaxed)
+                       - tail.load (std::memory_order_acquire));
+    }
+
+    // producer side, returns how many items were written
+    size_t write (const T *data, size_t count) {
+        size_t h    = head.load (std::memory_order_relaxed);
+        size_t t    = tail.load (std::memory_order_acquire);
+        size_t room = size - (h - t);
+        if (count > room) count = room;
+
+        size_t start = h & mask;
+        size_t first = count < size - start ? count : size - start;
+        memcpy (buffer + start, data, first * sizeof (T));
+        memcpy (buffer, data + first, (count - first) * sizeof (T));
+
+        head.store (h + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer side, returns how many items were read
+    size_t read (T *data, size_t count) {
+        size_t t     = tail.load (std::memory_order_relaxed);
+        size_t h     = head.load (std::memory_order_acquire);
+        size_t avail = h - t;
+        if (count > avail) count = avail;
+
+        size_t start = t & mask;
+        size_t first = count < size - start ? count : size - start;
+        memcpy (data, buffer + start, first * sizeof (T));
+        memcpy (data + first, buffer, (count - first) * sizeof (T));
+
+        tail.store (t + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer side, drops everything written so far
+    void discard () {
+        tail.store (head.load (std::memory_order_acquire),
+                    std::memory_order_release);
+    }
+};
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// tells the cpu we are spinning, keeps busy-waits cheap for the sibling
+// hyperthread
+inline void au_cpu_relax () {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause ();
+#elif defined(__aarch64__)
+    asm volatile ("yield");
+#endif
+}
+
+// spins for a while, then gives the core away in case whoever we wait for
+// shares it
+inline void au_backoff (unsigned int *spins) {
+    if (++*spins < 256) {
+        au_cpu_relax ();
+    } else {
+        std::this_thread::yield ();
+    }
+}
+
+// bounded chase-lev deque of task indices, the owner pushes and pops at the
+// bottom while any other thread steals from the top. the capacity is rounded
+// up to a power of two and has to cover everything pushed before it drains
+class auWorkDeque {
+    std::vector<std::atomic<uint32_t>> items;
+    int64_t                            mask;
+
+    alignas (64) std::atomic<int64_t> top    = 0;
+    alignas (64) std::atomic<int64_t> bottom = 0;
+
+public:
+    explicit auWorkDeque (size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        items = std::vector<std::atomic<uint32_t>> (size);
+        mask  = int64_t (size) - 1;
+    }
+
+    auWorkDeque (const auWorkDeque &)            = delete;
+    auWorkDeque &operator= (const auWorkDeque &) = delete;
+
+    inline size_t get_capacity () const { return items.size (); }
+
+    // owner only
+    void push (uint32_t item) {
+        int64_t b = bottom.load (std::memory_order_relaxed);
+        items[b & mask].store (item, std::memory_order_relaxed);
+        bottom.store (b + 1, std::memory_order_release);
+    }
+
+    // owner only, newest first
+    bool pop (uint32_t *item) {
+        int64_t b = bottom.load (std::memory_order_relaxed) - 1;
+        bottom.store (b, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        int64_t t = top.load (std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store (b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        *item = items[b & mask].load (std::memory_order_relaxed);
+        if (t == b) {
+            // last item, race the thieves for it
+            bool won = top.compare_exchange_strong (
+                t, t + 1, std::memory_order_seq_cst,
+                std::memory_order_relaxed);
+            bottom.store (b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // any thread, oldest first
+    bool steal (uint32_t *item) {
+        int64_t t = top.load (std::memory_order_acquire);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        int64_t b = bottom.load (std::memory_order_acquire);
+        if (t >= b) return false;
+
+        *item = items[t & mask].load (std::memory_order_relaxed);
+        return top.compare_exchange_strong (t, t + 1,
+                                            std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    }
+};
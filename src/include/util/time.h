@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <time.h>
+
+// monotonic clock, cheap enough for real-time threads(vDSO)
+inline uint64_t au_now_ns () {
+    timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return uint64_t (ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
\ No newline at end of file
@@ -1,7 +1,14 @@
 #include "spdlog/spdlog.h"
 #include <alsa/asoundlib.h>
 #include <fmt/core.h>
+#include <algorithm>
+#include <future>
 #include <io/Alsa.hpp>
+#include <io/Sink.hpp>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 snd_pcm_format_t sformat_to_pcm_format (auSFormat s_format) {
     switch (s_format.data_type) {
@@ -12,7 +19,7 @@ snd_pcm_format_t sformat_to_pcm_format (auSFormat s_format) {
         case 16:
             return SND_PCM_FORMAT_U16;
         case 24:
-            return SND_PCM_FORMAT_U24;
+            return SND_PCM_FORMAT_U24_3LE; // packed, like in wav files
         case 32:
             return SND_PCM_FORMAT_U32;
         default:
@@ -26,7 +33,7 @@ snd_pcm_format_t sformat_to_pcm_format (auSFormat s_format) {
         case 16:
             return SND_PCM_FORMAT_S16;
         case 24:
-            return SND_PCM_FORMAT_S24;
+            return SND_PCM_FORMAT_S24_3LE;
         case 32:
             return SND_PCM_FORMAT_S32;
         default:
@@ -44,14 +51,453 @@ snd_pcm_format_t sformat_to_pcm_format (auSFormat s_format) {
     case auDtype::uDviAdpcm:
         return SND_PCM_FORMAT_IMA_ADPCM;
     case auDtype::uMsAdpcm:
-        return SND_PCM_FORMAT_IMA_ADPCM;
+        return SND_PCM_FORMAT_UNKNOWN; // alsa has no ms adpcm
     default:
         return SND_PCM_FORMAT_S16_LE;
     }
 }
 
+static const unsigned int COMMON_RATES[]
+    = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400,
+        192000 };
+
+bool auDeviceCaps::supports (auSFormat s_format) const {
+    snd_pcm_format_t fmt = sformat_to_pcm_format (s_format);
+    if (fmt == SND_PCM_FORMAT_UNKNOWN) return false;
+    if (std::find (formats.begin (), formats.end (), fmt) == formats.end ()) {
+        return false;
+    }
+    return s_format.channels >= channels_min
+           && s_format.channels <= channels_max
+           && s_format.sample_rate >= rate_min
+           && s_format.sample_rate <= rate_max;
+}
+
+const auDeviceCaps &auDevice::probe_caps (snd_pcm_stream_t stream) {
+    std::lock_guard<std::mutex> lock (*caps_mutex);
+    if (caps->probed) return *caps;
+
+    int        err;
+    snd_pcm_t *handle;
+    if ((err = snd_pcm_open (&handle, dev_string.c_str (), stream,
+                             SND_PCM_NONBLOCK))
+        < 0) {
+        spdlog::warn ("Cannot probe {}: {}", dev_string, snd_strerror (err));
+        return *caps;
+    }
+
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_hw_params_alloca (&hw_params);
+    if ((err = snd_pcm_hw_params_any (handle, hw_params)) < 0) {
+        spdlog::warn ("Cannot probe {}: {}", dev_string, snd_strerror (err));
+        snd_pcm_close (handle);
+        return *caps;
+    }
+
+    auDeviceCaps probed;
+
+    static const snd_pcm_format_t candidates[]
+        = { SND_PCM_FORMAT_S8,      SND_PCM_FORMAT_U8,
+            SND_PCM_FORMAT_S16,     SND_PCM_FORMAT_U16,
+            SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_U24_3LE,
+            SND_PCM_FORMAT_S32,     SND_PCM_FORMAT_U32,
+            SND_PCM_FORMAT_FLOAT,   SND_PCM_FORMAT_FLOAT64,
+            SND_PCM_FORMAT_MU_LAW,  SND_PCM_FORMAT_A_LAW,
+            SND_PCM_FORMAT_IMA_ADPCM };
+    for (snd_pcm_format_t fmt : candidates) {
+        if (snd_pcm_hw_params_test_format (handle, hw_params, fmt) == 0) {
+            probed.formats.push_back (fmt);
+        }
+    }
+    for (unsigned int rate : COMMON_RATES) {
+        if (snd_pcm_hw_params_test_rate (handle, hw_params, rate, 0) == 0) {
+            probed.rates.push_back (rate);
+        }
+    }
+
+    snd_pcm_hw_params_get_rate_min (hw_params, &probed.rate_min, nullptr);
+    snd_pcm_hw_params_get_rate_max (hw_params, &probed.rate_max, nullptr);
+    snd_pcm_hw_params_get_channels_min (hw_params, &probed.channels_min);
+    snd_pcm_hw_params_get_channels_max (hw_params, &probed.channels_max);
+    snd_pcm_hw_params_get_period_size_min (hw_params, &probed.period_min,
+                                           nullptr);
+    snd_pcm_hw_params_get_period_size_max (hw_params, &probed.period_max,
+                                           nullptr);
+    snd_pcm_hw_params_get_periods_min (hw_params, &probed.periods_min,
+                                       nullptr);
+    snd_pcm_hw_params_get_periods_max (hw_params, &probed.periods_max,
+                                       nullptr);
+    probed.mmap_interleaved = snd_pcm_hw_params_test_access (
+                                  handle, hw_params,
+                                  SND_PCM_ACCESS_MMAP_INTERLEAVED)
+                              == 0;
+    probed.mmap_planar = snd_pcm_hw_params_test_access (
+                             handle, hw_params,
+                             SND_PCM_ACCESS_MMAP_NONINTERLEAVED)
+                         == 0;
+    snd_pcm_close (handle);
+
+    probed.probed = true;
+    *caps         = std::move (probed);
+
+    spdlog::info ("{}: {} formats, {}-{} Hz, {}-{} channels, periods of "
+                  "{}-{} frames",
+                  dev_string, caps->formats.size (), caps->rate_min,
+                  caps->rate_max, caps->channels_min, caps->channels_max,
+                  caps->period_min, caps->period_max);
+    return *caps;
+}
+
+// lower is cheaper, only lossless or near lossless targets are considered
+static int conversion_cost (auSFormat from, auSFormat to) {
+    if (from == to) return 0;
+
+    bool from_int = from.data_type == auDtype::sInt
+                    || from.data_type == auDtype::uInt;
+    bool to_int
+        = to.data_type == auDtype::sInt || to.data_type == auDtype::uInt;
+
+    // widening within the same type only shifts
+    if (from.data_type == to.data_type && to.bit_depth > from.bit_depth) {
+        return 1 + (to.bit_depth - from.bit_depth) / 8;
+    }
+    if (from_int && to_int && to.bit_depth >= from.bit_depth) {
+        return 6; // sign flip
+    }
+    if (to.data_type == auDtype::sFloat) return 8;
+    if (to.data_type == auDtype::sDouble) return 9;
+    if (to_int && to.bit_depth >= 16) return 20 - to.bit_depth / 8;
+    return 100; // lossy, last resort
+}
+
+auSFormat auDevice::choose_format (snd_pcm_stream_t stream,
+                                   auSFormat        source) {
+    const auDeviceCaps &dev_caps = probe_caps (stream);
+    if (!dev_caps.probed || dev_caps.supports (source)) return source;
+
+    auSFormat target = source;
+    if (dev_caps.channels_max && target.channels > dev_caps.channels_max) {
+        target.channels = dev_caps.channels_max;
+    }
+    if (target.channels < dev_caps.channels_min) {
+        target.channels = dev_caps.channels_min;
+    }
+
+    static const auSFormat candidates[] = {
+        auSFormat (0, 8, 0, auDtype::sInt),
+        auSFormat (0, 8, 0, auDtype::uInt),
+        auSFormat (0, 16, 0, auDtype::sInt),
+        auSFormat (0, 16, 0, auDtype::uInt),
+        auSFormat (0, 24, 0, auDtype::sInt),
+        auSFormat (0, 24, 0, auDtype::uInt),
+        auSFormat (0, 32, 0, auDtype::sInt),
+        auSFormat (0, 32, 0, auDtype::uInt),
+        auSFormat (0, 32, 0, auDtype::sFloat),
+        auSFormat (0, 64, 0, auDtype::sDouble),
+        auSFormat (0, 8, 0, auDtype::uMuLaw),
+        auSFormat (0, 8, 0, auDtype::uALaw),
+    };
+
+    int best_cost = -1;
+    for (auSFormat candidate : candidates) {
+        candidate.sample_rate = target.sample_rate;
+        candidate.channels    = target.channels;
+        if (!dev_caps.supports (candidate)) continue;
+
+        int cost = conversion_cost (source, candidate);
+        if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            target    = candidate;
+        }
+    }
+
+    if (best_cost < 0) {
+        spdlog::warn ("{} supports no format for {} Hz {} channels",
+                      dev_string, target.sample_rate, target.channels);
+        return source;
+    }
+    return target;
+}
+
+snd_pcm_access_t access_to_pcm_access (auAccessMode access) {
+    switch (access) {
+    case auAccessMmapInterleaved:
+        return SND_PCM_ACCESS_MMAP_INTERLEAVED;
+    case auAccessMmapPlanar:
+        return SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+    default:
+        return SND_PCM_ACCESS_RW_INTERLEAVED;
+    }
+}
+
+auAccessMode choose_access (snd_pcm_t *handle, snd_pcm_hw_params_t *hw_params,
+                            auAccessMode wanted) {
+    auAccessMode order[3] = { wanted, auAccessMmapInterleaved, auAccessRw };
+    if (wanted == auAccessMmapInterleaved) order[1] = auAccessMmapPlanar;
+    if (wanted == auAccessRw) return auAccessRw;
+
+    for (auAccessMode access : order) {
+        if (snd_pcm_hw_params_test_access (handle, hw_params,
+                                           access_to_pcm_access (access))
+            == 0) {
+            return access;
+        }
+    }
+    return auAccessRw;
+}
+
+int au_mmap_begin (snd_pcm_t *handle, const auStreamConfig &config,
+                   snd_pcm_uframes_t frames, auMmapWindow *window) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t             offset;
+    unsigned int                  channels = config.channels;
+
+    if (channels > AU_MAX_CHANNELS) { return -EINVAL; }
+
+    int err = snd_pcm_mmap_begin (handle, &areas, &offset, &frames);
+    if (err < 0) { return err; }
+
+    window->offset = offset;
+    window->frames = frames;
+    window->step   = areas[0].step / 8;
+
+    // interleaved areas share one block, channel i sits i samples into a
+    // frame and a frame is one sample per channel. planar buffers can share
+    // a block too, so the block alone proves nothing
+    int  width       = snd_pcm_format_physical_width (config.format);
+    bool interleaved = width > 0;
+    for (unsigned int i = 0; i < channels; i++) {
+        window->channels[i] = static_cast<char *> (areas[i].addr)
+                              + (areas[i].first + offset * areas[i].step) / 8;
+        if (areas[i].addr != areas[0].addr
+            || areas[i].first != i * unsigned (width)
+            || areas[i].step != channels * unsigned (width)) {
+            interleaved = false;
+        }
+    }
+    window->interleaved = interleaved ? window->channels[0] : nullptr;
+    return 0;
+}
+
+int au_mmap_commit (snd_pcm_t *handle, const auMmapWindow &window) {
+    snd_pcm_sframes_t committed
+        = snd_pcm_mmap_commit (handle, window.offset, window.frames);
+    if (committed < 0) { return committed; }
+    if (snd_pcm_uframes_t (committed) != window.frames) { return -EPIPE; }
+    return 0;
+}
+
+void auStreamStats::record_callback (uint64_t ns, uint64_t period_ns) {
+    periods.fetch_add (1, std::memory_order_relaxed);
+    if (ns > period_ns) late_periods.fetch_add (1, std::memory_order_relaxed);
+
+    uint64_t max = max_callback_ns.load (std::memory_order_relaxed);
+    while (ns > max
+           && !max_callback_ns.compare_exchange_weak (
+               max, ns, std::memory_order_relaxed)) {}
+}
+
+void auStreamStats::reset () {
+    periods         = 0;
+    xruns           = 0;
+    short_transfers = 0;
+    late_periods    = 0;
+    max_callback_ns = 0;
+}
+
+int au_pcm_prefill (snd_pcm_t *handle, snd_pcm_uframes_t frames,
+                    const auStreamConfig &config, const char *silence) {
+    while (frames > 0) {
+        snd_pcm_uframes_t chunk
+            = frames < config.period_size ? frames : config.period_size;
+        snd_pcm_sframes_t done;
+
+        if (config.access == auAccessRw) {
+            done = snd_pcm_writei (handle, silence, chunk);
+        } else {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t             offset;
+            int err = snd_pcm_mmap_begin (handle, &areas, &offset, &chunk);
+            if (err < 0) return err;
+            snd_pcm_areas_silence (areas, offset, config.channels, chunk,
+                                   config.format);
+            done = snd_pcm_mmap_commit (handle, offset, chunk);
+        }
+        if (done < 0) return done;
+        if (done == 0) break;
+        frames -= done;
+    }
+    return 0;
+}
+
+int au_pcm_recover (snd_pcm_t *handle, int err, snd_pcm_stream_t stream,
+                    const auStreamConfig &config, auStreamStats *stats,
+                    const char *silence) {
+    if (err == -EPIPE) stats->xruns.fetch_add (1, std::memory_order_relaxed);
+
+    if ((err = snd_pcm_recover (handle, err, 1)) < 0) { return err; }
+
+    if (stream == SND_PCM_STREAM_PLAYBACK) {
+        snd_pcm_uframes_t frames
+            = config.period_count > 1
+                  ? config.period_size * (config.period_count - 1)
+                  : config.period_size;
+        if ((err = au_pcm_prefill (handle, frames, config, silence)) < 0) {
+            return err;
+        }
+    } else if (config.access != auAccessRw) {
+        // capture mmap streams are not started by a read
+        if ((err = snd_pcm_start (handle)) < 0) { return err; }
+    }
+    return 0;
+}
+
+int negotiate_params (snd_pcm_t *handle, const std::string &dev_str,
+                      snd_pcm_stream_t stream, auSFormat s_format,
+                      auStreamParams params, auStreamConfig *config) {
+    int                  err;
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_hw_params_alloca (&hw_params);
+    snd_pcm_sw_params_alloca (&sw_params);
+
+    snd_pcm_format_t fmt = sformat_to_pcm_format (s_format);
+
+    if ((err = snd_pcm_hw_params_any (handle, hw_params)) < 0) {
+        spdlog::error ("No hardware configurations for device {}: {}",
+                       dev_str, snd_strerror (err));
+        return err;
+    }
+    if ((err = snd_pcm_hw_params_set_rate_resample (handle, hw_params,
+                                                    params.soft_resample))
+        < 0) {
+        spdlog::error ("Failed to set resampling for device {}: {}", dev_str,
+                       snd_strerror (err));
+        return err;
+    }
+    auAccessMode access = choose_access (handle, hw_params, params.access);
+    if (access != params.access) {
+        spdlog::warn ("Device {} does not support access mode {}, using {}",
+                      dev_str, int (params.access), int (access));
+    }
+    if ((err = snd_pcm_hw_params_set_access (handle, hw_params,
+                                             access_to_pcm_access (access)))
+        < 0) {
+        spdlog::error ("Failed to set access type for device {}: {}",
+                       dev_str, snd_strerror (err));
+        return err;
+    }
+    if ((err = snd_pcm_hw_params_set_format (handle, hw_params, fmt)) < 0) {
+        spdlog::error ("Format {} not available for device {}: {}",
+                       snd_pcm_format_name (fmt), dev_str,
+                       snd_strerror (err));
+        return err;
+    }
+    if ((err = snd_pcm_hw_params_set_channels (handle, hw_params,
+                                               s_format.channels))
+        < 0) {
+        spdlog::error ("{} channels not available for device {}: {}",
+                       s_format.channels, dev_str, snd_strerror (err));
+        return err;
+    }
+
+    unsigned int rate = s_format.sample_rate;
+    if ((err = snd_pcm_hw_params_set_rate_near (handle, hw_params, &rate,
+                                                nullptr))
+        < 0) {
+        spdlog::error ("Sample rate {} not available for device {}: {}",
+                       s_format.sample_rate, dev_str, snd_strerror (err));
+        return err;
+    }
+    if (rate != s_format.sample_rate) {
+        spdlog::error ("Device {} cannot run at {} Hz(got {} Hz)", dev_str,
+                       s_format.sample_rate, rate);
+        return -EINVAL;
+    }
+
+    // period size first, the period count then decides the buffer size
+    snd_pcm_uframes_t period_size = params.period_size;
+    if (period_size
+        && (err = snd_pcm_hw_params_set_period_size_near (
+                handle, hw_params, &period_size, nullptr))
+               < 0) {
+        spdlog::error ("Failed to set period size {} for device {}: {}",
+                       params.period_size, dev_str, snd_strerror (err));
+        return err;
+    }
+    unsigned int period_count = params.period_count;
+    if (period_count
+        && (err = snd_pcm_hw_params_set_periods_near (handle, hw_params,
+                                                      &period_count, nullptr))
+               < 0) {
+        spdlog::error ("Failed to set period count {} for device {}: {}",
+                       params.period_count, dev_str, snd_strerror (err));
+        return err;
+    }
+
+    if ((err = snd_pcm_hw_params (handle, hw_params)) < 0) {
+        spdlog::error ("Failed to set hardware parameters for device {}: {}",
+                       dev_str, snd_strerror (err));
+        return err;
+    }
+
+    snd_pcm_uframes_t buffer_size;
+    snd_pcm_hw_params_get_period_size (hw_params, &period_size, nullptr);
+    snd_pcm_hw_params_get_periods (hw_params, &period_count, nullptr);
+    snd_pcm_hw_params_get_buffer_size (hw_params, &buffer_size);
+
+    snd_pcm_uframes_t start_threshold = params.start_threshold;
+    if (!start_threshold) {
+        start_threshold
+            = stream == SND_PCM_STREAM_PLAYBACK ? buffer_size : 1;
+    }
+    snd_pcm_uframes_t avail_min
+        = params.avail_min ? params.avail_min : period_size;
+
+    if ((err = snd_pcm_sw_params_current (handle, sw_params)) < 0) {
+        spdlog::error ("Failed to get software parameters for device {}: {}",
+                       dev_str, snd_strerror (err));
+        return err;
+    }
+    if ((err = snd_pcm_sw_params_set_start_threshold (handle, sw_params,
+                                                      start_threshold))
+        < 0) {
+        spdlog::error ("Failed to set start threshold for device {}: {}",
+                       dev_str, snd_strerror (err));
+        return err;
+    }
+    if ((err = snd_pcm_sw_params_set_avail_min (handle, sw_params,
+                                                avail_min))
+        < 0) {
+        spdlog::error ("Failed to set avail min for device {}: {}", dev_str,
+                       snd_strerror (err));
+        return err;
+    }
+    if ((err = snd_pcm_sw_params (handle, sw_params)) < 0) {
+        spdlog::error ("Failed to set software parameters for device {}: {}",
+                       dev_str, snd_strerror (err));
+        return err;
+    }
+
+    config->sample_rate     = rate;
+    config->channels        = s_format.channels;
+    config->format          = fmt;
+    config->period_size     = period_size;
+    config->period_count    = period_count;
+    config->buffer_size     = buffer_size;
+    config->start_threshold = start_threshold;
+    config->avail_min       = avail_min;
+    config->access          = access;
+    config->latency_us
+        = uint32_t ((uint64_t (buffer_size) * 1000000) / rate);
+
+    spdlog::info ("Device {} granted {} periods of {} frames({} us latency)",
+                  dev_str, period_count, period_size, config->latency_us);
+    return 0;
+}
+
 int auInputDevice::open_stream (snd_pcm_t **handle, auSFormat s_format,
-                                size_t latency) {
+                                auStreamParams params) {
     int         err;
     std::string dev_str = get_dev_string ();
 
@@ -63,24 +509,62 @@ int auInputDevice::open_stream (snd_pcm_t **handle, auSFormat s_format,
         return err;
     }
 
-    if ((err = snd_pcm_set_params (*handle, sformat_to_pcm_format (s_format),
-                                   SND_PCM_ACCESS_RW_INTERLEAVED,
-                                   s_format.channels, s_format.sample_rate, 1,
-                                   latency))
+    if ((err = negotiate_params (*handle, dev_str, SND_PCM_STREAM_CAPTURE,
+                                 s_format, params, &config))
         < 0) {
-        spdlog::error ("Failed to set PCM parameters for device {}: {}",
-                       dev_str, snd_strerror (err));
         snd_pcm_close (*handle);
         return err;
     }
+    this->handle = *handle;
+    stats->reset ();
     spdlog::info ("PCM device {} opened successfully with sample rate {} and "
                   "channels {}",
                   dev_str, s_format.sample_rate, s_format.channels);
     return 0;
 }
 
+int auInputDevice::read_chunk (void *data, size_t num_frames) {
+    if (!handle) {
+        spdlog::error ("Input device wasnt opened yet!");
+        return -1;
+    }
+    if (config.access == auAccessMmapPlanar) {
+        spdlog::error ("read_chunk needs an interleaved stream!");
+        return -EINVAL;
+    }
+
+    char  *buf  = static_cast<char *> (data);
+    size_t done = 0;
+    while (done < num_frames) {
+        char             *chunk = buf + snd_pcm_frames_to_bytes (handle, done);
+        snd_pcm_sframes_t read
+            = config.access == auAccessMmapInterleaved
+                  ? snd_pcm_mmap_readi (handle, chunk, num_frames - done)
+                  : snd_pcm_readi (handle, chunk, num_frames - done);
+        if (read < 0) {
+            int err = au_pcm_recover (handle, read, SND_PCM_STREAM_CAPTURE,
+                                      config, stats.get (), nullptr);
+            if (err < 0) {
+                spdlog::error ("Failed to read from PCM device: {}",
+                               snd_strerror (err));
+                return err;
+            }
+            spdlog::warn ("Recovered from {} on {}", snd_strerror (read),
+                          get_dev_string ());
+            continue;
+        }
+        if (read < static_cast<snd_pcm_sframes_t> (num_frames - done)) {
+            stats->short_transfers++;
+        }
+        done += read;
+    }
+    stats->periods++;
+
+    return 0;
+}
+
 int auOutputDevice::open_stream (snd_pcm_t **handle, auSFormat s_format,
-                                 size_t latency) {
+                                 auStreamParams params) {
     int         err;
     std::string dev_str = get_dev_string ();
 
@@ -97,12 +581,9 @@ int auOutputDevice::open_stream (snd_pcm_t **handle, auSFormat s_format,
     spdlog::info ("Trying to open PCM device {} with format {}", dev_str,
                   snd_pcm_format_name (fmt));
 
-    if ((err = snd_pcm_set_params (*handle, fmt, SND_PCM_ACCESS_RW_INTERLEAVED,
-                                   s_format.channels, s_format.sample_rate, 1,
-                                   latency))
+    if ((err = negotiate_params (*handle, dev_str, SND_PCM_STREAM_PLAYBACK,
+                                 s_format, params, &config))
         < 0) {
-        spdlog::error ("Failed to set PCM parameters for device {}: {}",
-                       dev_str, snd_strerror (err));
         snd_pcm_close (*handle);
         return err;
     }
@@ -112,6 +593,11 @@ int auOutputDevice::open_stream (snd_pcm_t **handle, auSFormat s_format,
 
     this->handle      = *handle;
     this->sample_rate = s_format.sample_rate;
+
+    silence.assign (snd_pcm_frames_to_bytes (*handle, config.period_size), 0);
+    snd_pcm_format_set_silence (config.format, silence.data (),
+                                config.period_size * config.channels);
+    stats->reset ();
     return 0;
 }
 
@@ -120,156 +606,346 @@ int auOutputDevice::play_chunk (const void *data, size_t num_frames) {
         spdlog::error ("Output device wasnt opened yet!");
         return -1;
     }
+    if (config.access == auAccessMmapPlanar) {
+        spdlog::error ("play_chunk needs an interleaved stream!");
+        return -EINVAL;
+    }
 
-    snd_pcm_sframes_t written = snd_pcm_writei (handle, data, num_frames);
-    if (written < 0) {
-        spdlog::error ("Failed to write to PCM device: {}",
-                       snd_strerror (written));
-        return written;
-    } else if (written < static_cast<snd_pcm_sframes_t> (num_frames)) {
-        spdlog::warn ("Short write: expected {}, wrote {}", num_frames,
-                      written);
+    const char *buf  = static_cast<const char *> (data);
+    size_t      done = 0;
+    while (done < num_frames) {
+        const char       *chunk = buf + snd_pcm_frames_to_bytes (handle, done);
+        snd_pcm_sframes_t written
+            = config.access == auAccessMmapInterleaved
+                  ? snd_pcm_mmap_writei (handle, chunk, num_frames - done)
+                  : snd_pcm_writei (handle, chunk, num_frames - done);
+        if (written < 0) {
+            int err = au_pcm_recover (handle, written, SND_PCM_STREAM_PLAYBACK,
+                                      config, stats.get (), silence.data ());
+            if (err < 0) {
+                spdlog::error ("Failed to write to PCM device: {}",
+                               snd_strerror (err));
+                return err;
+            }
+            spdlog::warn ("Recovered from {} on {}", snd_strerror (written),
+                          get_dev_string ());
+            continue;
+        }
+        if (written < static_cast<snd_pcm_sframes_t> (num_frames - done)) {
+            stats->short_transfers++;
+            spdlog::warn ("Short write: expected {}, wrote {}",
+                          num_frames - done, written);
+        }
+        done += written;
     }
+    stats->periods++;
 
     return 0;
 }
 
-std::vector<auOutputDevice> auDeviceManager::get_output_devices () {
-    std::vector<auOutputDevice> output_devices;
+int auOutputDevice::open (auSFormat s_format, auStreamParams params) {
+    snd_pcm_t *pcm;
+    return open_stream (&pcm, s_format, params);
+}
 
-    output_devices.emplace_back (0, 0, "pulse", "pulse", "pulse");
+void auOutputDevice::close () {
+    if (!handle) return;
+    snd_pcm_drain (handle);
+    snd_pcm_close (handle);
+    handle = nullptr;
+    config = auStreamConfig ();
+}
 
-    int card_number = -1;
-    int err;
+// probes playback and capture of every pcm on one card in a single pass
+static void probe_card (int card_number, std::vector<auInputDevice> *inputs,
+                        std::vector<auOutputDevice> *outputs) {
+    int                  err;
+    snd_ctl_t           *ctl;
+    snd_ctl_card_info_t *info;
+    snd_ctl_card_info_alloca (&info);
+
+    char card_id[32];
+    snprintf (card_id, sizeof (card_id), "hw:%d", card_number);
+
+    if ((err = snd_ctl_open (&ctl, card_id, 0)) < 0) {
+        spdlog::warn ("Failed to open card {}: {}", card_id,
+                      snd_strerror (err));
+        return;
+    }
 
-    if (snd_card_next (&card_number) < 0) {
-        spdlog::warn ("No sound cards found!");
-        return output_devices;
+    if ((err = snd_ctl_card_info (ctl, info)) < 0) {
+        spdlog::warn ("Failed to get card info for {}: {}", card_id,
+                      snd_strerror (err));
+        snd_ctl_close (ctl);
+        return;
     }
 
-    while (card_number >= 0) {
-        snd_ctl_t           *ctl;
-        snd_ctl_card_info_t *info;
-        snd_ctl_card_info_alloca (&info);
+    std::string card_name_str = snd_ctl_card_info_get_name (info);
 
-        char card_id[32];
-        snprintf (card_id, sizeof (card_id), "hw:%d", card_number);
-        spdlog::info ("Trying to open card {}", card_id);
+    snd_pcm_info_t *pcminfo;
+    snd_pcm_info_alloca (&pcminfo);
 
-        if ((err = snd_ctl_open (&ctl, card_id, 0)) < 0) {
-            spdlog::warn ("Failed to open card {}: {}", card_id,
-                          snd_strerror (err));
-            if (snd_card_next (&card_number) < 0) break;
+    int dev_num = -1;
+    while (true) {
+        if ((err = snd_ctl_pcm_next_device (ctl, &dev_num)) < 0) {
+            spdlog::warn ("Failed to get next device for card {}: {}",
+                          card_id, snd_strerror (err));
+            break;
         }
 
-        if ((err = snd_ctl_card_info (ctl, info)) < 0) {
-            spdlog::warn ("Failed to get card info for {}: {}", card_id,
-                          snd_strerror (err));
-            if (snd_card_next (&card_number) < 0) break;
-        }
+        if (dev_num < 0) break;
 
-        std::string card_name_str = snd_ctl_card_info_get_name (info);
+        snd_pcm_info_set_device (pcminfo, dev_num);
+        snd_pcm_info_set_subdevice (pcminfo, 0);
 
-        int dev_num = -1;
-        while (true) {
-            if (snd_ctl_pcm_next_device (ctl, &dev_num) < 0) {
-                spdlog::warn ("Failed to get next device for card {}: {}",
-                              card_id, snd_strerror (err));
-                break;
-            }
+        snd_pcm_info_set_stream (pcminfo, SND_PCM_STREAM_PLAYBACK);
+        bool has_playback = snd_ctl_pcm_info (ctl, pcminfo) >= 0;
+        int  playback_subdevs
+            = has_playback ? snd_pcm_info_get_subdevices_count (pcminfo) : 0;
 
-            if (dev_num < 0) break;
+        snd_pcm_info_set_stream (pcminfo, SND_PCM_STREAM_CAPTURE);
+        bool has_capture = snd_ctl_pcm_info (ctl, pcminfo) >= 0;
+        int  capture_subdevs
+            = has_capture ? snd_pcm_info_get_subdevices_count (pcminfo) : 0;
 
-            snd_pcm_info_t *pcminfo;
-            snd_pcm_info_alloca (&pcminfo);
-            snd_pcm_info_set_device (pcminfo, dev_num);
-            snd_pcm_info_set_subdevice (pcminfo, 0);
-            snd_pcm_info_set_stream (pcminfo, SND_PCM_STREAM_PLAYBACK);
+        if (!has_playback && !has_capture) continue;
 
-            if ((err = snd_ctl_pcm_info (ctl, pcminfo)) < 0) { continue; }
+        // the name and id are the same for both directions
+        snd_pcm_info_set_stream (pcminfo, has_playback
+                                              ? SND_PCM_STREAM_PLAYBACK
+                                              : SND_PCM_STREAM_CAPTURE);
+        snd_ctl_pcm_info (ctl, pcminfo);
 
-            std::string device_name_str = snd_pcm_info_get_name (pcminfo);
+        std::string device_name_str = snd_pcm_info_get_name (pcminfo);
+        std::string device_string
+            = fmt::format ("hw:{},{}", card_number, dev_num);
 
-            std::string device_string
-                = fmt::format ("hw:{},{}", card_number, dev_num);
+        uint8_t id[64] = { 0 };
+        strncpy (reinterpret_cast<char *> (id),
+                 snd_pcm_info_get_id (pcminfo), sizeof (id) - 1);
 
-            output_devices.emplace_back (card_number, dev_num, card_name_str,
-                                         device_name_str, device_string);
+        if (has_playback) {
+            outputs->emplace_back (card_number, dev_num, card_name_str,
+                                   device_name_str, device_string,
+                                   card_number, dev_num, 0, playback_subdevs,
+                                   capture_subdevs, id);
         }
+        if (has_capture) {
+            inputs->emplace_back (card_number, dev_num, card_name_str,
+                                  device_name_str, device_string, card_number,
+                                  dev_num, 0, playback_subdevs,
+                                  capture_subdevs, id);
+        }
+    }
 
-        if (snd_card_next (&card_number) < 0) break;
+    snd_ctl_close (ctl);
+}
 
-        snd_ctl_close (ctl);
+void auDeviceManager::scan () {
+    std::vector<int> cards;
+    int              card_number = -1;
+    while (snd_card_next (&card_number) == 0 && card_number >= 0) {
+        cards.push_back (card_number);
+    }
+    if (cards.empty ()) { spdlog::warn ("No sound cards found!"); }
+
+    // every card is probed on its own thread, the ioctls dont depend on each
+    // other
+    struct auCardProbe {
+        std::vector<auInputDevice>  inputs;
+        std::vector<auOutputDevice> outputs;
+    };
+    std::vector<auCardProbe>       probes (cards.size ());
+    std::vector<std::future<void>> pending;
+    for (size_t i = 0; i < cards.size (); i++) {
+        pending.push_back (std::async (std::launch::async, probe_card,
+                                       cards[i], &probes[i].inputs,
+                                       &probes[i].outputs));
+    }
+    for (auto &p : pending) p.wait ();
+
+    std::vector<auInputDevice>  inputs;
+    std::vector<auOutputDevice> outputs;
+    inputs.emplace_back (0, 0, "pulse", "pulse", "pulse");
+    outputs.emplace_back (0, 0, "pulse", "pulse", "pulse");
+    for (auto &probe : probes) {
+        inputs.insert (inputs.end (), probe.inputs.begin (),
+                       probe.inputs.end ());
+        outputs.insert (outputs.end (), probe.outputs.begin (),
+                        probe.outputs.end ());
+    }
+
+    spdlog::info ("Found {} sound cards with {} outputs and {} inputs",
+                  cards.size (), outputs.size () - 1, inputs.size () - 1);
+
+    std::lock_guard<std::mutex> lock (mutex);
+    input_devices  = std::move (inputs);
+    output_devices = std::move (outputs);
+    scanned        = true;
+    generation++;
+}
+
+void auDeviceManager::refresh () { scan (); }
+
+std::vector<auOutputDevice> auDeviceManager::get_output_devices () {
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (scanned) return output_devices;
     }
+    scan ();
+    std::lock_guard<std::mutex> lock (mutex);
     return output_devices;
 }
 
+std::unique_ptr<auOutputSink>
+auDeviceManager::create_sink (const std::string &spec) {
+    if (spec == "null") {
+        return std::make_unique<auNullSink> (auClockRealtime);
+    }
+    if (spec == "null:freewheel") {
+        return std::make_unique<auNullSink> (auClockFreewheel);
+    }
+    if (spec.starts_with ("wav:")) {
+        return std::make_unique<auFileSink> (spec.substr (4), AudioFFWav);
+    }
+
+    for (const auOutputDevice &dev : get_output_devices ()) {
+        if (dev.get_dev_string () == spec) {
+            return std::make_unique<auOutputDevice> (dev);
+        }
+    }
+    spdlog::error ("No output sink matches {}", spec);
+    return nullptr;
+}
+
 std::vector<auInputDevice> auDeviceManager::get_input_devices () {
-    std::vector<auInputDevice> input_devices;
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (scanned) return input_devices;
+    }
+    scan ();
+    std::lock_guard<std::mutex> lock (mutex);
+    return input_devices;
+}
 
-    input_devices.emplace_back (0, 0, "pulse", "pulse", "pulse");
+auDeviceManager::~auDeviceManager () { stop_watching (); }
 
-    int card_number = -1;
-    int err;
+void auDeviceManager::start_watching () {
+    if (watcher.joinable ()) return;
 
-    if (snd_card_next (&card_number) < 0) {
-        spdlog::warn ("No sound cards found!");
-        return input_devices;
+    wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        spdlog::error ("Failed to create device watcher eventfd: {}",
+                       strerror (errno));
+        return;
     }
+    watcher = std::thread (&auDeviceManager::watch, this);
+}
 
-    while (card_number >= 0) {
-        snd_ctl_t           *ctl;
-        snd_ctl_card_info_t *info;
-        snd_ctl_card_info_alloca (&info);
+void auDeviceManager::stop_watching () {
+    if (!watcher.joinable ()) return;
 
+    uint64_t one = 1;
+    if (write (wake_fd, &one, sizeof (one)) < 0) {
+        spdlog::warn ("Failed to wake device watcher: {}", strerror (errno));
+    }
+    watcher.join ();
+    close (wake_fd);
+    wake_fd = -1;
+}
+
+// blocks until a card appears, disappears or reports a removed control
+// element, returns false when asked to stop
+static bool wait_for_change (int wake_fd, int inotify_fd) {
+    std::vector<snd_ctl_t *> ctls;
+    std::vector<pollfd>      fds;
+    fds.push_back ({ wake_fd, POLLIN, 0 });
+    if (inotify_fd >= 0) fds.push_back ({ inotify_fd, POLLIN, 0 });
+    size_t ctl_start = fds.size ();
+
+    int card_number = -1;
+    while (snd_card_next (&card_number) == 0 && card_number >= 0) {
         char card_id[32];
         snprintf (card_id, sizeof (card_id), "hw:%d", card_number);
-        spdlog::info ("Trying to open card {}", card_id);
 
-        if ((err = snd_ctl_open (&ctl, card_id, 0)) < 0) {
-            spdlog::warn ("Failed to open card {}: {}", card_id,
-                          snd_strerror (err));
-            if (snd_card_next (&card_number) < 0) break;
+        snd_ctl_t *ctl;
+        if (snd_ctl_open (&ctl, card_id, SND_CTL_NONBLOCK) < 0) continue;
+        if (snd_ctl_subscribe_events (ctl, 1) < 0
+            || snd_ctl_poll_descriptors_count (ctl) != 1) {
+            snd_ctl_close (ctl);
+            continue;
         }
+        pollfd pfd;
+        snd_ctl_poll_descriptors (ctl, &pfd, 1);
+        ctls.push_back (ctl);
+        fds.push_back (pfd);
+    }
 
-        if ((err = snd_ctl_card_info (ctl, info)) < 0) {
-            spdlog::warn ("Failed to get card info for {}: {}", card_id,
-                          snd_strerror (err));
-            if (snd_card_next (&card_number) < 0) break;
+    bool keep_going = true;
+    bool changed    = false;
+    while (!changed) {
+        if (poll (fds.data (), fds.size (), -1) < 0) {
+            if (errno == EINTR) continue;
+            spdlog::error ("Device watcher poll failed: {}",
+                           strerror (errno));
+            keep_going = false;
+            break;
+        }
+        if (fds[0].revents) {
+            keep_going = false;
+            break;
+        }
+        if (inotify_fd >= 0 && fds[1].revents) {
+            char buf[4096];
+            while (read (inotify_fd, buf, sizeof (buf)) > 0) {}
+            changed = true;
         }
 
-        std::string card_name_str = snd_ctl_card_info_get_name (info);
-
-        int dev_num = -1;
-        while (true) {
-            if (snd_ctl_pcm_next_device (ctl, &dev_num) < 0) {
-                spdlog::warn ("Failed to get next device for card {}: {}",
-                              card_id, snd_strerror (err));
-                break;
+        snd_ctl_event_t *event;
+        snd_ctl_event_alloca (&event);
+        for (size_t i = 0; i < ctls.size (); i++) {
+            pollfd &pfd = fds[ctl_start + i];
+            if (!pfd.revents) continue;
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                changed = true; // card unplugged
+                continue;
             }
+            // value changes(volume and friends) dont change the device list
+            while (snd_ctl_read (ctls[i], event) > 0) {
+                if (snd_ctl_event_elem_get_mask (event)
+                    == SND_CTL_EVENT_MASK_REMOVE) {
+                    changed = true;
+                }
+            }
+        }
+    }
 
-            if (dev_num < 0) break;
-
-            snd_pcm_info_t *pcminfo;
-            snd_pcm_info_alloca (&pcminfo);
-            snd_pcm_info_set_device (pcminfo, dev_num);
-            snd_pcm_info_set_subdevice (pcminfo, 0);
-            snd_pcm_info_set_stream (pcminfo, SND_PCM_STREAM_CAPTURE);
-
-            if ((err = snd_ctl_pcm_info (ctl, pcminfo)) < 0) { continue; }
-
-            std::string device_name_str = snd_pcm_info_get_name (pcminfo);
+    for (snd_ctl_t *ctl : ctls) snd_ctl_close (ctl);
+    return keep_going;
+}
 
-            std::string device_string
-                = fmt::format ("hw:{},{}", card_number, dev_num);
+void auDeviceManager::watch () {
+    int inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0
+        && inotify_add_watch (inotify_fd, "/dev/snd", IN_CREATE | IN_DELETE)
+               < 0) {
+        spdlog::warn ("Cannot watch /dev/snd for new cards: {}",
+                      strerror (errno));
+        close (inotify_fd);
+        inotify_fd = -1;
+    }
 
-            input_devices.emplace_back (card_number, dev_num, card_name_str,
-                                        device_name_str, device_string);
+    while (wait_for_change (wake_fd, inotify_fd)) {
+        // udev creates a card's nodes one by one, let it settle
+        pollfd pfd = { wake_fd, POLLIN, 0 };
+        if (poll (&pfd, 1, 250) > 0) break;
+        if (inotify_fd >= 0) {
+            char buf[4096];
+            while (read (inotify_fd, buf, sizeof (buf)) > 0) {}
         }
-
-        if (snd_card_next (&card_number) < 0) break;
-
-        snd_ctl_close (ctl);
+        spdlog::info ("Sound devices changed, rescanning");
+        scan ();
     }
-    return input_devices;
-}
+
+    if (inotify_fd >= 0) close (inotify_fd);
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <io/Drift.hpp>
+#include <util/time.h>
+
+void auDriftTracker::reset (unsigned int nominal_rate, size_t period_frames,
+                            double bandwidth) {
+    this->nominal_rate = nominal_rate;
+    period             = double (period_frames);
+
+    // critically damped: b = sqrt(2) w, c = w^2
+    double omega = 2 * M_PI * bandwidth * (period / nominal_rate);
+    b            = M_SQRT2 * omega;
+    c            = omega * omega;
+
+    started      = false;
+    ns_per_frame = 1e9 / nominal_rate;
+    rate.store (nominal_rate, std::memory_order_relaxed);
+}
+
+void auDriftTracker::update (uint64_t time_ns, uint64_t position) {
+    if (!started || position < last_position) {
+        // first period or the stream restarted after an xrun
+        started       = true;
+        last_position = position;
+        t_pred        = double (time_ns);
+        return;
+    }
+
+    double advanced = double (position - last_position);
+    last_position   = position;
+    if (advanced == 0) return;
+
+    t_pred   += ns_per_frame * advanced;
+    double e  = double (time_ns) - t_pred;
+
+    // an error of more than a buffer means the clock jumped, start over
+    if (std::fabs (e) > ns_per_frame * period * 8) {
+        t_pred = double (time_ns);
+        return;
+    }
+
+    t_pred       += b * e;
+    ns_per_frame += c * e / period;
+    rate.store (1e9 / ns_per_frame, std::memory_order_relaxed);
+}
+
+uint64_t auDriftTracker::get_time_ns (uint64_t position) const {
+    if (!started) return 0;
+    double t = t_pred
+               + (double (position) - double (last_position)) * ns_per_frame;
+    return t > 0 ? uint64_t (t) : 0;
+}
+
+int auDriftTracker::update (snd_pcm_t *handle, snd_pcm_stream_t stream,
+                            uint64_t transferred) {
+    snd_pcm_sframes_t delay;
+    int               err = snd_pcm_delay (handle, &delay);
+    uint64_t          now = au_now_ns ();
+    if (err < 0) return err;
+
+    // playback still holds `delay` unplayed frames, capture has `delay`
+    // frames the application did not read yet
+    uint64_t position = stream == SND_PCM_STREAM_PLAYBACK
+                            ? transferred - uint64_t (delay)
+                            : transferred + uint64_t (delay);
+    update (now, position);
+    return 0;
+}
+
+auDriftResampler::auDriftResampler (unsigned int channels) :
+    channels (channels), history (3 * channels, 0.f) {}
+
+void auDriftResampler::set_ratio (double input_per_output) {
+    if (input_per_output < 0.5) input_per_output = 0.5;
+    if (input_per_output > 2.0) input_per_output = 2.0;
+    step.store (input_per_output, std::memory_order_relaxed);
+}
+
+void auDriftResampler::reset () {
+    std::fill (history.begin (), history.end (), 0.f);
+    index = 0;
+    frac  = 0;
+}
+
+size_t auDriftResampler::process (const float *in, size_t in_frames,
+                                  float *out, size_t max_out) {
+    // the input is seen as the 3 history frames followed by `in`
+    auto frame = [&] (size_t k) -> const float * {
+        return k < 3 ? &history[k * channels] : &in[(k - 3) * channels];
+    };
+
+    double s     = step.load (std::memory_order_relaxed);
+    size_t last  = in_frames + 2;
+    size_t count = 0;
+    while (count < max_out && index + 3 <= last) {
+        const float *x0 = frame (index), *x1 = frame (index + 1),
+                    *x2 = frame (index + 2), *x3 = frame (index + 3);
+        float        t  = float (frac);
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            float c1 = 0.5f * (x2[ch] - x0[ch]);
+            float c2 = x0[ch] - 2.5f * x1[ch] + 2.f * x2[ch] - 0.5f * x3[ch];
+            float c3 = 0.5f * (x3[ch] - x0[ch]) + 1.5f * (x1[ch] - x2[ch]);
+            out[count * channels + ch] = ((c3 * t + c2) * t + c1) * t + x1[ch];
+        }
+        count++;
+
+        frac        += s;
+        double whole = std::floor (frac);
+        index       += size_t (whole);
+        frac        -= whole;
+    }
+
+    // keep the last 3 frames, the next block continues from them. `index`
+    // only stays below `in_frames` if `max_out` was too small, those frames
+    // are lost
+    if (in_frames >= 3) {
+        std::copy (in + (in_frames - 3) * channels, in + in_frames * channels,
+                   history.begin ());
+    } else if (in_frames > 0) {
+        size_t keep = 3 - in_frames;
+        std::copy (history.begin () + in_frames * channels, history.end (),
+                   history.begin ());
+        std::copy (in, in + in_frames * channels,
+                   history.begin () + keep * channels);
+    }
+    index = index > in_frames ? index - in_frames : 0;
+    return count;
+}
+
+void auClockLock::update (size_t fill_frames) {
+    double base = input.get_rate () / output.get_rate ();
+
+    // more than the target queued means the consumer is slower than the
+    // rates say, produce a little less. the correction is capped at 0.1%
+    double error      = (double (fill_frames) - target_fill) / target_fill;
+    double correction = gain * error;
+    if (correction > 0.001) correction = 0.001;
+    if (correction < -0.001) correction = -0.001;
+
+    resampler.set_ratio (base * (1.0 + correction));
+}
@@ -0,0 +1,318 @@
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <io/Duplex.hpp>
+#include <util/RtAlloc.hpp>
+#include <util/time.h>
+
+static snd_pcm_sframes_t read_frames (snd_pcm_t *handle, auAccessMode access,
+                                      void *buf, snd_pcm_uframes_t frames) {
+    if (access == auAccessMmapInterleaved) {
+        return snd_pcm_mmap_readi (handle, buf, frames);
+    }
+    return snd_pcm_readi (handle, buf, frames);
+}
+
+static snd_pcm_sframes_t write_frames (snd_pcm_t *handle, auAccessMode access,
+                                       const void       *buf,
+                                       snd_pcm_uframes_t frames) {
+    if (access == auAccessMmapInterleaved) {
+        return snd_pcm_mmap_writei (handle, buf, frames);
+    }
+    return snd_pcm_writei (handle, buf, frames);
+}
+
+auDuplexStream::~auDuplexStream () {
+    stop ();
+    if (linked) { snd_pcm_unlink (input.handle); }
+}
+
+int auDuplexStream::open (auSFormat in_format, auSFormat out_format,
+                          auStreamParams params) {
+    int err;
+
+    if (in_format.sample_rate != out_format.sample_rate) {
+        spdlog::error ("Duplex streams need one sample rate({} != {})!",
+                       in_format.sample_rate, out_format.sample_rate);
+        return -EINVAL;
+    }
+    if (params.access == auAccessMmapPlanar) {
+        params.access = auAccessMmapInterleaved;
+    }
+
+    snd_pcm_t *in_handle, *out_handle;
+    if ((err = input.open_stream (&in_handle, in_format, params)) < 0) {
+        return err;
+    }
+    if ((err = output.open_stream (&out_handle, out_format, params)) < 0) {
+        snd_pcm_close (in_handle);
+        input.handle = nullptr;
+        return err;
+    }
+
+    const auStreamConfig &in_config  = input.get_stream_config ();
+    const auStreamConfig &out_config = output.get_stream_config ();
+    if (in_config.period_size != out_config.period_size
+        || in_config.access == auAccessMmapPlanar
+        || out_config.access == auAccessMmapPlanar) {
+        spdlog::error ("{} and {} could not agree on a period layout({} vs {} "
+                       "frames)",
+                       input.get_dev_string (), output.get_dev_string (),
+                       in_config.period_size, out_config.period_size);
+        snd_pcm_close (in_handle);
+        snd_pcm_close (out_handle);
+        input.handle  = nullptr;
+        output.handle = nullptr;
+        return -EINVAL;
+    }
+
+    if ((err = snd_pcm_link (in_handle, out_handle)) < 0) {
+        spdlog::warn ("Could not link {} and {}, resampling capture to the "
+                      "playback clock: {}",
+                      input.get_dev_string (), output.get_dev_string (),
+                      snd_strerror (err));
+        linked = false;
+    } else {
+        linked = true;
+    }
+
+    period_size = in_config.period_size;
+    period_ns = (uint64_t (period_size) * 1000000000) / in_config.sample_rate;
+    in_buf.assign (snd_pcm_frames_to_bytes (in_handle, period_size), 0);
+    out_buf.assign (snd_pcm_frames_to_bytes (out_handle, period_size), 0);
+
+    resampler.reset ();
+    clock_lock.reset ();
+    ring.reset ();
+    if (!linked) {
+        unsigned int channels = in_format.channels;
+        this->in_format       = in_format;
+        resampler  = std::make_unique<auDriftResampler> (channels);
+        clock_lock = std::make_unique<auClockLock> (
+            in_tracker, out_tracker, *resampler, 2 * period_size);
+        ring = std::make_unique<auSpscRing<float>> (8 * period_size
+                                                    * channels);
+        capture_buf.assign (in_buf.size (), 0);
+        capture_float.assign (period_size * channels, 0.f);
+        // room for the lowest ratio the resampler allows
+        resampled.assign ((2 * period_size + 2) * channels, 0.f);
+        period_float.assign (period_size * channels, 0.f);
+    }
+
+    spdlog::info ("Duplex stream {} -> {} opened, nominal round trip {} us",
+                  input.get_dev_string (), output.get_dev_string (),
+                  get_nominal_round_trip_us ());
+    return 0;
+}
+
+uint32_t auDuplexStream::get_nominal_round_trip_us () const {
+    const auStreamConfig &out_config = output.get_stream_config ();
+    if (!out_config.sample_rate) { return 0; }
+    return uint32_t ((uint64_t (period_size + out_config.buffer_size)
+                      * 1000000)
+                     / out_config.sample_rate);
+}
+
+uint32_t auDuplexStream::get_round_trip_us () const {
+    const auStreamConfig &out_config = output.get_stream_config ();
+    if (!out_config.sample_rate) { return 0; }
+    return uint32_t ((uint64_t (round_trip_frames.load ()) * 1000000)
+                     / out_config.sample_rate);
+}
+
+int auDuplexStream::start (auEngineParams params) {
+    if (thread.joinable ()) { return 0; }
+    if (!input.handle || !output.handle) {
+        spdlog::error ("Duplex stream wasnt opened yet!");
+        return -1;
+    }
+
+    last_error = 0;
+    running    = true;
+    thread     = std::thread (&auDuplexStream::run, this);
+    au_make_realtime (thread, params);
+    return 0;
+}
+
+void auDuplexStream::stop () {
+    running = false;
+    if (!thread.joinable ()) { return; }
+    thread.join ();
+    snd_pcm_drop (input.handle);
+    if (!linked) { snd_pcm_drop (output.handle); }
+}
+
+// brings both streams back to a known state: prepared, playback queued with
+// all but one period of silence, then started together
+int auDuplexStream::restart () {
+    int err;
+
+    snd_pcm_drop (input.handle);
+    if (!linked) { snd_pcm_drop (output.handle); }
+
+    if ((err = snd_pcm_prepare (input.handle)) < 0) { return err; }
+    if ((err = snd_pcm_prepare (output.handle)) < 0) { return err; }
+
+    const auStreamConfig &out_config = output.get_stream_config ();
+    if ((err = au_pcm_prefill (output.handle,
+                               out_config.buffer_size - period_size,
+                               out_config, output.silence.data ()))
+        < 0) {
+        return err;
+    }
+    // both clocks start over with the streams, the prefill counts as written
+    in_transferred  = 0;
+    out_transferred = out_config.buffer_size - period_size;
+    in_tracker.reset (input.get_stream_config ().sample_rate, period_size);
+    out_tracker.reset (out_config.sample_rate, period_size);
+
+    if (resampler) {
+        // the ring starts at the level the lock holds it at
+        resampler->reset ();
+        resampler->set_ratio (1.0);
+        ring->discard ();
+        std::fill (period_float.begin (), period_float.end (), 0.f);
+        for (int i = 0; i < 2; i++) {
+            ring->write (period_float.data (), period_float.size ());
+        }
+    }
+
+    if ((err = snd_pcm_start (input.handle)) < 0) { return err; }
+    if (!linked && (err = snd_pcm_start (output.handle)) < 0) { return err; }
+    return 0;
+}
+
+bool auDuplexStream::recover (int err) {
+    if (err == -EPIPE || err == -ESTRPIPE) {
+        // an xrun on one side desyncs both, restart the pair
+        if (err == -EPIPE) {
+            output.stats->xruns.fetch_add (1, std::memory_order_relaxed);
+        }
+        if ((err = restart ()) == 0) { return true; }
+    }
+    last_error = err;
+    running    = false;
+    return false;
+}
+
+// reads a whole period, linked capture runs on the playback clock
+snd_pcm_sframes_t auDuplexStream::capture_linked (snd_pcm_t   *handle,
+                                                  auAccessMode access) {
+    size_t done = 0;
+    while (done < period_size) {
+        snd_pcm_sframes_t n = read_frames (
+            handle, access,
+            in_buf.data () + snd_pcm_frames_to_bytes (handle, done),
+            period_size - done);
+        if (n < 0) return n;
+        done += n;
+    }
+    in_transferred += period_size;
+    if (in_tracker.update (handle, SND_PCM_STREAM_CAPTURE, in_transferred)
+        == 0) {
+        clock.publish (in_tracker.get_time_ns (in_transferred));
+    }
+    return 0;
+}
+
+// drains what the capture device has without blocking, resampled into the
+// ring, then takes one period out of it for the callback
+snd_pcm_sframes_t auDuplexStream::capture_resampled (snd_pcm_t   *handle,
+                                                     auAccessMode access) {
+    unsigned int channels = in_format.channels;
+    auSFormat    planar (in_format.sample_rate, 32, channels, auDtype::sFloat);
+
+    while (true) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (handle);
+        if (avail < 0) return avail;
+        if (avail == 0) break;
+
+        size_t            want = std::min<size_t> (avail, period_size);
+        snd_pcm_sframes_t n
+            = read_frames (handle, access, capture_buf.data (), want);
+        if (n < 0) return n;
+        if (n == 0) break;
+        in_transferred += n;
+
+        au_convert_buffer (in_format, planar, capture_buf.data (),
+                           snd_pcm_frames_to_bytes (handle, n),
+                           reinterpret_cast<char *> (capture_float.data ()));
+        size_t out = resampler->process (
+            capture_float.data (), n, resampled.data (),
+            resampled.size () / channels);
+        ring->write (resampled.data (), out * channels);
+    }
+    if (in_tracker.update (handle, SND_PCM_STREAM_CAPTURE, in_transferred)
+        == 0) {
+        clock.publish (in_tracker.get_time_ns (in_transferred));
+    }
+
+    size_t got = ring->read (period_float.data (), period_float.size ());
+    if (got < period_float.size ()) {
+        ring_underruns.fetch_add (1, std::memory_order_relaxed);
+        std::fill (period_float.begin () + got, period_float.end (), 0.f);
+    }
+    clock_lock->update (ring->get_read_available () / channels);
+
+    au_convert_buffer (planar, in_format,
+                       reinterpret_cast<char *> (period_float.data ()),
+                       period_float.size () * sizeof (float), in_buf.data ());
+    return 0;
+}
+
+void auDuplexStream::run () {
+    auRtScope rt;
+
+    snd_pcm_t   *in_handle  = input.handle;
+    snd_pcm_t   *out_handle = output.handle;
+    auAccessMode in_access  = input.get_stream_config ().access;
+    auAccessMode out_access = output.get_stream_config ().access;
+
+    auStreamStats *stats = output.stats.get ();
+
+    int err;
+    if ((err = restart ()) < 0) {
+        last_error = err;
+        running    = false;
+        return;
+    }
+
+    while (running.load (std::memory_order_relaxed)) {
+        // unlinked, the blocking playback write below paces the loop
+        snd_pcm_sframes_t n = linked ? capture_linked (in_handle, in_access)
+                                     : capture_resampled (in_handle,
+                                                          in_access);
+        if (n < 0) {
+            if (!recover (n)) return;
+            continue;
+        }
+
+        uint64_t start = au_now_ns ();
+        callback->process (in_buf.data (), out_buf.data (), period_size);
+        stats->record_callback (au_now_ns () - start, period_ns);
+
+        size_t done = 0;
+        while (done < period_size) {
+            n = write_frames (
+                out_handle, out_access,
+                out_buf.data () + snd_pcm_frames_to_bytes (out_handle, done),
+                period_size - done);
+            if (n < 0) break;
+            done += n;
+        }
+        if (n < 0) {
+            if (!recover (n)) return;
+            continue;
+        }
+        out_transferred += period_size;
+        out_tracker.update (out_handle, SND_PCM_STREAM_PLAYBACK,
+                            out_transferred);
+
+        snd_pcm_sframes_t in_delay, out_delay;
+        if (snd_pcm_delay (in_handle, &in_delay) == 0
+            && snd_pcm_delay (out_handle, &out_delay) == 0) {
+            round_trip_frames.store (uint32_t (in_delay + out_delay
+                                               + period_size),
+                                     std::memory_order_relaxed);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "spdlog/spdlog.h"
+#include <io/IoLoop.hpp>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <util/RtAlloc.hpp>
+#include <util/time.h>
+
+auIoLoop::~auIoLoop () {
+    stop ();
+    if (wake_fd >= 0) close (wake_fd);
+}
+
+static int prepare_stream (auIoStream &s, const std::string &dev_str) {
+    int err;
+    if (!s.handle) {
+        spdlog::error ("Device {} wasnt opened yet!", dev_str);
+        return -1;
+    }
+    if (s.config->access == auAccessMmapPlanar
+        && !(s.render && s.render->has_planar ())) {
+        spdlog::error ("Device {} is planar, the io loop only moves "
+                       "interleaved frames!",
+                       dev_str);
+        return -EINVAL;
+    }
+    if ((err = snd_pcm_nonblock (s.handle, 1)) < 0) {
+        spdlog::error ("Failed to make {} non-blocking: {}", dev_str,
+                       snd_strerror (err));
+        return err;
+    }
+
+    s.buf.assign (snd_pcm_frames_to_bytes (s.handle, s.config->period_size),
+                  0);
+    s.period_ns = (uint64_t (s.config->period_size) * 1000000000)
+                  / s.config->sample_rate;
+    return 0;
+}
+
+int auIoLoop::add_output (auOutputDevice &device, auRenderCallback *callback) {
+    if (thread.joinable ()) { return -EBUSY; }
+
+    auIoStream s;
+    s.handle  = device.handle;
+    s.stream  = SND_PCM_STREAM_PLAYBACK;
+    s.config  = &device.config;
+    s.stats   = device.stats.get ();
+    s.silence = device.silence.data ();
+    s.render  = callback;
+
+    int err;
+    if ((err = prepare_stream (s, device.get_dev_string ())) < 0) return err;
+    streams.push_back (std::move (s));
+    return 0;
+}
+
+int auIoLoop::add_input (auInputDevice &device, auCaptureCallback *callback) {
+    if (thread.joinable ()) { return -EBUSY; }
+
+    auIoStream s;
+    s.handle  = device.handle;
+    s.stream  = SND_PCM_STREAM_CAPTURE;
+    s.config  = &device.config;
+    s.stats   = device.stats.get ();
+    s.capture = callback;
+
+    int err;
+    if ((err = prepare_stream (s, device.get_dev_string ())) < 0) return err;
+    streams.push_back (std::move (s));
+    return 0;
+}
+
+int auIoLoop::start (auEngineParams params) {
+    if (thread.joinable ()) { return 0; }
+    if (streams.empty ()) {
+        spdlog::error ("IO loop has no streams to run!");
+        return -1;
+    }
+
+    if (wake_fd < 0
+        && (wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        spdlog::error ("Failed to create io loop eventfd: {}",
+                       strerror (errno));
+        return -errno;
+    }
+
+    // slot 0 is the wakeup fd, then every stream's descriptors in order
+    fds.assign (1, { wake_fd, POLLIN, 0 });
+    for (auIoStream &s : streams) {
+        int count = snd_pcm_poll_descriptors_count (s.handle);
+        if (count <= 0) {
+            spdlog::error ("Stream has no poll descriptors!");
+            return -EINVAL;
+        }
+        s.fd_offset = fds.size ();
+        s.fd_count  = count;
+        s.failed    = false;
+        fds.resize (fds.size () + count);
+        snd_pcm_poll_descriptors (s.handle, &fds[s.fd_offset], count);
+    }
+
+    last_error = 0;
+    running    = true;
+    thread     = std::thread (&auIoLoop::run, this);
+    au_make_realtime (thread, params);
+
+    spdlog::info ("IO loop started with {} streams on one thread",
+                  streams.size ());
+    return 0;
+}
+
+void auIoLoop::stop () {
+    running = false;
+    if (!thread.joinable ()) { return; }
+
+    uint64_t one = 1;
+    if (write (wake_fd, &one, sizeof (one)) < 0) {
+        spdlog::warn ("Failed to wake io loop: {}", strerror (errno));
+    }
+    thread.join ();
+
+    // reset the eventfd for the next start, it is non-blocking
+    uint64_t count;
+    if (read (wake_fd, &count, sizeof (count)) < 0) { count = 0; }
+
+    for (auIoStream &s : streams) {
+        snd_pcm_drop (s.handle);
+        snd_pcm_prepare (s.handle);
+    }
+}
+
+bool auIoLoop::recover (auIoStream &s, int err) {
+    if ((err = au_pcm_recover (s.handle, err, s.stream, *s.config, s.stats,
+                               s.silence))
+        < 0) {
+        last_error = err;
+        s.failed   = true;
+        // stop polling it, poll ignores negative fds
+        for (unsigned int i = 0; i < s.fd_count; i++) {
+            fds[s.fd_offset + i].fd = -1;
+        }
+        return false;
+    }
+    // capture streams only wake poll once they run
+    if (s.stream == SND_PCM_STREAM_CAPTURE
+        && snd_pcm_state (s.handle) == SND_PCM_STATE_PREPARED) {
+        snd_pcm_start (s.handle);
+    }
+    return true;
+}
+
+bool auIoLoop::service_playback (auIoStream &s) {
+    snd_pcm_uframes_t period = s.config->period_size;
+
+    while (true) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (s.handle);
+        if (avail < 0) return recover (s, avail);
+        if (snd_pcm_uframes_t (avail) < period) break;
+
+        uint64_t start = au_now_ns ();
+        if (s.config->access == auAccessRw) {
+            s.render->process (s.buf.data (), period);
+            snd_pcm_sframes_t written
+                = snd_pcm_writei (s.handle, s.buf.data (), period);
+            if (written < 0) return recover (s, written);
+            if (snd_pcm_uframes_t (written) < period) {
+                s.stats->short_transfers.fetch_add (
+                    1, std::memory_order_relaxed);
+            }
+        } else {
+            auMmapWindow      window;
+            snd_pcm_uframes_t left = period;
+            while (left > 0) {
+                int err = au_mmap_begin (s.handle, *s.config, left, &window);
+                if (err < 0) return recover (s, err);
+                if (window.interleaved) {
+                    s.render->process (window.interleaved, window.frames);
+                } else {
+                    s.render->process_planar (window.channels,
+                                              window.frames);
+                }
+                if ((err = au_mmap_commit (s.handle, window)) < 0) {
+                    return recover (s, err);
+                }
+                left -= window.frames;
+            }
+        }
+        s.stats->record_callback (au_now_ns () - start, s.period_ns);
+    }
+
+    // mmap streams do not start on their own
+    if (s.config->access != auAccessRw
+        && snd_pcm_state (s.handle) == SND_PCM_STATE_PREPARED) {
+        int err = snd_pcm_start (s.handle);
+        if (err < 0) return recover (s, err);
+    }
+    return true;
+}
+
+bool auIoLoop::service_capture (auIoStream &s) {
+    snd_pcm_uframes_t period = s.config->period_size;
+
+    while (true) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (s.handle);
+        if (avail < 0) return recover (s, avail);
+        if (snd_pcm_uframes_t (avail) < period) break;
+
+        uint64_t          start = au_now_ns ();
+        snd_pcm_sframes_t read
+            = s.config->access == auAccessRw
+                  ? snd_pcm_readi (s.handle, s.buf.data (), period)
+                  : snd_pcm_mmap_readi (s.handle, s.buf.data (), period);
+        if (read < 0) return recover (s, read);
+        if (snd_pcm_uframes_t (read) < period) {
+            s.stats->short_transfers.fetch_add (1, std::memory_order_relaxed);
+        }
+        s.capture->process (s.buf.data (), read);
+        s.stats->record_callback (au_now_ns () - start, s.period_ns);
+    }
+    return true;
+}
+
+void auIoLoop::run () {
+    auRtScope rt;
+
+    for (auIoStream &s : streams) {
+        if (s.stream == SND_PCM_STREAM_CAPTURE) {
+            int err = snd_pcm_start (s.handle);
+            if (err < 0) recover (s, err);
+        } else {
+            service_playback (s); // fill the buffer, rw streams auto-start
+        }
+    }
+
+    while (running.load (std::memory_order_relaxed)) {
+        if (poll (fds.data (), fds.size (), 1000) < 0) {
+            if (errno == EINTR) continue;
+            last_error = -errno;
+            break;
+        }
+        if (fds[0].revents) break;
+
+        for (auIoStream &s : streams) {
+            if (s.failed) continue;
+
+            unsigned short revents = 0;
+            snd_pcm_poll_descriptors_revents (s.handle, &fds[s.fd_offset],
+                                              s.fd_count, &revents);
+            if (revents & POLLERR) {
+                recover (s, snd_pcm_state (s.handle) == SND_PCM_STATE_XRUN
+                                ? -EPIPE
+                                : -ESTRPIPE);
+                continue;
+            }
+            if (s.stream == SND_PCM_STREAM_PLAYBACK && (revents & POLLOUT)) {
+                service_playback (s);
+            } else if (s.stream == SND_PCM_STREAM_CAPTURE
+                       && (revents & POLLIN)) {
+                service_capture (s);
+            }
+        }
+    }
+    running = false;
+}
\ No newline at end of file
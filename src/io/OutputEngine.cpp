@@ -0,0 +1,272 @@
+#include "spdlog/spdlog.h"
+#include <cstring>
+#include <io/OutputEngine.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <util/RtAlloc.hpp>
+#include <util/time.h>
+
+auRingSource::auRingSource (auSFormat s_format, size_t capacity_frames) :
+    ring (capacity_frames * ((s_format.bit_depth * s_format.channels) / 8)),
+    s_format (s_format),
+    frame_size ((s_format.bit_depth * s_format.channels) / 8) {}
+
+size_t auRingSource::write (const void *data, size_t frames) {
+    size_t room = ring.get_write_available () / frame_size;
+    if (frames > room) frames = room;
+    ring.write (static_cast<const char *> (data), frames * frame_size);
+    return frames;
+}
+
+void auRingSource::process (void *out, size_t frames) {
+    size_t avail = ring.get_read_available () / frame_size;
+    size_t got   = frames < avail ? frames : avail;
+    ring.read (static_cast<char *> (out), got * frame_size);
+
+    if (got < frames) {
+        underflows++;
+        snd_pcm_format_set_silence (
+            sformat_to_pcm_format (s_format),
+            static_cast<char *> (out) + got * frame_size,
+            (frames - got) * s_format.channels);
+    }
+}
+
+int au_make_realtime (std::thread &thread, auEngineParams params) {
+    int ret = 0;
+
+    sched_param sp {};
+    sp.sched_priority = params.priority;
+    int err = pthread_setschedparam (thread.native_handle (), SCHED_FIFO, &sp);
+    if (err) {
+        spdlog::warn ("Could not switch audio thread to SCHED_FIFO {}: {}",
+                      params.priority, strerror (err));
+        ret = -err;
+    }
+
+    if (params.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO (&set);
+        CPU_SET (params.cpu, &set);
+        err = pthread_setaffinity_np (thread.native_handle (), sizeof (set),
+                                      &set);
+        if (err) {
+            spdlog::warn ("Could not pin audio thread to cpu {}: {}",
+                          params.cpu, strerror (err));
+            ret = -err;
+        }
+    }
+    return ret;
+}
+
+auOutputEngine::~auOutputEngine () { stop (); }
+
+int auOutputEngine::start (auEngineParams params) {
+    if (thread.joinable ()) { return 0; }
+    if (!sink.is_open () || (device && !device->handle)) {
+        spdlog::error ("Output sink {} wasnt opened yet!",
+                       sink.get_sink_name ());
+        return -1;
+    }
+
+    const auStreamConfig &config = sink.get_stream_config ();
+    if (config.access == auAccessMmapPlanar && !callback->has_planar ()) {
+        spdlog::error ("Stream on {} is planar but the callback can only "
+                       "render interleaved frames!",
+                       sink.get_sink_name ());
+        return -1;
+    }
+
+    // everything the real-time loop touches is allocated here
+    period_size = config.period_size;
+    buffer_size = config.buffer_size;
+    frame_size  = (snd_pcm_format_physical_width (config.format) / 8)
+                 * config.channels;
+    period_buf.assign (period_size * frame_size, 0);
+    period_ns  = (uint64_t (period_size) * 1000000000) / config.sample_rate;
+    last_error = 0;
+
+    running = true;
+    thread  = std::thread (&auOutputEngine::run, this);
+
+    au_make_realtime (thread, params);
+
+    spdlog::info ("Output engine started on {} with {} frame periods",
+                  sink.get_sink_name (), period_size);
+    return 0;
+}
+
+void auOutputEngine::stop () {
+    // the thread may have stopped itself on an error, still join it
+    running = false;
+    if (!thread.joinable ()) { return; }
+    thread.join ();
+    if (device) {
+        snd_pcm_drop (device->handle);
+        snd_pcm_prepare (device->handle);
+    }
+}
+
+// a fresh or recovered stream starts over at hardware position 0, with
+// whatever is queued already counted as transferred
+void auOutputEngine::reset_clock () {
+    snd_pcm_sframes_t queued = 0;
+    if (snd_pcm_delay (device->handle, &queued) < 0 || queued < 0) {
+        queued = 0;
+    }
+    transferred = uint64_t (queued);
+    tracker.reset (device->get_stream_config ().sample_rate, period_size);
+}
+
+// a period's room opens once the hardware played up to a buffer minus a
+// period behind what was written. the tracker's time for that position is
+// the wakeup without its jitter, the raw one stands in until it has one
+uint64_t auOutputEngine::block_time (uint64_t woke) const {
+    uint64_t lead = buffer_size - period_size;
+    if (transferred < lead) return woke;
+    uint64_t t = tracker.get_time_ns (transferred - lead);
+    return t ? t : woke;
+}
+
+bool auOutputEngine::recover (int err) {
+    if ((err = au_pcm_recover (device->handle, err, SND_PCM_STREAM_PLAYBACK,
+                               device->get_stream_config (),
+                               device->stats.get (),
+                               device->silence.data ()))
+        < 0) {
+        last_error = err;
+        running    = false;
+        return false;
+    }
+    reset_clock ();
+    return true;
+}
+
+void auOutputEngine::run () {
+    // stand-in sinks may write files and are not held to real-time rules
+    if (!device) {
+        run_sink ();
+        return;
+    }
+
+    auRtScope rt;
+    reset_clock ();
+    if (device->get_stream_config ().access == auAccessRw) {
+        run_rw ();
+    } else {
+        run_mmap ();
+    }
+}
+
+void auOutputEngine::run_rw () {
+    snd_pcm_t *handle = device->handle;
+    char      *buf    = period_buf.data ();
+
+    auStreamStats *stats = device->stats.get ();
+
+    while (running.load (std::memory_order_relaxed)) {
+        uint64_t start = au_now_ns ();
+        clock.publish (block_time (start));
+        callback->process (buf, period_size);
+        stats->record_callback (au_now_ns () - start, period_ns);
+
+        size_t done = 0;
+        while (done < period_size) {
+            snd_pcm_sframes_t written = snd_pcm_writei (
+                handle, buf + done * frame_size, period_size - done);
+            if (written < 0) {
+                if (!recover (written)) return;
+                continue;
+            }
+            if (size_t (written) < period_size - done) {
+                stats->short_transfers.fetch_add (1,
+                                                  std::memory_order_relaxed);
+            }
+            done        += written;
+            transferred += written;
+        }
+        tracker.update (handle, SND_PCM_STREAM_PLAYBACK, transferred);
+    }
+}
+
+// renders straight into the DMA area, period_buf stays unused
+void auOutputEngine::run_mmap () {
+    snd_pcm_t            *handle = device->handle;
+    const auStreamConfig &config = device->get_stream_config ();
+    auMmapWindow          window;
+
+    auStreamStats *stats = device->stats.get ();
+
+    while (running.load (std::memory_order_relaxed)) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (handle);
+        if (avail < 0) {
+            if (!recover (avail)) return;
+            continue;
+        }
+
+        if (snd_pcm_uframes_t (avail) < period_size) {
+            // mmap streams are never auto-started, kick it once the buffer
+            // is full
+            if (snd_pcm_state (handle) == SND_PCM_STATE_PREPARED) {
+                int err = snd_pcm_start (handle);
+                if (err < 0 && !recover (err)) return;
+                continue;
+            }
+            int err = snd_pcm_wait (handle, 1000);
+            if (err < 0 && !recover (err)) return;
+            continue;
+        }
+
+        uint64_t          start = au_now_ns ();
+        snd_pcm_uframes_t left  = period_size;
+        clock.publish (block_time (start));
+        while (left > 0) {
+            int err = au_mmap_begin (handle, config, left, &window);
+            if (err < 0) {
+                if (!recover (err)) return;
+                break;
+            }
+            if (window.interleaved) {
+                callback->process (window.interleaved, window.frames);
+            } else {
+                callback->process_planar (window.channels, window.frames);
+            }
+            if ((err = au_mmap_commit (handle, window)) < 0) {
+                if (!recover (err)) return;
+                break;
+            }
+            left        -= window.frames;
+            transferred += window.frames;
+        }
+        tracker.update (handle, SND_PCM_STREAM_PLAYBACK, transferred);
+        stats->record_callback (au_now_ns () - start, period_ns);
+    }
+}
+// stand-in sinks pace themselves inside write
+void auOutputEngine::run_sink () {
+    char *buf = period_buf.data ();
+
+    auStreamStats *stats = sink.stats.get ();
+
+    // write returns once the sink took the period, which is when the next
+    // one starts
+    transferred = 0;
+    tracker.reset (sink.get_stream_config ().sample_rate, period_size);
+
+    while (running.load (std::memory_order_relaxed)) {
+        uint64_t start = au_now_ns ();
+        uint64_t t     = tracker.get_time_ns (transferred);
+        clock.publish (t ? t : start);
+        callback->process (buf, period_size);
+        stats->record_callback (au_now_ns () - start, period_ns);
+
+        int err = sink.write (buf, period_size);
+        if (err < 0) {
+            last_error = err;
+            running    = false;
+            return;
+        }
+        transferred += period_size;
+        tracker.update (au_now_ns (), transferred);
+    }
+}
@@ -0,0 +1,199 @@
+#include "spdlog/spdlog.h"
+#include <chrono>
+#include <fcntl.h>
+#include <io/Recorder.hpp>
+#include <unistd.h>
+
+auRecordTrack::auRecordTrack (const auInputDevice &device,
+                              std::filesystem::path path, auSFormat s_format,
+                              auRecordParams params) :
+    device (device), path (std::move (path)), s_format (s_format),
+    frame_size ((s_format.bit_depth * s_format.channels) / 8),
+    ring ((uint64_t (s_format.sample_rate) * params.ring_ms / 1000)
+          * ((s_format.bit_depth * s_format.channels) / 8)),
+    batch ((uint64_t (s_format.sample_rate) * params.batch_ms / 1000)
+           * ((s_format.bit_depth * s_format.channels) / 8)) {}
+
+void auRecordTrack::process (const void *in, size_t frames) {
+    size_t room = ring.get_write_available () / frame_size;
+    size_t got  = frames < room ? frames : room;
+    ring.write (static_cast<const char *> (in), got * frame_size);
+
+    captured.fetch_add (frames, std::memory_order_relaxed);
+    if (got < frames) {
+        dropped.fetch_add (frames - got, std::memory_order_relaxed);
+    }
+}
+
+auRecorder::~auRecorder () {
+    stop ();
+    while (!tracks.empty ()) disarm (tracks.back ().get ());
+}
+
+// reserves the blocks without growing the file, the wav header still gets
+// its sizes from the write position
+static void preallocate (const std::filesystem::path &path, uint64_t bytes) {
+    int fd = open (path.c_str (), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        spdlog::warn ("Could not reopen {} to preallocate it: {}",
+                      path.string (), strerror (errno));
+        return;
+    }
+    if (fallocate (fd, FALLOC_FL_KEEP_SIZE, 0, bytes) < 0) {
+        spdlog::warn ("Could not preallocate {} bytes for {}: {}", bytes,
+                      path.string (), strerror (errno));
+    }
+    close (fd);
+}
+
+auRecordTrack *auRecorder::arm (const auInputDevice &device,
+                                auSFormat s_format, std::filesystem::path path,
+                                auStreamParams stream_params) {
+    if (recording.load () || writer.joinable ()) {
+        spdlog::error ("Cant arm {} while recording!", path.string ());
+        return nullptr;
+    }
+
+    // the capture loop only moves interleaved frames
+    if (stream_params.access == auAccessMmapPlanar) {
+        stream_params.access = auAccessMmapInterleaved;
+    }
+
+    auto track = std::make_unique<auRecordTrack> (device, std::move (path),
+                                                  s_format, params);
+    snd_pcm_t *handle;
+    if (track->device.open_stream (&handle, s_format, stream_params) < 0) {
+        return nullptr;
+    }
+
+    track->writer = std::make_unique<auFileWriter> (track->path, AudioFFWav,
+                                                    s_format);
+    if (track->writer->get_error ()) {
+        spdlog::error ("Failed to create {}!", track->path.string ());
+        snd_pcm_close (handle);
+        return nullptr;
+    }
+    if (params.preallocate_s) {
+        preallocate (track->path, uint64_t (params.preallocate_s)
+                                      * s_format.sample_rate
+                                      * track->frame_size);
+    }
+
+    spdlog::info ("Armed {} -> {}", device.get_dev_string (),
+                  track->path.string ());
+    tracks.push_back (std::move (track));
+    return tracks.back ().get ();
+}
+
+void auRecorder::disarm (auRecordTrack *track) {
+    if (recording.load () || writer.joinable ()) {
+        spdlog::error ("Cant disarm {} while recording!",
+                       track->path.string ());
+        return;
+    }
+
+    for (auto it = tracks.begin (); it != tracks.end (); it++) {
+        if (it->get () != track) continue;
+
+        // the loop still holds the stream's handle
+        loop.reset ();
+        if (track->device.handle) {
+            snd_pcm_close (track->device.handle);
+            track->device.handle = nullptr;
+        }
+        // the writer fills in the header sizes when it is destroyed
+        tracks.erase (it);
+        return;
+    }
+}
+
+int auRecorder::start (auEngineParams engine_params) {
+    if (writer.joinable ()) { return 0; }
+    if (tracks.empty ()) {
+        spdlog::error ("Nothing is armed for recording!");
+        return -1;
+    }
+
+    int err;
+    loop = std::make_unique<auIoLoop> ();
+    for (auto &track : tracks) {
+        if ((err = loop->add_input (track->device, track.get ())) < 0) {
+            loop.reset ();
+            return err;
+        }
+    }
+
+    last_error = 0;
+    recording  = true;
+    writer     = std::thread (&auRecorder::write_loop, this);
+
+    if ((err = loop->start (engine_params)) < 0) {
+        stop ();
+        return err;
+    }
+    spdlog::info ("Recording {} tracks", tracks.size ());
+    return 0;
+}
+
+void auRecorder::stop () {
+    if (loop) loop->stop ();
+
+    // the writer flushes whatever the rings still hold before it exits
+    recording = false;
+    if (writer.joinable ()) writer.join ();
+
+    if (loop && loop->get_last_error () < 0 && last_error == 0) {
+        last_error = loop->get_last_error ();
+    }
+}
+
+// writes one batch, or everything left when flushing
+bool auRecorder::drain (auRecordTrack &track, bool flush) {
+    size_t avail = track.ring.get_read_available ();
+    if (!flush && avail < track.batch.size ()) return false;
+
+    while (avail > 0) {
+        size_t chunk = avail < track.batch.size () ? avail
+                                                   : track.batch.size ();
+        chunk -= chunk % track.frame_size;
+        if (chunk == 0) break;
+
+        track.ring.read (track.batch.data (), chunk);
+        if (!track.writer->write_chunk (track.batch.data (), chunk)) {
+            spdlog::error ("Failed to write to {}!", track.path.string ());
+            last_error = -EIO;
+            return false;
+        }
+        track.written.fetch_add (chunk / track.frame_size,
+                                 std::memory_order_relaxed);
+        if (!flush) break;
+        avail = track.ring.get_read_available ();
+    }
+    return true;
+}
+
+void auRecorder::write_loop () {
+    // a quarter batch of slack so the rings never get close to full
+    auto interval = std::chrono::milliseconds (params.batch_ms / 4 + 1);
+
+    while (recording.load (std::memory_order_relaxed)) {
+        bool wrote = false;
+        for (auto &track : tracks) wrote |= drain (*track, false);
+        if (!wrote) std::this_thread::sleep_for (interval);
+    }
+
+    for (auto &track : tracks) {
+        drain (*track, true);
+        uint64_t dropped = track->dropped.load ();
+        if (dropped) {
+            spdlog::warn ("{} dropped {} frames", track->path.string (),
+                          dropped);
+        }
+    }
+}
+
+uint64_t auRecorder::get_dropped_frames () const {
+    uint64_t total = 0;
+    for (const auto &track : tracks) total += track->get_dropped_frames ();
+    return total;
+}
@@ -0,0 +1,288 @@
+#include "spdlog/spdlog.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <util/RtAlloc.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+
+// flush to zero and denormals are zero
+#define AU_FP_FLUSH 0x8040
+
+static inline uint64_t get_fp_mode () { return _mm_getcsr (); }
+static inline void set_fp_mode (uint64_t mode) { _mm_setcsr (mode); }
+#elif defined(__aarch64__)
+// FZ, aarch64 has no separate input flag
+#define AU_FP_FLUSH (1 << 24)
+
+static inline uint64_t get_fp_mode () {
+    uint64_t fpcr;
+    asm volatile ("mrs %0, fpcr" : "=r"(fpcr));
+    return fpcr;
+}
+static inline void set_fp_mode (uint64_t mode) {
+    asm volatile ("msr fpcr, %0" : : "r"(mode));
+}
+#else
+#define AU_FP_FLUSH 0
+
+static inline uint64_t get_fp_mode () { return 0; }
+static inline void     set_fp_mode (uint64_t) {}
+#endif
+
+static thread_local uint64_t saved_fp_mode = 0;
+
+void au_rt_enter () {
+    if (au_rt_thread++ == 0) {
+        saved_fp_mode = get_fp_mode ();
+        set_fp_mode (saved_fp_mode | AU_FP_FLUSH);
+    }
+}
+
+void au_rt_leave () {
+    if (--au_rt_thread == 0) set_fp_mode (saved_fp_mode);
+}
+
+auDenormalScope::auDenormalScope () : saved (get_fp_mode ()) {
+    set_fp_mode (saved | AU_FP_FLUSH);
+}
+
+auDenormalScope::~auDenormalScope () { set_fp_mode (saved); }
+
+auSlab::auSlab (size_t bytes) {
+    if (bytes == 0) return;
+
+    size_t huge_size = (bytes + AU_HUGEPAGE_SIZE - 1) & ~size_t (
+                           AU_HUGEPAGE_SIZE - 1);
+    data = mmap (nullptr, huge_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1,
+                 0);
+    if (data != MAP_FAILED) {
+        size = huge_size;
+        huge = true;
+    } else {
+        // no reserved hugepages, ask for transparent ones instead
+        size_t page = size_t (sysconf (_SC_PAGESIZE));
+        size        = (bytes + page - 1) & ~(page - 1);
+        data        = mmap (nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (data == MAP_FAILED) {
+            spdlog::error ("Failed to map a {} byte slab: {}", bytes,
+                           strerror (errno));
+            data = nullptr;
+            size = 0;
+            return;
+        }
+        madvise (data, size, MADV_HUGEPAGE);
+    }
+
+    if (mlock (data, size) < 0) {
+        spdlog::warn ("Could not lock a {} byte slab, it may page fault: {}",
+                      size, strerror (errno));
+    }
+}
+
+auSlab::~auSlab () {
+    if (data) munmap (data, size);
+}
+
+auSlab::auSlab (auSlab &&other) noexcept :
+    data (other.data), size (other.size), huge (other.huge) {
+    other.data = nullptr;
+    other.size = 0;
+}
+
+auSlab &auSlab::operator= (auSlab &&other) noexcept {
+    if (this != &other) {
+        if (data) munmap (data, size);
+        data       = other.data;
+        size       = other.size;
+        huge       = other.huge;
+        other.data = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+void *auArena::alloc (size_t bytes, size_t align) {
+    uintptr_t base  = reinterpret_cast<uintptr_t> (slab.get_data ());
+    size_t    start = ((base + offset + align - 1) & ~(align - 1)) - base;
+    if (!base || start + bytes > slab.get_size ()) {
+        failures.fetch_add (1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    offset = start + bytes;
+    if (offset > high_water) high_water = offset;
+    return reinterpret_cast<void *> (base + start);
+}
+
+auBufferPool::auBufferPool (size_t buffer_size, size_t count) :
+    slab (((buffer_size + AU_RT_ALIGN - 1) & ~size_t (AU_RT_ALIGN - 1))
+          * count),
+    buffer_size (buffer_size),
+    stride ((buffer_size + AU_RT_ALIGN - 1) & ~size_t (AU_RT_ALIGN - 1)),
+    count (slab.get_data () ? count : 0),
+    next (std::make_unique<std::atomic<uint32_t>[]> (count)) {
+    for (size_t i = 0; i < this->count; i++) {
+        next[i].store (i + 1 < this->count ? uint32_t (i + 2) : 0,
+                       std::memory_order_relaxed);
+    }
+    head      = this->count ? 1 : 0;
+    available = this->count;
+}
+
+void *auBufferPool::acquire () {
+    uint64_t h = head.load (std::memory_order_acquire);
+    while (true) {
+        uint32_t index = uint32_t (h);
+        if (index == 0) return nullptr;
+
+        // the tag changes on every pop so a recycled head fails the swap
+        uint64_t tag = (h >> 32) + 1;
+        uint64_t n   = (tag << 32)
+                     | next[index - 1].load (std::memory_order_relaxed);
+        if (head.compare_exchange_weak (h, n, std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+            available.fetch_sub (1, std::memory_order_relaxed);
+            return static_cast<char *> (slab.get_data ())
+                   + (index - 1) * stride;
+        }
+    }
+}
+
+void auBufferPool::release (void *buffer) {
+    size_t index = (static_cast<char *> (buffer)
+                    - static_cast<char *> (slab.get_data ()))
+                   / stride;
+
+    uint64_t h = head.load (std::memory_order_relaxed);
+    while (true) {
+        next[index].store (uint32_t (h), std::memory_order_relaxed);
+        uint64_t n = (h & 0xffffffff00000000ull) | uint64_t (index + 1);
+        if (head.compare_exchange_weak (h, n, std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    available.fetch_add (1, std::memory_order_relaxed);
+}
+
+#ifdef AU_RT_ALLOC_TRAP
+
+// no formatting, no allocation, straight to stderr and into the debugger
+static void rt_alloc_trap (const char *what) {
+    static const char msg[] = "real-time thread called ";
+    ssize_t           r     = write (2, msg, sizeof (msg) - 1);
+    r = write (2, what, strlen (what));
+    r = write (2, "\n", 1);
+    (void)r;
+    __builtin_trap ();
+}
+
+#define RT_CHECK(what)                                                        \
+    if (au_rt_alloc_forbidden ()) rt_alloc_trap (what)
+
+void *operator new (size_t size) {
+    RT_CHECK ("operator new");
+    if (void *p = malloc (size ? size : 1)) return p;
+    throw std::bad_alloc ();
+}
+
+void *operator new[] (size_t size) {
+    RT_CHECK ("operator new[]");
+    if (void *p = malloc (size ? size : 1)) return p;
+    throw std::bad_alloc ();
+}
+
+void *operator new (size_t size, const std::nothrow_t &) noexcept {
+    RT_CHECK ("operator new");
+    return malloc (size ? size : 1);
+}
+
+void *operator new[] (size_t size, const std::nothrow_t &) noexcept {
+    RT_CHECK ("operator new[]");
+    return malloc (size ? size : 1);
+}
+
+void *operator new (size_t size, std::align_val_t align) {
+    RT_CHECK ("operator new");
+    size_t a = size_t (align);
+    if (void *p = aligned_alloc (a, (size + a - 1) & ~(a - 1))) return p;
+    throw std::bad_alloc ();
+}
+
+void *operator new[] (size_t size, std::align_val_t align) {
+    return operator new (size, align);
+}
+
+void operator delete (void *p) noexcept {
+    if (p) RT_CHECK ("operator delete");
+    free (p);
+}
+
+void operator delete[] (void *p) noexcept { operator delete (p); }
+
+void operator delete (void *p, size_t) noexcept { operator delete (p); }
+
+void operator delete[] (void *p, size_t) noexcept { operator delete (p); }
+
+void operator delete (void *p, std::align_val_t) noexcept {
+    operator delete (p);
+}
+
+void operator delete[] (void *p, std::align_val_t) noexcept {
+    operator delete (p);
+}
+
+void operator delete (void *p, size_t, std::align_val_t) noexcept {
+    operator delete (p);
+}
+
+void operator delete[] (void *p, size_t, std::align_val_t) noexcept {
+    operator delete (p);
+}
+
+// the sanitizers bring their own malloc, only new and delete are checked
+// under them
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define AU_SANITIZED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#define AU_SANITIZED
+#endif
+#endif
+
+#ifndef AU_SANITIZED
+
+extern "C" {
+void *__libc_malloc (size_t);
+void *__libc_calloc (size_t, size_t);
+void *__libc_realloc (void *, size_t);
+void  __libc_free (void *);
+
+void *malloc (size_t size) {
+    RT_CHECK ("malloc");
+    return __libc_malloc (size);
+}
+
+void *calloc (size_t n, size_t size) {
+    RT_CHECK ("calloc");
+    return __libc_calloc (n, size);
+}
+
+void *realloc (void *p, size_t size) {
+    RT_CHECK ("realloc");
+    return __libc_realloc (p, size);
+}
+
+void free (void *p) {
+    if (p) RT_CHECK ("free");
+    __libc_free (p);
+}
+}
+
+#endif
+#endif
@@ -0,0 +1,136 @@
+#include "spdlog/spdlog.h"
+#include <io/Sink.hpp>
+#include <time.h>
+#include <util/time.h>
+
+int auNullSink::open (auSFormat s_format, auStreamParams params) {
+    snd_pcm_format_t fmt = sformat_to_pcm_format (s_format);
+    if (fmt == SND_PCM_FORMAT_UNKNOWN || !s_format.sample_rate
+        || !s_format.channels || s_format.channels > AU_MAX_CHANNELS) {
+        spdlog::error ("{} cant take {}Hz {} channel {}", get_sink_name (),
+                       s_format.sample_rate, s_format.channels,
+                       snd_pcm_format_name (fmt));
+        return -EINVAL;
+    }
+    if (!params.period_size || !params.period_count) {
+        spdlog::error ("{} needs a period size and count!", get_sink_name ());
+        return -EINVAL;
+    }
+
+    // there is no DMA area to map, everything goes through write
+    config                 = auStreamConfig ();
+    config.sample_rate     = s_format.sample_rate;
+    config.channels        = s_format.channels;
+    config.format          = fmt;
+    config.period_size     = params.period_size;
+    config.period_count    = params.period_count;
+    config.buffer_size     = params.period_size * params.period_count;
+    config.start_threshold = params.start_threshold ? params.start_threshold
+                                                    : config.buffer_size;
+    config.avail_min
+        = params.avail_min ? params.avail_min : params.period_size;
+    config.access = auAccessRw;
+    config.latency_us
+        = uint32_t ((uint64_t (config.buffer_size) * 1000000)
+                    / config.sample_rate);
+
+    frame_size = (snd_pcm_format_physical_width (fmt) / 8) * s_format.channels;
+    start_ns   = 0;
+    queued_frames  = 0;
+    frames_written = 0;
+    stats->reset ();
+
+    spdlog::info ("{} opened with {} x {} frame periods", get_sink_name (),
+                  config.period_count, config.period_size);
+    return 0;
+}
+
+void auNullSink::pace (size_t num_frames) {
+    if (clock == auClockFreewheel) return;
+
+    uint64_t now = au_now_ns ();
+    if (!start_ns) {
+        start_ns      = now;
+        queued_frames = 0;
+    }
+
+    // frames the simulated card has played since it started
+    uint64_t played
+        = ((now - start_ns) * config.sample_rate) / 1000000000;
+    if (played > queued_frames) {
+        // the writer was late and the buffer ran dry, start over like a
+        // recovered stream would
+        stats->xruns.fetch_add (1, std::memory_order_relaxed);
+        start_ns      = now;
+        queued_frames = 0;
+        played        = 0;
+    }
+
+    queued_frames += num_frames;
+    if (queued_frames <= played + config.buffer_size) return;
+
+    // wait until the new frames fit into the buffer
+    uint64_t wake = start_ns
+                    + ((queued_frames - config.buffer_size) * 1000000000)
+                          / config.sample_rate;
+    timespec ts;
+    ts.tv_sec  = wake / 1000000000;
+    ts.tv_nsec = wake % 1000000000;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)
+           == EINTR) {}
+}
+
+int auNullSink::write (const void *data, size_t num_frames) {
+    if (!is_open ()) {
+        spdlog::error ("{} wasnt opened yet!", get_sink_name ());
+        return -1;
+    }
+    pace (num_frames);
+    frames_written.fetch_add (num_frames, std::memory_order_relaxed);
+    return 0;
+}
+
+void auNullSink::close () { config = auStreamConfig (); }
+
+std::string auNullSink::get_sink_name () const {
+    return clock == auClockFreewheel ? "null:freewheel" : "null";
+}
+
+auFileSink::~auFileSink () { close (); }
+
+int auFileSink::open (auSFormat s_format, auStreamParams params) {
+    int err;
+    if ((err = auNullSink::open (s_format, params)) < 0) return err;
+
+    writer = std::make_unique<auFileWriter> (path, format, s_format);
+    if (writer->get_error ()) {
+        spdlog::error ("Failed to open {} for writing!", path.string ());
+        writer.reset ();
+        auNullSink::close ();
+        return -EIO;
+    }
+    return 0;
+}
+
+int auFileSink::write (const void *data, size_t num_frames) {
+    if (!writer) {
+        spdlog::error ("{} wasnt opened yet!", get_sink_name ());
+        return -1;
+    }
+    if (!writer->write_chunk (static_cast<const char *> (data),
+                              num_frames * frame_size)) {
+        spdlog::error ("Failed to write to {}!", path.string ());
+        return -EIO;
+    }
+    return auNullSink::write (data, num_frames);
+}
+
+void auFileSink::close () {
+    // the writer patches the header sizes when it is destroyed
+    writer.reset ();
+    auNullSink::close ();
+}
+
+std::string auFileSink::get_sink_name () const {
+    return "wav:" + path.string ();
+}
@@ -0,0 +1,207 @@
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cstring>
+#include <dlfcn.h>
+#include <plugin/Host.hpp>
+
+// plugins past this many descriptors are most likely broken
+#define AU_PLUGIN_MAX_DESCRIPTORS 1024
+
+auPluginLibrary::~auPluginLibrary () {
+    if (handle) dlclose (handle);
+}
+
+std::shared_ptr<auPluginLibrary>
+auPluginLibrary::open (std::filesystem::path path) {
+    // RTLD_NOW so missing symbols fail here and not on the real-time thread
+    void *handle = dlopen (path.c_str (), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        spdlog::error ("Failed to load plugin {}: {}", path.string (),
+                       dlerror ());
+        return nullptr;
+    }
+
+    std::shared_ptr<auPluginLibrary> lib (new auPluginLibrary ());
+    lib->handle = handle;
+    lib->path   = std::move (path);
+
+    auto entry
+        = reinterpret_cast<auPluginEntry> (dlsym (handle, AU_PLUGIN_ENTRY));
+    if (!entry) {
+        spdlog::error ("{} exports no {}", lib->path.string (),
+                       AU_PLUGIN_ENTRY);
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < AU_PLUGIN_MAX_DESCRIPTORS; i++) {
+        const auPluginDescriptor *desc = entry (i);
+        if (!desc) break;
+        if (desc->abi_version != AU_PLUGIN_ABI_VERSION) {
+            spdlog::error ("{}: plugin {} speaks abi version {}, expected {}",
+                           lib->path.string (), i, desc->abi_version,
+                           AU_PLUGIN_ABI_VERSION);
+            return nullptr;
+        }
+        if (!desc->id || !desc->create || !desc->destroy || !desc->process
+            || !desc->channels || desc->channels > AU_PLUGIN_MAX_CHANNELS
+            || (desc->param_count && !desc->params)) {
+            spdlog::error ("{}: plugin {} has an incomplete descriptor",
+                           lib->path.string (), i);
+            return nullptr;
+        }
+        lib->descriptors.push_back (desc);
+    }
+    if (lib->descriptors.empty ()) {
+        spdlog::error ("{} contains no plugins", lib->path.string ());
+        return nullptr;
+    }
+
+    spdlog::info ("Loaded {} plugins from {}", lib->descriptors.size (),
+                  lib->path.string ());
+    return lib;
+}
+
+const auPluginDescriptor *auPluginLibrary::find (const std::string &id) const {
+    for (const auPluginDescriptor *desc : descriptors) {
+        if (id == desc->id) return desc;
+    }
+    return nullptr;
+}
+
+auPluginNode::auPluginNode (std::shared_ptr<auPluginLibrary> library,
+                            const auPluginDescriptor        *desc,
+                            unsigned int sample_rate, size_t max_frames) :
+    library (std::move (library)), desc (desc), sample_rate (sample_rate),
+    max_frames (max_frames), changes (AU_PLUGIN_MAX_EVENTS) {
+    instance = desc->create (sample_rate, uint32_t (max_frames));
+    if (!instance) {
+        spdlog::error ("Plugin {} failed to create an instance", desc->id);
+        return;
+    }
+    apply_defaults ();
+    reset ();
+}
+
+auPluginNode::~auPluginNode () {
+    if (instance) desc->destroy (instance);
+}
+
+// parameters only reach a plugin as events, so the defaults go in on
+// single frames of silence. the queue would drop those past its capacity
+void auPluginNode::apply_defaults () {
+    std::vector<float>   silence (desc->channels, 0.f);
+    std::vector<float *> channels (desc->channels);
+
+    for (uint32_t first = 0; first < desc->param_count;
+         first += AU_PLUGIN_MAX_EVENTS) {
+        uint32_t count = std::min<uint32_t> (desc->param_count - first,
+                                             AU_PLUGIN_MAX_EVENTS);
+        for (uint32_t i = 0; i < count; i++) {
+            events[i] = { 0, first + i, desc->params[first + i].def };
+        }
+        for (unsigned int ch = 0; ch < desc->channels; ch++) {
+            silence[ch]  = 0.f;
+            channels[ch] = &silence[ch];
+        }
+
+        auPluginBlock block;
+        block.channels      = channels.data ();
+        block.channel_count = desc->channels;
+        block.frames        = 1;
+        block.events        = events;
+        block.event_count   = count;
+        block.frame_time    = 0;
+        desc->process (instance, &block);
+    }
+}
+
+void auPluginNode::reset () {
+    if (instance && desc->reset) desc->reset (instance);
+}
+
+bool auPluginNode::set_param (uint32_t param, float value, uint64_t frame) {
+    if (param >= desc->param_count) return false;
+    const auPluginParamInfo &info = desc->params[param];
+    return changes.push ({ frame, param,
+                           std::clamp (value, info.min, info.max) });
+}
+
+uint32_t auPluginNode::get_latency () const {
+    return instance && desc->get_latency ? desc->get_latency (instance) : 0;
+}
+
+uint32_t auPluginNode::get_tail () const {
+    return instance && desc->get_tail ? desc->get_tail (instance) : 0;
+}
+
+void auPluginNode::prepare (unsigned int rate, size_t frames) {
+    // the instance keeps its rate, larger blocks are split in process
+    if (rate != sample_rate) {
+        spdlog::warn ("Plugin {} runs at {} Hz inside a {} Hz graph",
+                      desc->id, sample_rate, rate);
+    }
+}
+
+// moves the events due within the next `frames` into `events`, later ones
+// stay held for the following blocks
+size_t auPluginNode::collect_events (size_t frames) {
+    auPluginParamChange change;
+    while (held_count < AU_PLUGIN_MAX_EVENTS && changes.pop (&change)) {
+        held[held_count++] = change;
+    }
+
+    uint64_t now = frame_time.load (std::memory_order_relaxed);
+
+    size_t count = 0, kept = 0;
+    for (size_t i = 0; i < held_count; i++) {
+        const auPluginParamChange &c = held[i];
+        if (c.frame >= now + frames) {
+            held[kept++] = c;
+            continue;
+        }
+        auPluginEvent e {
+            uint32_t (c.frame > now ? c.frame - now : 0),
+            c.param, c.value
+        };
+        // insertion sort, stable so equal offsets keep their send order
+        size_t j = count++;
+        while (j > 0 && events[j - 1].offset > e.offset) {
+            events[j] = events[j - 1];
+            j--;
+        }
+        events[j] = e;
+    }
+    held_count = kept;
+    return count;
+}
+
+void auPluginNode::process (const float *const *inputs,
+                            float *const *outputs, size_t frames) {
+    for (unsigned int ch = 0; ch < desc->channels; ch++) {
+        if (inputs[ch] != outputs[ch]) {
+            memcpy (outputs[ch], inputs[ch], frames * sizeof (float));
+        }
+    }
+    if (!instance) return;
+
+    float   *channels[AU_PLUGIN_MAX_CHANNELS];
+    uint64_t time = frame_time.load (std::memory_order_relaxed);
+    for (size_t done = 0; done < frames; done += max_frames) {
+        size_t n = std::min (frames - done, max_frames);
+        for (unsigned int ch = 0; ch < desc->channels; ch++) {
+            channels[ch] = outputs[ch] + done;
+        }
+
+        auPluginBlock block;
+        block.channels      = channels;
+        block.channel_count = desc->channels;
+        block.frames        = uint32_t (n);
+        block.events        = events;
+        block.event_count   = uint32_t (collect_events (n));
+        block.frame_time    = time;
+        desc->process (instance, &block);
+
+        time += n;
+        frame_time.store (time, std::memory_order_relaxed);
+    }
+}